@@ -0,0 +1,47 @@
+#ifndef CLOUDLAB_ARENA_HH
+#define CLOUDLAB_ARENA_HH
+
+#include <google/protobuf/arena.h>
+
+namespace cloudlab {
+
+    // memory every thread keeps for the messages of one request, larger
+    // requests take additional blocks until they are done
+    const auto request_arena_block = 64 * 1024;
+
+    /**
+     * Scope of the protobuf arena of the current thread. The messages of a
+     * request are created on the arena and freed at once when the outermost
+     * scope ends. The first block of the arena is reused by the next request,
+     * so a typical request allocates its messages, strings and repeated
+     * fields without calling malloc. Scopes nest, e.g. a handler function
+     * called from handle_connection(); messages must not outlive the
+     * outermost scope. A nested scope frees nothing, so messages that are
+     * created per key or per peer of a request live on the stack instead.
+     */
+    class ArenaScope {
+    public:
+        ArenaScope();
+
+        ~ArenaScope();
+
+        ArenaScope(const ArenaScope &) = delete;
+
+        auto operator=(const ArenaScope &) -> ArenaScope & = delete;
+
+        template<typename T>
+        auto create() -> T & {
+            return *google::protobuf::Arena::CreateMessage<T>(arena);
+        }
+
+        [[nodiscard]] auto get() const -> google::protobuf::Arena * {
+            return arena;
+        }
+
+    private:
+        google::protobuf::Arena *arena;
+    };
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_ARENA_HH
@@ -0,0 +1,106 @@
+#ifndef CLOUDLAB_CACHE_HH
+#define CLOUDLAB_CACHE_HH
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace cloudlab {
+
+    const auto cache_shards = 16;
+
+    // default memory budget of the hot-key cache, 0 disables the cache
+    const size_t default_cache_capacity = 64 * 1024 * 1024;
+
+    /**
+     * Sharded read-through cache for hot key-value pairs in front of the
+     * storage engine. Every shard runs the CLOCK algorithm over a ring of
+     * slots: a hit only sets the reference bit of its slot, and the clock hand
+     * gives referenced slots a second chance before evicting them. The memory
+     * budget is split evenly across the shards.
+     */
+    class Cache {
+    public:
+        struct Stats {
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t inserts;
+            uint64_t evictions;
+            uint64_t invalidations;
+            uint64_t entries;
+            uint64_t bytes;
+            uint64_t capacity;
+        };
+
+        explicit Cache(size_t capacity = default_cache_capacity);
+
+        Cache(const Cache &) = delete;
+
+        auto operator=(const Cache &) -> Cache & = delete;
+
+        auto enabled() const -> bool {
+            return capacity > 0;
+        }
+
+        auto get(const std::string &key, std::string &value) -> bool;
+
+        auto put(const std::string &key, const std::string &value) -> void;
+
+        auto erase(const std::string &key) -> void;
+
+        auto clear() -> void;
+
+        auto stats() const -> Stats;
+
+    private:
+        struct Slot {
+            std::string key;
+            std::string value;
+            std::atomic<bool> referenced{false};
+            bool used{false};
+        };
+
+        struct Shard {
+            mutable std::shared_mutex mtx;
+            std::unordered_map<std::string, size_t> index;
+            // slots never move, so the reference bits can be set under a
+            // shared lock
+            std::deque<Slot> slots;
+            std::vector<size_t> free;
+            size_t hand{};
+            size_t bytes{};
+        };
+
+        static auto charge(const std::string &key, const std::string &value) -> size_t {
+            // the key is stored twice (index and slot), plus bookkeeping
+            return 2 * key.size() + value.size() + sizeof(Slot) + 32;
+        }
+
+        auto shard(const std::string &key) -> Shard & {
+            return shards[std::hash<std::string>{}(key) % cache_shards];
+        }
+
+        auto evict(Shard &s, size_t needed) -> void;
+
+        auto release(Shard &s, size_t slot) -> void;
+
+        const size_t capacity;
+        const size_t shard_capacity;
+        std::array<Shard, cache_shards> shards;
+
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+        std::atomic<uint64_t> inserts{0};
+        std::atomic<uint64_t> evictions{0};
+        std::atomic<uint64_t> invalidations{0};
+    };
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_CACHE_HH
@@ -0,0 +1,144 @@
+#ifndef CLOUDLAB_ASYNC_CLIENT_HH
+#define CLOUDLAB_ASYNC_CLIENT_HH
+
+#include "cloudlab/client/client.hh"
+
+#include "cloud.pb.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cloudlab {
+
+struct AsyncClientOptions {
+  // connections to the leader that requests are spread over
+  size_t connections{2};
+
+  // requests sent on a connection without a response yet
+  size_t max_in_flight{32};
+
+  // operations merged into one request
+  size_t max_batch{128};
+};
+
+/**
+ * Asynchronous client. Operations return immediately and complete through a
+ * callback or a future. Concurrent operations of the same kind are merged
+ * into one multi-key request, and requests are pipelined over a few
+ * persistent connections to the leader, each with a bound on the requests in
+ * flight. Responses arrive in request order per connection.
+ *
+ * Requests that fail on a pipelined connection (leader change, lost
+ * connection) are retried through the synchronous Client, which follows
+ * redirects; the connection is then re-established to the new leader. Writes
+ * of one batch are applied atomically, and a retried batch may be reordered
+ * with batches that were sent after it.
+ */
+class AsyncClient {
+ public:
+  // `ok` is false if the operation failed; `value` is the value of a GET
+  using Callback = std::function<void(bool ok, const std::string& value)>;
+
+  explicit AsyncClient(const std::vector<std::string>& seeds,
+                       const AsyncClientOptions& options = {});
+
+  // completes all outstanding operations
+  ~AsyncClient();
+
+  // delete copy constructor and copy assignment
+  AsyncClient(const AsyncClient&) = delete;
+  auto operator=(const AsyncClient&) -> AsyncClient& = delete;
+
+  auto get(const std::string& key, Callback done) -> void;
+
+  auto put(const std::string& key, const std::string& value, Callback done)
+      -> void;
+
+  auto remove(const std::string& key, Callback done) -> void;
+
+  auto get(const std::string& key) -> std::future<std::optional<std::string>>;
+
+  auto put(const std::string& key, const std::string& value)
+      -> std::future<bool>;
+
+  auto remove(const std::string& key) -> std::future<bool>;
+
+  // wait until every operation submitted so far has completed
+  auto flush() -> void;
+
+ private:
+  struct Op {
+    cloud::CloudMessage_Operation operation;
+    std::string key;
+    std::string value;
+    Callback done;
+  };
+
+  struct Batch {
+    cloud::CloudMessage request;
+    std::vector<Callback> done;
+  };
+
+  // one pipelined connection; the connection is only replaced by the
+  // dispatcher while nothing is in flight
+  struct Lane {
+    std::unique_ptr<Connection> con;
+    std::deque<std::shared_ptr<Batch>> in_flight;
+    // the connection broke or points to a former leader; no new requests
+    // until the in-flight ones are back
+    bool stale{true};
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::thread receiver;
+  };
+
+  auto submit(Op op) -> void;
+
+  auto dispatcher() -> void;
+
+  auto receiver(Lane& lane) -> void;
+
+  // send a batch on the least loaded lane, or synchronously without a lane
+  auto send(std::shared_ptr<Batch> batch) -> void;
+
+  // (re)connect a lane to the current leader, requires the lane lock
+  auto connect(Lane& lane) -> bool;
+
+  auto complete(Batch& batch, const cloud::CloudMessage& response, bool ok)
+      -> void;
+
+  // retry a batch through the synchronous client
+  auto retry(Batch& batch) -> void;
+
+  const AsyncClientOptions options;
+  Client client;
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::deque<Op> queue;
+  bool stopping{false};
+
+  // set once the dispatcher is gone, stops the receivers
+  std::atomic<bool> closed{false};
+
+  // operations submitted but not completed, for flush()
+  std::atomic<size_t> outstanding{0};
+  std::mutex done_mtx;
+  std::condition_variable done_cv;
+
+  std::vector<std::unique_ptr<Lane>> lanes;
+  std::thread dispatch_thread;
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_ASYNC_CLIENT_HH
@@ -0,0 +1,107 @@
+#ifndef CLOUDLAB_CLIENT_HH
+#define CLOUDLAB_CLIENT_HH
+
+#include "cloudlab/network/address.hh"
+#include "cloudlab/network/connection.hh"
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cloud {
+class CloudMessage;
+}
+
+namespace cloudlab {
+
+// attempts per request, redirects and retries during an election included
+const auto client_max_attempts = 20;
+
+// pause before asking again while the cluster has no leader
+const auto client_retry_delay = std::chrono::milliseconds(250);
+
+/**
+ * Client for the key-value store. Requests go straight to the raft leader:
+ * the client caches the leader address, follows the redirects of followers,
+ * asks the seed nodes with RAFT_GET_LEADER when it lost track of the leader,
+ * and keeps one persistent connection per node. A failover thus costs a
+ * retry inside the client instead of a failed request.
+ *
+ * Seeds can be P2P or API addresses; redirects always point to the P2P
+ * address of the leader. A client may be shared between threads, requests are
+ * serialized.
+ *
+ * A client is a session: it remembers the log index of its last write and of
+ * the newest state it read, and follower reads never see older state.
+ */
+class Client {
+ public:
+  explicit Client(const std::vector<std::string>& seeds);
+
+  // delete copy constructor and copy assignment
+  Client(const Client&) = delete;
+  auto operator=(const Client&) -> Client& = delete;
+
+  auto get(const std::string& key, std::string& value) -> bool;
+
+  auto put(const std::string& key, const std::string& value) -> bool;
+
+  auto remove(const std::string& key) -> bool;
+
+  // one page of an ordered scan, see KVS::scan()
+  auto scan(const std::string& start, const std::string& end, uint32_t limit,
+            std::vector<std::pair<std::string, std::string>>& buffer,
+            std::string& next) -> bool;
+
+  /**
+   * Read `key` from one of the seeds, typically a follower, if its state is
+   * at most `max_staleness` old and includes log index `min_applied_index`
+   * (0 disables a bound) as well as the session token. The seeds take turns;
+   * a node that does not qualify redirects to the leader, which serves the
+   * read instead.
+   */
+  auto follower_get(const std::string& key, std::string& value,
+                    std::chrono::milliseconds max_staleness,
+                    uint64_t min_applied_index = 0) -> bool;
+
+  /**
+   * Send a request to the leader and follow redirects until the leader
+   * answers. Returns false if no leader could be reached; otherwise the
+   * response is that of the leader, successful or not.
+   */
+  auto execute(const cloud::CloudMessage& request,
+               cloud::CloudMessage& response) -> bool;
+
+  // the newest log index this session wrote or read
+  auto session_token() -> uint64_t;
+
+  // the cached leader, if any
+  auto leader() -> std::optional<SocketAddress>;
+
+  // ask the seeds for the current leader
+  auto refresh_leader() -> bool;
+
+ private:
+  auto refresh_leader_locked() -> bool;
+
+  // one round trip on the persistent connection to `peer`
+  auto round_trip(const SocketAddress& peer, const cloud::CloudMessage& request,
+                  cloud::CloudMessage& response) -> bool;
+
+  std::mutex mtx;
+  std::vector<SocketAddress> seeds;
+  // the seed for the next follower read
+  size_t next_seed{};
+  uint64_t session_index{};
+  std::optional<SocketAddress> leader_address{};
+  std::unordered_map<SocketAddress, std::unique_ptr<Connection>> connections;
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_CLIENT_HH
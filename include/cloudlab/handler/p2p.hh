@@ -2,19 +2,26 @@
 #define CLOUDLAB_P2P_HH
 
 #include "cloudlab/handler/handler.hh"
+#include "cloudlab/handler/transfer.hh"
 #include "cloudlab/kvs.hh"
 #include "cloudlab/network/routing.hh"
 #include "cloudlab/raft/raft.hh"
 
 namespace cloudlab {
 
+// upper bound for the number of key-value pairs in one SCAN page
+const auto max_scan_limit = 1000;
+
+// upper bound for the payload of one SCAN page
+const auto max_scan_bytes = 1024 * 1024;
+
 /**
  * Handler for P2P requests. Takes care of the messages from peers, cluster
  * metadata / routing tier, and the API.
  */
 class P2PHandler : public ServerHandler {
  public:
-  explicit P2PHandler(Routing& routing);
+  explicit P2PHandler(Routing& routing, const StorageOptions& options = {});
 
   auto handle_connection(Connection& con) -> void override;
 
@@ -35,15 +42,41 @@ class P2PHandler : public ServerHandler {
   }
 
   auto raft_run() -> std::thread {
-    return raft->run(routing, mtx);
+    return raft->run(routing);
+  }
+
+  // for monitoring, none of these take a lock
+  auto raft_status() -> RaftStatus {
+    return raft->status();
+  }
+
+  auto cache_stats() const -> Cache::Stats {
+    return raft->cache_stats();
+  }
+
+  auto storage_statistics() -> std::vector<std::pair<std::string, uint64_t>> {
+    return raft->storage().engine_statistics();
+  }
+
+  // persist the state of the storage engine, see StorageEngine::snapshot()
+  auto snapshot() -> bool {
+    return raft->snapshot();
   }
 
+  /**
+   * Leader only: split the hottest partition if it serves more than its share
+   * of the requests since the last round, place the partitions on the nodes
+   * by load, copy partitions to their new owners, and broadcast the placement.
+   */
+  auto rebalance() -> bool;
+
  private:
   // clang-format off
   auto handle_put(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_get(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_delete(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_key_operation_leader(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_scan(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_join_cluster(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_create_partitions(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_steal_partitions(Connection& con, const cloud::CloudMessage& msg) -> void;
@@ -52,15 +85,53 @@ class P2PHandler : public ServerHandler {
   auto handle_raft_append_entries(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_raft_vote(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_raft_dropped_node(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_raft_add_node(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_raft_remove_node(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_raft_transfer_leadership(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_raft_timeout_now(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_raft_get_leader(Connection& con, const cloud::CloudMessage& msg) -> void;
   auto handle_raft_direct_get(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_partitions_added(Connection& con, const cloud::CloudMessage& msg) -> void;
+  auto handle_stats(Connection& con, const cloud::CloudMessage& msg) -> void;
   // clang-format on
 
+  // requires mtx
+  auto drop_unowned_partitions() -> void;
+
+  // give up the imports whose source fell silent, requires imports_mtx
+  auto expire_imports() -> void;
+
+  // leader: add a learner and tell it who leads the group
+  auto add_node(const SocketAddress& node) -> bool;
+
+  // reads a key of a partition that is placed on another node; false if no
+  // owner is known or answered, otherwise `found` tells whether the key exists
+  auto forward_get(const std::string& key, std::string& value, bool& found)
+      -> bool;
+
+  // merges the local scan with the scans of the owners of the other partitions
+  auto scan_cluster(const std::string& start, const std::string& end,
+                    size_t limit,
+                    std::vector<std::pair<std::string, std::string>>& page,
+                    std::string& next) -> bool;
+
+  auto copy_partition(uint32_t id, const SocketAddress& source,
+                      const SocketAddress& destination) -> bool;
+
   std::unordered_map<uint32_t, std::unique_ptr<KVS>> partitions{};
 
   std::unique_ptr<Raft> raft;
   Routing& routing;
+  // orders placement changes with dropping the partitions we no longer own;
+  // raft has its own locks
   std::mutex mtx;
+
+  // exported / received partition files are staged next to the db
+  std::string staging_prefix;
+
+  // incoming partition transfers
+  std::mutex imports_mtx;
+  std::unordered_map<uint32_t, std::unique_ptr<PartitionImport>> imports{};
 };
 
 }  // namespace cloudlab
@@ -0,0 +1,85 @@
+#ifndef CLOUDLAB_TRANSFER_HH
+#define CLOUDLAB_TRANSFER_HH
+
+#include "cloudlab/kvs.hh"
+#include "cloudlab/network/address.hh"
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace cloud {
+class CloudMessage;
+}
+
+namespace cloudlab {
+
+// size of the file pieces a partition is streamed in
+const auto transfer_chunk_size = 1024 * 1024;
+
+// the destination gives up a transfer whose source fell silent this long
+const auto transfer_idle_timeout = std::chrono::seconds(30);
+
+/**
+ * Moves one partition to another node:
+ *
+ *  1. start capturing writes to the partition,
+ *  2. export it into files (SST files for rocksdb),
+ *  3. create the partition on the destination and stream the files in
+ *     chunks, the destination ingests them as a whole,
+ *  4. catch up with the writes captured during the copy,
+ *  5. freeze the partition, ship the last few writes and the applied index
+ *     as of the freeze, and call `on_switch` (e.g. to update the routing)
+ *     before the partition is unfrozen.
+ *
+ * Writes wait during step 5, which takes two round trips. The destination
+ * holds back the raft writes to the partition until the end, see
+ * KVS::begin_import().
+ */
+auto transfer_partition(KVS& kvs, uint32_t id, const SocketAddress& destination,
+                        const std::string& staging_dir,
+                        const std::function<void()>& on_switch) -> bool;
+
+/**
+ * Receiving side of a transfer. Chunks are appended to files in a staging
+ * directory until the source asks to ingest them. An import that is
+ * destroyed before the source finished it drops the partition again.
+ */
+class PartitionImport {
+ public:
+  PartitionImport(KVS& kvs, uint32_t id, std::string staging_dir);
+
+  ~PartitionImport();
+
+  PartitionImport(const PartitionImport&) = delete;
+
+  auto operator=(const PartitionImport&) -> PartitionImport& = delete;
+
+  // handle one TRANSFER_PARTITION notification, see cloud::CloudMessage::Chunk
+  auto receive(const cloud::CloudMessage& msg) -> bool;
+
+  // the source finished the transfer, the import can go
+  [[nodiscard]] auto finished() const -> bool {
+    return done;
+  }
+
+  // since the last chunk
+  [[nodiscard]] auto idle() const -> std::chrono::steady_clock::duration {
+    return std::chrono::steady_clock::now() - last_chunk;
+  }
+
+ private:
+  auto remove_files() -> void;
+
+  KVS& kvs;
+  const uint32_t id;
+  const std::string staging_dir;
+  std::vector<std::string> files;
+  bool done{false};
+  std::chrono::steady_clock::time_point last_chunk;
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_TRANSFER_HH
@@ -1,41 +1,61 @@
 #ifndef CLOUDLAB_KVS_HH
 #define CLOUDLAB_KVS_HH
 
-#include <deque>
+#include <atomic>
+#include <condition_variable>
 #include <filesystem>
-#include <set>
+#include <map>
+#include <memory>
+#include <optional>
 #include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 
-#include "rocksdb/db.h"
-#include "rocksdb/options.h"
-#include "rocksdb/slice.h"
+#include "cloudlab/cache.hh"
+#include "cloudlab/sharding.hh"
+#include "cloudlab/storage/engine.hh"
 
-// actually 840 is a good number
+// initial number of partitions, hot partitions are split at runtime
 const auto partitions = 4;
 
-namespace rocksdb {
-    class DB;
+namespace cloudlab {
 
-    class Iterator;
+    struct StorageOptions {
+        EngineType engine{EngineType::ROCKSDB};
 
-    class ColumnFamilyHandle;
-}  // namespace rocksdb
+        // memory budget of the hot-key cache, 0 disables the cache
+        size_t cache_capacity{default_cache_capacity};
 
-namespace cloudlab {
+        // the raft log is synced to disk and replayed on recovery, so the
+        // storage engine can skip its own write-ahead log
+        bool durable_log{false};
+    };
 
 /**
- * The key-value store. We use rocksdb for the actual key-value operations.
+ * The key-value store. The actual key-value operations are delegated to a
+ * storage engine (rocksdb by default).
  */
     class KVS {
     public:
         struct Sentinel {
         };
 
+        /**
+         * Iterates over all partitions in key order. Every partition is a
+         * sorted run, so we keep one cursor per partition and merge them with
+         * a min-heap (k-way merge).
+         */
         struct Iterator {
-            std::deque<rocksdb::Iterator *> iterators;
+            Iterator() = default;
+
+            explicit Iterator(std::vector<std::unique_ptr<Cursor>> cursors);
 
-            ~Iterator();
+            Iterator(Iterator &&other) noexcept = default;
+
+            auto operator=(Iterator &&other) noexcept -> Iterator & = default;
+
+            // position every partition cursor at the first key >= key
+            auto seek(const std::string &key) -> void;
 
             friend auto operator==(const Iterator &it, const Sentinel &) -> bool;
 
@@ -44,22 +64,24 @@ namespace cloudlab {
             auto operator*() -> std::pair<std::string_view, std::string_view>;
 
             auto operator++() -> Iterator &;
-        };
-
-        explicit KVS(const std::string &path = {}, bool open = false) : path{path} {
-            if (open) this->open();
-        }
 
-        struct Partition {
-            rocksdb::DB *db;
-            rocksdb::ColumnFamilyHandle *handle;
+        private:
+            auto rebuild_heap() -> void;
 
-            [[nodiscard]] auto begin() const -> Iterator;
+            // one cursor per partition
+            std::vector<std::unique_ptr<Cursor>> cursors;
 
-            [[nodiscard]] auto end() const -> Sentinel;
+            // valid cursors, ordered as a min-heap on their current key
+            std::vector<Cursor *> heap;
         };
 
-        ~KVS();
+        explicit KVS(const std::string &path = {}, bool open = false, const StorageOptions &options = {})
+                : path{path}, options{options}, engine{make_engine(options.engine, path, options.durable_log)},
+                  map{partitions}, cache{options.cache_capacity} {
+            if (open) this->open();
+        }
+
+        ~KVS() = default;
 
         // delete copy constructor and copy assignment
         KVS(const KVS &) = delete;
@@ -68,6 +90,9 @@ namespace cloudlab {
 
         [[nodiscard]] auto begin() -> Iterator;
 
+        // `ids` restricts the iterator to some partitions, empty means all
+        [[nodiscard]] auto seek(const std::string &key, const std::vector<size_t> &ids = {}) -> Iterator;
+
         [[nodiscard]] auto end() const -> Sentinel;
 
         auto open() -> bool;
@@ -77,59 +102,192 @@ namespace cloudlab {
         auto get_all(std::vector<std::pair<std::string, std::string>> &buffer)
         -> bool;
 
+        /**
+         * Returns up to `limit` key-value pairs in key order from [start, end).
+         * An empty `end` means no upper bound. The page is also cut once it
+         * exceeds `max_bytes`. `next` is set to the key the following page
+         * starts at, or left empty if the range is exhausted.
+         */
+        auto scan(const std::string &start, const std::string &end, size_t limit,
+                  size_t max_bytes,
+                  std::vector<std::pair<std::string, std::string>> &buffer,
+                  std::string &next, const std::vector<size_t> &ids = {}) -> bool;
+
         auto put(const std::string &key, const std::string &value) -> bool;
 
         auto remove(const std::string &key) -> bool;
 
-        auto create_partition(size_t id) {
-            rocksdb::ColumnFamilyHandle *cf;
-            if (!has_partition(id)) db->CreateColumnFamily(rocksdb::ColumnFamilyOptions(), std::to_string(id), &cf);
-            partition_handles.emplace_back(cf);
+        /**
+         * Apply the writes of raft log entry `index` atomically. The partition
+         * of every mutation is derived from its key.
+         */
+        auto apply(std::vector<Mutation> &batch, uint64_t index) -> bool;
+
+        // index of the last raft log entry that was applied to this store
+        auto applied_index() -> uint64_t;
+
+        auto create_partition(size_t id) -> bool;
+
+        auto remove_partition(size_t id) -> bool;
+
+        auto key_to_partition(std::string_view key) const -> size_t {
+            return map.partition(key);
         }
 
-        auto remove_partition(size_t id) {
-            auto k = std::find_if(partition_handles.begin(), partition_handles.end(),
-                                  [&id](rocksdb::ColumnFamilyHandle *handle) {
-                                      return handle->GetName() == std::to_string(id);
-                                  });
-            if (k != partition_handles.end()) {
-                db->DropColumnFamily(*k);
-                db->DestroyColumnFamilyHandle(*k);
-                partition_handles.erase(k);
-            }
+        auto has_partition(size_t id) -> bool;
+
+        // partitions stored on this node
+        auto partition_ids() -> std::vector<size_t>;
+
+        // all partitions of the cluster
+        auto cluster_partition_ids() const -> std::vector<size_t> {
+            return map.ids();
         }
 
-        static auto key_to_partition(const std::string &key) -> size_t {
-            return std::hash<std::string>{}(key) % partitions;
+        auto partition_map() const -> const PartitionMap & {
+            return map;
         }
 
-        auto has_partition(size_t id) -> bool {
-            return partition(id).handle != nullptr;
+        /**
+         * Split a hot partition as raft log entry `index`: the given hash
+         * buckets of `source` move to the new partition `target`. The keys
+         * move locally if this node stores `source`; the partition map
+         * changes on every node.
+         */
+        auto split_partition(size_t source, size_t target, const std::vector<uint32_t> &buckets, uint64_t index)
+        -> bool;
+
+        // requests and bytes per hash bucket since the last call
+        auto take_load() -> std::vector<Load> {
+            return load.take();
         }
 
-        auto has_partition_for_key(const std::string &key) -> bool {
-            return has_partition(key_to_partition(key));
+        // count a request that was served on behalf of this store elsewhere
+        auto record_load(std::string_view key, size_t bytes) -> void {
+            load.record(key, bytes);
         }
 
-        auto partition(size_t id) -> Partition {
-            auto k = std::find_if(partition_handles.begin(), partition_handles.end(),
-                                  [&id](rocksdb::ColumnFamilyHandle *handle) {
-                                      return handle->GetName() == std::to_string(id);
-                                  });
-            if (k == partition_handles.end()) return {db, nullptr};
-            else return {db, *k};
+        auto has_partition_for_key(const std::string &key) -> bool {
+            return has_partition(key_to_partition(key));
         }
 
         auto clear() -> bool;
 
         auto clear_partition(size_t id) -> bool;
+
+        // persist the engine state, e.g. write the in-memory engine to disk
+        auto snapshot() -> bool;
+
+        // the latest value per key, std::nullopt for a delete
+        using Writes = std::map<std::string, std::optional<std::string>>;
+
+        /**
+         * Partition transfer: while a partition is exported, the writes to it
+         * are captured so that they can be replayed on the destination.
+         * take_capture() hands over and resets the captured writes; with
+         * `freeze` all further writes to the partition wait until
+         * end_capture(), which gives the final catch-up a stable end.
+         */
+        auto begin_capture(size_t id) -> void;
+
+        auto take_capture(size_t id, bool freeze) -> Writes;
+
+        auto end_capture(size_t id) -> void;
+
+        /**
+         * Receiving side of a transfer: the copy of the source is older than
+         * the raft writes this node applies meanwhile, so apply() holds those
+         * back until end_import(). `covered` is the applied index of the
+         * source when it froze the partition; held writes beyond it are
+         * written, later entries up to it are skipped as the copy has them.
+         * An importing partition is not served, see has_partition().
+         */
+        auto begin_import(size_t id) -> void;
+
+        auto end_import(size_t id, uint64_t covered) -> bool;
+
+        auto abort_import(size_t id) -> void;
+
+        auto export_partition(size_t id, const std::string &dir, std::vector<std::string> &files) -> bool;
+
+        auto ingest_partition(size_t id, const std::vector<std::string> &files) -> bool;
+
+        // write the catch-up of a transfer directly into a partition
+        auto apply_writes(size_t id, const Writes &writes) -> bool;
+
+        auto cache_stats() const -> Cache::Stats {
+            return cache.stats();
+        }
+
+        // counters of the storage engine, see StorageEngine::statistics()
+        auto engine_statistics() -> std::vector<std::pair<std::string, uint64_t>> {
+            return engine->statistics();
+        }
+
     private:
+        // lazily open the engine on first use
+        auto ensure_open() -> void {
+            if (!opened.load(std::memory_order_acquire)) open();
+        }
+
+        auto load_map() -> void;
+
+        auto store_map() -> bool;
+
+        // wait until no transfer freezes a partition of `batch`
+        auto wait_unfrozen(std::unique_lock<std::shared_mutex> &lock, const std::vector<Mutation> &batch) -> void;
+
+        // records a write for a running transfer, requires the exclusive lock
+        auto capture(std::string_view key, const std::optional<std::string_view> &value) -> void;
+
+        // drops the writes to imported partitions from `batch`, requires the
+        // exclusive lock
+        auto hold_back(std::vector<Mutation> &batch, uint64_t index) -> void;
+
+        // requires mtx
+        auto importing(size_t id) const -> bool {
+            auto it = imports.find(id);
+            return it != imports.end() && !it->second.covered;
+        }
+
+        struct Capture {
+            bool frozen{false};
+            Writes writes;
+        };
+
+        struct HeldWrite {
+            uint64_t index;
+            std::string key;
+            std::optional<std::string> value;
+        };
+
+        struct Import {
+            // raft writes to the partition, in log order
+            std::vector<HeldWrite> held;
+            // set by end_import()
+            std::optional<uint64_t> covered;
+        };
+
         std::filesystem::path path;
-        rocksdb::DB *db{};
-        std::vector<rocksdb::ColumnFamilyHandle *> partition_handles;
+        const StorageOptions options;
+        std::unique_ptr<StorageEngine> engine;
+        std::atomic<bool> opened{false};
+
+        // key to partition, persisted next to the store as it changes by splits
+        PartitionMap map;
+        LoadTracker load;
+
+        // readers share the lock, writers and partition changes are exclusive
+        std::shared_mutex mtx;
+
+        // hot keys, filled under the shared lock and invalidated under the
+        // exclusive one, so a fill can never resurrect an overwritten value
+        Cache cache;
 
-        std::set<size_t> partition_exists;
-        std::mutex mtx;
+        // partitions that are currently transferred, guarded by mtx
+        std::unordered_map<size_t, Capture> captures;
+        std::condition_variable_any unfrozen;
+        std::unordered_map<size_t, Import> imports;
     };
 
 }  // namespace cloudlab
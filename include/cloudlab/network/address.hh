@@ -1,46 +1,53 @@
 #ifndef CLOUDLAB_ADDRESS_HH
 #define CLOUDLAB_ADDRESS_HH
 
-#include <array>
+#include <cstring>
 #include <string>
 
-namespace cloudlab {
+#include <sys/socket.h>
 
-enum class IPAddressType {
-  V4,
-  V6
-};
+namespace cloudlab {
 
 /**
- * Representation of an IPv4 / IPv6 address plus port.
+ * Representation of an IPv4 / IPv6 address plus port. The address is kept in
+ * its resolved binary form, so it can be passed to connect() / bind()
+ * directly, and comparing or hashing it never allocates.
  */
 class SocketAddress {
  public:
   explicit SocketAddress(const std::string& address);
 
   friend bool operator==(SocketAddress const& lhs, SocketAddress const& rhs) {
-    return lhs.type == rhs.type && lhs.port == rhs.port &&
-           lhs.ip_address == rhs.ip_address;
+    return lhs.hash_value == rhs.hash_value && lhs.length == rhs.length &&
+           std::memcmp(&lhs.storage, &rhs.storage, lhs.length) == 0;
   }
 
   [[nodiscard]] auto is_ipv4() const -> bool {
-    return type == IPAddressType::V4;
+    return storage.ss_family == AF_INET;
   }
 
-  [[nodiscard]] auto get_ip_address() const -> std::string const& {
-    return ip_address;
+  [[nodiscard]] auto get_ip_address() const -> std::string;
+
+  [[nodiscard]] auto get_port() const -> uint16_t;
+
+  [[nodiscard]] auto string() const -> std::string;
+
+  [[nodiscard]] auto sockaddr() const -> const struct sockaddr* {
+    return reinterpret_cast<const struct sockaddr*>(&storage);
   }
 
-  [[nodiscard]] auto get_port() const -> uint16_t {
-    return port;
+  [[nodiscard]] auto sockaddr_length() const -> socklen_t {
+    return length;
   }
 
-  [[nodiscard]] auto string() const -> std::string;
+  [[nodiscard]] auto hash() const -> std::size_t {
+    return hash_value;
+  }
 
  private:
-  IPAddressType type;
-  std::string ip_address;
-  uint16_t port;
+  struct sockaddr_storage storage {};
+  socklen_t length{};
+  std::size_t hash_value{};
 };
 
 }  // namespace cloudlab
@@ -50,10 +57,7 @@ namespace std {
 template <>
 struct hash<cloudlab::SocketAddress> {
   std::size_t operator()(const cloudlab::SocketAddress& k) const {
-    using std::hash;
-    using std::string;
-
-    return hash<string>()(k.string());
+    return k.hash();
   }
 };
 
@@ -9,7 +9,9 @@ class CloudMessage;
 
 namespace cloudlab {
 
-const auto max_message_size = 4096;
+// large enough for streamed partition chunks and the log records of one
+// AppendEntries request, see max_append_bytes
+const auto max_message_size = 64 * 1024 * 1024;
 
 /**
  * Representation of a (TCP) network connection.
@@ -30,9 +32,17 @@ class Connection {
 
   auto send(const cloud::CloudMessage& msg) const -> bool;
 
+  // abort a blocked receive() or send() from another thread, e.g. when the
+  // deadline of a request passed
+  auto shutdown() const -> void;
+
   bool connect_failed{false};
 
  private:
+  // read / write exactly `size` bytes, waiting for the socket if necessary
+  auto read_fully(void* buf, size_t size) const -> size_t;
+  auto write_fully(const void* buf, size_t size) const -> bool;
+
   int fd{-1};
   void* bev{nullptr};
 };
@@ -0,0 +1,48 @@
+#ifndef CLOUDLAB_METRICS_HH
+#define CLOUDLAB_METRICS_HH
+
+#include "cloudlab/handler/p2p.hh"
+#include "cloudlab/network/server.hh"
+
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace cloudlab {
+
+/**
+ * HTTP listener that serves the metrics of a node in the Prometheus text
+ * format on /metrics. Scrapes never take the raft locks: the histograms
+ * and counters are atomics, and the raft state comes from
+ * P2PHandler::raft_status().
+ */
+class MetricsServer {
+ public:
+  // `servers` are reported by name, e.g. their worker queue depth
+  MetricsServer(std::string address, P2PHandler& handler,
+                std::vector<std::pair<std::string, const Server*>> servers)
+      : address{std::move(address)},
+        handler{handler},
+        servers{std::move(servers)} {
+  }
+
+  MetricsServer(const MetricsServer&) = delete;
+  MetricsServer& operator=(const MetricsServer&) = delete;
+
+  auto run() -> std::thread;
+
+  // the current metrics in the Prometheus text format
+  auto render() -> std::string;
+
+ private:
+  auto serve() -> void;
+
+  const std::string address;
+  P2PHandler& handler;
+  const std::vector<std::pair<std::string, const Server*>> servers;
+};
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_METRICS_HH
@@ -5,6 +5,9 @@
 #include "cloudlab/network/address.hh"
 
 #include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <unordered_map>
 #include <unordered_set>
@@ -12,96 +15,168 @@
 
 namespace cloudlab {
 
-// actually 840 is a good number
-const auto cluster_partitions = 4;
-
 /**
- * Routing class to map keys to peers.
+ * Routing class to map partitions to peers. The membership of the cluster is
+ * kept apart from the placement: every member takes part in raft, but only
+ * the owners of a partition store it.
+ *
+ * The routing state is an immutable snapshot that is published through an
+ * atomic shared pointer. Readers grab the current snapshot without a lock
+ * and keep using it while writers publish new ones; writers copy the
+ * snapshot, change the copy and publish it (serialized among each other).
  */
 class Routing {
  public:
+  struct Table {
+    // partition -> owners, empty until the leader placed the partitions
+    std::unordered_map<uint32_t, std::vector<SocketAddress>> placement;
+
+    // the other voting nodes of the raft group, independent of the placement
+    std::vector<SocketAddress> members;
+
+    // nodes that receive the raft log but do not vote, see RaftConfig
+    std::vector<SocketAddress> learners;
+
+    // derived from placement: the first owner per partition, indexed by
+    // partition id, and the partitions per owner
+    std::vector<std::optional<SocketAddress>> owners;
+    std::unordered_map<SocketAddress, std::unordered_set<uint32_t>> by_peer;
+
+    // the first owner of a partition serves its reads
+    [[nodiscard]] auto find_peer(uint32_t partition) const
+        -> const SocketAddress* {
+      if (partition >= owners.size() || !owners[partition]) return nullptr;
+      return &*owners[partition];
+    }
+  };
+
   explicit Routing(const std::string& backend_address)
-      : backend_address{SocketAddress{backend_address}} {
+      : backend_address{SocketAddress{backend_address}},
+        table{std::make_shared<const Table>()} {
+  }
+
+  // the current routing state, never blocks
+  [[nodiscard]] auto snapshot() const -> std::shared_ptr<const Table> {
+    return table.load(std::memory_order_acquire);
   }
 
   auto add_peer(uint32_t partition, const SocketAddress& peer) {
-    if (table.contains(partition)) {
-      auto& peers = table.at(partition);
+    update([&](Table& t) {
+      auto& peers = t.placement[partition];
       if (std::find(peers.begin(), peers.end(), peer) == peers.end()) {
         peers.push_back(peer);
       }
-    } else {
-      table.insert({partition, {peer}});
-    }
+    });
   }
 
   auto remove_peer(uint32_t partition, const SocketAddress& peer) {
-    if (table.contains(partition)) {
-      auto& peers = table.at(partition);
-      peers.erase(std::remove(peers.begin(), peers.end(), peer), peers.end());
-    }
+    update([&](Table& t) {
+      if (t.placement.contains(partition)) {
+        auto& peers = t.placement.at(partition);
+        peers.erase(std::remove(peers.begin(), peers.end(), peer),
+                    peers.end());
+      }
+    });
   }
 
-  auto find_peer(const std::string& key) -> std::optional<SocketAddress> {
-    // map key to partition ID
-    // no need for a cryptographically secure hash function here
-    auto partition_id = Routing::get_partition(key);
-
-    // check if partition ID is in map and if there is at least one peer
-    if (table.contains(partition_id) && !table.at(partition_id).empty()) {
-      return {table.at(partition_id).front()};
-    }
-
+  auto find_peer(uint32_t partition) const -> std::optional<SocketAddress> {
+    auto t = snapshot();
+    if (const auto* peer = t->find_peer(partition)) return {*peer};
     return {};
   }
 
-  auto get_partition(const std::string& key) const -> uint32_t {
-    return std::hash<std::string>{}(key) % partitions;
+  // replace the whole placement, e.g. with the one broadcast by the leader
+  auto set_placement(
+      std::unordered_map<uint32_t, std::vector<SocketAddress>> placement)
+      -> void {
+    update([&](Table& t) { t.placement = std::move(placement); });
   }
 
-  auto partitions_by_peer()
-      -> std::unordered_map<SocketAddress, std::unordered_set<uint32_t>> {
-    std::unordered_map<SocketAddress, std::unordered_set<uint32_t>> tmp;
-
-    for (const auto& [partition, peers] : table) {
-      for (auto & peer : peers){
-        if (tmp.contains(peer)) {
-          tmp.at(peer).insert(partition);
-        } else {
-          tmp.insert({peer, {partition}});
-        }
+  auto add_member(const SocketAddress& peer) -> void {
+    if (peer == backend_address) return;
+    update([&](Table& t) {
+      if (std::find(t.members.begin(), t.members.end(), peer) ==
+          t.members.end()) {
+        t.members.push_back(peer);
       }
-    }
+    });
+  }
 
-    return tmp;
+  auto remove_member(const SocketAddress& peer) -> void {
+    update([&](Table& t) {
+      t.members.erase(std::remove(t.members.begin(), t.members.end(), peer),
+                      t.members.end());
+      t.learners.erase(std::remove(t.learners.begin(), t.learners.end(), peer),
+                       t.learners.end());
+    });
   }
 
-  auto get_cluster_address() -> std::optional<SocketAddress> {
-    return cluster_address;
+  // replace the membership, e.g. with the one of a raft CONFIG entry; only
+  // publishes actual changes
+  auto set_membership(std::vector<SocketAddress> members,
+                      std::vector<SocketAddress> learners) -> void {
+    auto current = snapshot();
+    if (current->members == members && current->learners == learners) return;
+    update([&](Table& t) {
+      t.members = std::move(members);
+      t.learners = std::move(learners);
+    });
   }
 
-  auto set_cluster_address(std::optional<SocketAddress> address) -> void {
-    cluster_address = std::move(address);
+  auto get_cluster_address() const -> std::optional<SocketAddress> {
+    auto address = cluster_address.load(std::memory_order_acquire);
+    if (!address) return {};
+    return {*address};
   }
 
-  auto get_backend_address() -> SocketAddress {
-    return backend_address;
+  auto set_cluster_address(std::optional<SocketAddress> address) -> void {
+    // set on every heartbeat, so only publish actual changes
+    auto current = cluster_address.load(std::memory_order_acquire);
+    if (!address) {
+      if (current) cluster_address.store(nullptr, std::memory_order_release);
+      return;
+    }
+    if (current && *current == *address) return;
+    cluster_address.store(
+        std::make_shared<const SocketAddress>(std::move(*address)),
+        std::memory_order_release);
   }
 
-  auto set_partitions_to_cluster_size() -> void {
-    partitions = cluster_partitions;
+  auto get_backend_address() const -> const SocketAddress& {
+    return backend_address;
   }
 
  private:
-  size_t partitions{1};
+  template <typename F>
+  auto update(F&& change) -> void {
+    std::lock_guard<std::mutex> lock(writer_mtx);
+    auto next = std::make_shared<Table>(*table.load(std::memory_order_acquire));
+    change(*next);
+    rebuild(*next);
+    table.store(std::move(next), std::memory_order_release);
+  }
 
-  std::unordered_map<uint32_t, std::vector<SocketAddress>> table;
+  // recompute the derived lookup structures of a table
+  static auto rebuild(Table& t) -> void {
+    t.owners.clear();
+    t.by_peer.clear();
+    for (const auto& [partition, peers] : t.placement) {
+      if (t.owners.size() <= partition) t.owners.resize(partition + 1);
+      if (!peers.empty()) t.owners[partition] = peers.front();
+      for (const auto& peer : peers) {
+        t.by_peer[peer].insert(partition);
+      }
+    }
+  }
 
   // API requests are forwarded to this address
   const SocketAddress backend_address;
 
+  std::atomic<std::shared_ptr<const Table>> table;
+  std::mutex writer_mtx;
+
   // cluster metadata store, e.g., routing tier
-  std::optional<SocketAddress> cluster_address{};
+  std::atomic<std::shared_ptr<const SocketAddress>> cluster_address{};
 };
 
 }  // namespace cloudlab
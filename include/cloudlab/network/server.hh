@@ -5,6 +5,7 @@
 #include "cloudlab/spmc.hh"
 
 #include <array>
+#include <chrono>
 #include <thread>
 #include <unistd.h>
 
@@ -12,6 +13,14 @@ namespace cloudlab {
 
 const auto num_workers = 4;
 
+// a connection with pending data, queued for a worker; a null bufferevent
+// stops the worker
+struct ReadyConnection {
+  void* bev;
+  // when the data arrived, for the queueing time
+  std::chrono::steady_clock::time_point ready;
+};
+
 /**
  * A (TCP) network server class.
  */
@@ -34,17 +43,22 @@ class Server {
 
   auto run() -> std::thread;
 
+  // ready connections waiting for a worker
+  auto queue_depth() const -> size_t {
+    return bev_queue.size();
+  }
+
  private:
-  static auto server(const std::string& address, SPMCQueue<void*>& bev_queue)
-      -> void;
+  static auto server(const std::string& address,
+                     SPMCQueue<ReadyConnection>& bev_queue) -> void;
 
-  static auto worker(ServerHandler& handler, SPMCQueue<void*>& bev_queue)
-      -> void;
+  static auto worker(ServerHandler& handler,
+                     SPMCQueue<ReadyConnection>& bev_queue) -> void;
 
   const std::string address;
 
   std::array<std::thread, num_workers> workers;
-  SPMCQueue<void*> bev_queue{};
+  SPMCQueue<ReadyConnection> bev_queue{};
 
   ServerHandler& handler;
 };
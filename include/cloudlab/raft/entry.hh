@@ -0,0 +1,147 @@
+#ifndef CLOUDLAB_RAFT_ENTRY_HH
+#define CLOUDLAB_RAFT_ENTRY_HH
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cloudlab {
+
+    enum class EntryType : uint8_t {
+        NOOP,
+        PUT,
+        DELETE,
+        // split of a hot partition, see KVS::split_partition()
+        SPLIT,
+        // membership of the raft group, see RaftConfig
+        CONFIG,
+    };
+
+    /**
+     * Binary format of a raft log entry, in host byte order:
+     *
+     *   u64 term | u64 index | u8 type | u8 flags | u16 unused | u32 count
+     *   u64 trace ID | u64 parent span ID         if the entry is traced
+     *   PUT, DELETE: count x (u32 key size | u32 value size | key | value)
+     *   SPLIT:       u32 source | u32 target | count x u32 bucket
+     *   CONFIG:      u32 voters | u32 old voters | u32 learners |
+     *                count x (u32 size | address)
+     *
+     * The leader encodes an entry once; the log keeps it in one contiguous
+     * buffer, the durable log writes it and replication ships it unchanged.
+     */
+    const auto entry_header_size = 24;
+
+    /**
+     * Encodes a new entry. Term and index are set when the entry is appended
+     * to the log, see stamp_entry().
+     */
+    class LogEntryBuilder {
+    public:
+        // a trace ID other than 0 links the spans of the entry to that trace
+        explicit LogEntryBuilder(EntryType type, uint64_t trace_id = 0, uint64_t parent_span_id = 0);
+
+        auto add(std::string_view key, std::string_view value = {}) -> void;
+
+        auto set_split(uint32_t source, uint32_t target, const std::vector<uint32_t> &buckets) -> void;
+
+        auto set_config(const std::vector<std::string> &voters, const std::vector<std::string> &old_voters,
+                        const std::vector<std::string> &learners) -> void;
+
+        auto release() -> std::string {
+            return std::move(data);
+        }
+
+    private:
+        auto set_count(uint32_t count) -> void;
+
+        std::string data;
+        uint32_t count{};
+    };
+
+    /**
+     * Read-only view of an encoded entry; the entry must outlive the view.
+     */
+    class LogEntryView {
+    public:
+        // false if `entry` is not a complete, well-formed entry
+        auto parse(std::string_view entry) -> bool;
+
+        [[nodiscard]] auto term() const -> uint64_t {
+            return read<uint64_t>(0);
+        }
+
+        [[nodiscard]] auto index() const -> uint64_t {
+            return read<uint64_t>(8);
+        }
+
+        [[nodiscard]] auto type() const -> EntryType {
+            return static_cast<EntryType>(data[16]);
+        }
+
+        [[nodiscard]] auto count() const -> uint32_t {
+            return read<uint32_t>(20);
+        }
+
+        [[nodiscard]] auto trace_id() const -> uint64_t {
+            return traced() ? read<uint64_t>(entry_header_size) : 0;
+        }
+
+        [[nodiscard]] auto parent_span_id() const -> uint64_t {
+            return traced() ? read<uint64_t>(entry_header_size + 8) : 0;
+        }
+
+        // PUT, DELETE: call `f` with every key and value
+        template<typename F>
+        auto for_each(F &&f) const -> void {
+            auto offset = body();
+            for (uint32_t i = 0; i < count(); i++) {
+                auto key_size = read<uint32_t>(offset);
+                auto value_size = read<uint32_t>(offset + 4);
+                offset += 8;
+                f(data.substr(offset, key_size), data.substr(offset + key_size, value_size));
+                offset += key_size + value_size;
+            }
+        }
+
+        // SPLIT
+        [[nodiscard]] auto split_source() const -> uint32_t {
+            return read<uint32_t>(body());
+        }
+
+        [[nodiscard]] auto split_target() const -> uint32_t {
+            return read<uint32_t>(body() + 4);
+        }
+
+        [[nodiscard]] auto split_buckets() const -> std::vector<uint32_t>;
+
+        // CONFIG
+        auto config(std::vector<std::string> &voters, std::vector<std::string> &old_voters,
+                    std::vector<std::string> &learners) const -> void;
+
+    private:
+        [[nodiscard]] auto traced() const -> bool;
+
+        // start of the payload behind the header and the trace
+        [[nodiscard]] auto body() const -> size_t {
+            return entry_header_size + (traced() ? 16 : 0);
+        }
+
+        template<typename T>
+        [[nodiscard]] auto read(size_t offset) const -> T {
+            T value;
+            std::memcpy(&value, data.data() + offset, sizeof(T));
+            return value;
+        }
+
+        std::string_view data;
+    };
+
+    // set the position of an encoded entry in the log
+    auto stamp_entry(std::string &entry, uint64_t term, uint64_t index) -> void;
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_RAFT_ENTRY_HH
@@ -0,0 +1,98 @@
+#ifndef CLOUDLAB_RAFT_LOG_HH
+#define CLOUDLAB_RAFT_LOG_HH
+
+#include "cloudlab/raft/entry.hh"
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+namespace cloudlab {
+
+    /**
+     * The raft log of encoded entries (see entry.hh). The entries are kept as
+     * records (u32 size | entry) in one contiguous buffer; a durable log
+     * additionally appends every record to a file and syncs it before
+     * append() returns, so the log survives a crash and can be replayed into
+     * the state machine. Buffer, file and replication share the record format.
+     * Indices are 1-based as in the raft paper. Appends are serialized among
+     * themselves; readers only wait for the in-memory part of an append, never
+     * for the disk.
+     */
+    class RaftLog {
+    public:
+        explicit RaftLog(const std::string &path = {}, bool durable = false)
+                : path{path}, durable{durable} {
+        }
+
+        ~RaftLog();
+
+        RaftLog(const RaftLog &) = delete;
+
+        auto operator=(const RaftLog &) -> RaftLog & = delete;
+
+        // load the entries of a durable log, a torn last record is dropped
+        auto open() -> bool;
+
+        /**
+         * Append an entry stamped with index size() + 1, see stamp_entry().
+         * Returns the index, or 0 if the entry is out of order or could not be
+         * persisted.
+         */
+        auto append(std::string_view entry) -> uint64_t;
+
+        // drop the entries from index `first` on, false if the file could not
+        // be cut
+        auto truncate(uint64_t first) -> bool;
+
+        [[nodiscard]] auto size() const -> uint64_t {
+            return length.load(std::memory_order_acquire);
+        }
+
+        // a copy of entry `index`
+        [[nodiscard]] auto at(uint64_t index) const -> std::string;
+
+        // the term of entry `index`, 0 for index 0
+        [[nodiscard]] auto term_at(uint64_t index) const -> uint64_t;
+
+        [[nodiscard]] auto type_at(uint64_t index) const -> EntryType;
+
+        // the records of the entries from index `first` on, as shipped to the
+        // followers; at most `max_bytes` of them, but at least one entry
+        [[nodiscard]] auto records(uint64_t first = 1, size_t max_bytes = SIZE_MAX) const -> std::string;
+
+        // split shipped records into their entries, false if they are torn
+        static auto split_records(std::string_view records, std::vector<std::string_view> &entries) -> bool;
+
+        [[nodiscard]] auto is_durable() const -> bool {
+            return durable;
+        }
+
+    private:
+        // requires append_mtx
+        auto open_file() -> bool;
+
+        std::filesystem::path path;
+        const bool durable;
+        int fd{-1};
+        // end of the last complete record in the file
+        off_t tail{};
+        // serializes appends, including the write to the file
+        std::mutex append_mtx;
+
+        mutable std::shared_mutex entries_mtx;
+        std::string data;
+        // start of every record in data
+        std::vector<size_t> offsets;
+        std::atomic<uint64_t> length{0};
+    };
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_RAFT_LOG_HH
@@ -5,9 +5,15 @@
 #include "cloudlab/network/address.hh"
 #include "cloudlab/network/connection.hh"
 #include "cloudlab/network/routing.hh"
+#include "cloudlab/raft/entry.hh"
+#include "cloudlab/raft/log.hh"
+#include "cloudlab/stats.hh"
+#include "cloudlab/timer.hh"
+#include "cloudlab/trace.hh"
 
 #include "cloud.pb.h"
 
+#include <condition_variable>
 #include <optional>
 #include <random>
 #include <span>
@@ -23,31 +29,104 @@
 
 namespace cloudlab {
 
-    struct LogEntry {
-        uint64_t term_;
-        cloud::CloudMessage cmd_;
-    };
+    // between two heartbeats of the leader and two vote requests of a candidate
+    const auto heartbeat_interval = std::chrono::milliseconds(450);
+
+    // a peer that does not answer a raft request in time is considered dropped
+    const auto rpc_timeout = std::chrono::milliseconds(2000);
+
+    // longest a follower read waits for the entries it must see, one
+    // heartbeat round ships every entry the leader has
+    const auto follower_read_wait = heartbeat_interval;
+
+    // most log records in one AppendEntries request, far below the message
+    // limit of the connections; a follower that lacks more gets the rest
+    // over the next rounds
+    const size_t max_append_bytes = 4 * 1024 * 1024;
+
+    // longest a write waits for a majority to commit its entry, a round may
+    // wait the RPC timeout for an unresponsive peer
+    const auto commit_timeout = 2 * rpc_timeout;
 
     struct PeerIndices {
         uint64_t next_index_;
         uint64_t match_index_;
     };
 
+    /**
+     * Membership of the raft group. It changes through CONFIG log entries,
+     * which take effect as soon as a node appends them. A change of the
+     * voters passes through a joint configuration: while it lasts, elections
+     * need a majority of the old and of the new voters (joint consensus), and
+     * the leader appends the new configuration once both majorities hold the
+     * joint one. Learners receive the log but neither vote nor count for a
+     * majority.
+     */
+    struct RaftConfig {
+        std::vector<SocketAddress> voters;
+        // only set during a change of the voters
+        std::vector<SocketAddress> old_voters;
+        std::vector<SocketAddress> learners;
+        // the CONFIG entry, 0 until the first change
+        uint64_t index{};
+
+        [[nodiscard]] auto joint() const -> bool {
+            return !old_voters.empty();
+        }
+
+        // a voter of the old or the new configuration
+        [[nodiscard]] auto votes(const SocketAddress &node) const -> bool;
+
+        [[nodiscard]] auto learns(const SocketAddress &node) const -> bool;
+
+        // `nodes` hold a majority of the voters and, during a change, of the
+        // old voters
+        [[nodiscard]] auto quorum(const std::unordered_set<SocketAddress> &nodes) const -> bool;
+    };
+
     enum class RaftRole {
         LEADER,
         CANDIDATE,
         FOLLOWER,
     };
 
+    /**
+     * Raft state for monitoring, read without the consensus lock. The fields
+     * are read one by one and may stem from slightly different points in time.
+     */
+    struct RaftStatus {
+        RaftRole role;
+        // a follower that does not vote, see RaftConfig
+        bool learner;
+        uint64_t term;
+        // entries are committed once a majority of the voters holds them and
+        // applied only after that; followers learn the commit index from the
+        // heartbeats
+        uint64_t commit_index;
+        uint64_t applied_index;
+        uint64_t log_size;
+        // as of the last heartbeat round
+        std::vector<std::string> dropped_peers;
+    };
+
+    /**
+     * Raft state of a node. Role and term are atomics; changes of the
+     * consensus state (role, term, vote, leader, election timer, dropped
+     * peers) happen under a small consensus lock that is never held during
+     * network or disk I/O. Appending to the log and applying entries are
+     * ordered by a separate log lock, so client writes and consensus progress
+     * do not serialize each other.
+     */
     class Raft {
     public:
-        explicit Raft(const std::string &path = {}, const std::string &addr = {}, bool open = false)
-                : kvs{path, open}, own_addr{addr} {
+        explicit Raft(const std::string &path = {}, const std::string &addr = {}, bool open = false,
+                      const StorageOptions &options = {})
+                : kvs{path, open, options}, own_addr{addr}, log{path + "-log", options.durable_log} {
             current_term=0;
         }
 
 
-        auto run(Routing &routing, std::mutex &mtx) -> std::thread;
+        auto run(Routing &routing) -> std::thread;
 
         auto open() -> bool {
             return kvs.open();
@@ -62,12 +141,31 @@ namespace cloudlab {
             return kvs.get_all(buffer);
         }
 
+        auto scan(const std::string &start, const std::string &end, size_t limit, size_t max_bytes,
+                  std::vector<std::pair<std::string, std::string>> &buffer, std::string &next,
+                  const std::vector<size_t> &ids = {}) -> bool {
+            return kvs.scan(start, end, limit, max_bytes, buffer, next, ids);
+        }
+
         auto put(const std::string &key, const std::string &value) -> bool;
 
         auto remove(const std::string &key) -> bool {
             return kvs.remove(key);
         }
 
+        // direct access to the state machine, e.g. to move partitions
+        auto storage() -> KVS & {
+            return kvs;
+        }
+
+        auto cache_stats() const -> Cache::Stats {
+            return kvs.cache_stats();
+        }
+
+        auto snapshot() -> bool {
+            return kvs.snapshot();
+        }
+
         auto leader() -> bool {
             return role == RaftRole::LEADER;
         }
@@ -81,16 +179,19 @@ namespace cloudlab {
         }
 
         auto set_leader() -> void {
+            std::lock_guard<std::mutex> lock(state_mtx);
             role = RaftRole::LEADER;
             leader_addr = own_addr;
         }
 
         auto set_candidate() -> void {
+            std::lock_guard<std::mutex> lock(state_mtx);
             role = RaftRole::CANDIDATE;
             leader_addr = "";
         }
 
         auto set_follower() -> void {
+            std::lock_guard<std::mutex> lock(state_mtx);
             role = RaftRole::FOLLOWER;
             leader_addr = "";
         }
@@ -99,21 +200,29 @@ namespace cloudlab {
             return role;
         }
 
+        // learners follow the leader but never campaign
+        auto is_learner() -> bool {
+            return learner;
+        }
+
+        auto set_learner(bool value) -> void {
+            learner = value;
+        }
+
         auto term() -> uint64_t {
             return current_term;
         }
 
 
         auto election_timeout() -> bool {
-            return election_timer < std::chrono::high_resolution_clock::now();
+            return election_timer.load() < std::chrono::steady_clock::now();
         }
 
         auto reset_election_timer() -> void {
             std::random_device dev;
             std::mt19937 rng(dev());
             std::uniform_int_distribution<std::mt19937::result_type> dist(2000, 4000);
-            election_timeout_val = std::chrono::high_resolution_clock::duration(std::chrono::milliseconds(dist(rng)));
-            election_timer = std::chrono::high_resolution_clock::now() + election_timeout_val;
+            election_timer = std::chrono::steady_clock::now() + std::chrono::milliseconds(dist(rng));
         }
 
         auto set_term(uint64_t newterm) -> void {
@@ -121,93 +230,288 @@ namespace cloudlab {
         }
 
         auto set_voted_for(const SocketAddress &addr) -> void {
+            std::lock_guard<std::mutex> lock(state_mtx);
             voted_for = addr;
         }
 
-        auto perform_election(Routing &routing, std::mutex &mtx) -> void;
+        auto perform_election(Routing &routing) -> void;
+
+        /**
+         * Leader: ship the log to the voters and the learners, once per
+         * heartbeat interval, and move membership changes along: a joint
+         * configuration is followed by the new one once both majorities hold
+         * it, and a learner that holds every entry of a round becomes a voter.
+         */
+        auto heartbeat(Routing &routing) -> void;
+
+        // the current membership; before the first CONFIG entry, this node and
+        // the members it knows of are the voters
+        auto configuration() -> std::shared_ptr<const RaftConfig>;
+
+        /**
+         * Leader: hand the leadership to the voter `target`. Writes fail
+         * while the target receives the entries it lacks and a TimeoutNow;
+         * the target then starts an election it wins within about one round
+         * trip, and this node steps down. False if the target is no voter,
+         * cannot be reached or is not up to date in time.
+         */
+        auto transfer_leadership(const SocketAddress &target) -> bool;
 
-        auto heartbeat(Routing &routing, std::mutex &mtx) -> void;
+        // RAFT_TIMEOUT_NOW: campaign right away unless the sender's `term`
+        // is behind or we do not vote
+        auto timeout_now(uint64_t term) -> bool;
+
+        // leader: add `node` as learner, false if it could not be logged
+        auto add_learner(const SocketAddress &node) -> bool;
+
+        // leader: remove a learner or start removing a voter, this node
+        // included; false during another change of the voters
+        auto remove_node(const SocketAddress &node) -> bool;
 
         auto get_dropped_peers(std::vector<std::string> &result) -> void {
+            std::lock_guard<std::mutex> lock(state_mtx);
             for (auto &peer: dropped_peers) {
                 result.emplace_back(peer.string());
             }
             // Return the nodes that have dropped back.
         }
 
+        // RAFT_VOTE: grant the vote to a candidate in a newer term whose log is
+        // at least as up-to-date as ours
+        auto handle_vote(const std::string &candidate, const cloud::CloudMessage_RequestVote &request) -> bool;
+
+        // RAFT_APPEND_ENTRIES: follow `leader` unless its term is behind; its
+        // entries replace ours where they differ, see append_entries()
+        auto accept_leader(const std::string &leader, uint64_t term) -> bool;
+
+        // JOIN_CLUSTER notification: follow `leader` unless we know one already
+        auto join(const std::string &leader, uint64_t term) -> bool;
+
+        /**
+         * Follower: append and apply the shipped entries if they follow our
+         * log, i.e. our entry before them has the leader's prev_log_term.
+         * Entries of ours that differ in term from the leader's are dropped
+         * with everything behind them. Returns the index up to which our log
+         * is known to match the leader's.
+         */
+        auto append_entries(const cloud::CloudMessage_AppendEntries &request) -> uint64_t;
+
+        // leader: append a new entry (see LogEntryBuilder) and apply it;
+        // returns the index of the entry once a majority committed it and it
+        // is applied, 0 if it failed or was not committed in time
+        auto replicate(std::string entry) -> uint64_t;
+
+        // lock-free, see RaftStatus
+        auto status() -> RaftStatus {
+            auto dropped = published_dropped_peers.load(std::memory_order_acquire);
+            return {role.load(), learner.load(), current_term.load(), commit_index.load(), lastapplied.load(), log.size(),
+                    dropped ? *dropped : std::vector<std::string>{}};
+        }
+
+        auto applied_index() -> uint64_t {
+            return lastapplied;
+        }
+
+        // wait at most `timeout` until entry `index` is applied
+        auto wait_applied(uint64_t index, std::chrono::steady_clock::duration timeout) -> bool {
+            std::unique_lock<std::mutex> lock(applied_mtx);
+            return applied_cv.wait_for(lock, timeout, [&] { return lastapplied >= index; });
+        }
+
+        /**
+         * Age of the local state for follower reads: the time since this
+         * follower last held every entry of the leader. The leader's state is
+         * never stale; a candidate's is of unknown age.
+         */
+        auto staleness() -> std::chrono::steady_clock::duration {
+            if (leader()) return {};
+            if (!follower()) return std::chrono::steady_clock::duration::max();
+            return std::chrono::steady_clock::now() - caught_up.load();
+        }
+
         auto set_leader_addr(const std::string &addr) -> void {
+            std::lock_guard<std::mutex> lock(state_mtx);
             leader_addr = addr;
         }
 
         auto get_leader_addr(std::string &result) -> void {
+            std::lock_guard<std::mutex> lock(state_mtx);
             result = leader_addr;
         }
 
-        auto add_to_log(const std::string &cmd) -> void {
-            log.emplace_back(cmd);
+        // stamps a new entry with the current term and appends it; returns
+        // the index of the entry, 0 if it could not be persisted. Entries must
+        // be appended in order, see append()
+        auto add_to_log(std::string entry) -> uint64_t {
+            ScopedStage stage{Stage::LOG_APPEND};
+            stamp_entry(entry, term(), log.size() + 1);
+            return log.append(entry);
         }
 
-        auto size_log() -> uint32_t {
+        auto size_log() -> uint64_t {
             return log.size();
         }
 
-        auto done() -> void {
-            ++lastapplied;
-        }
+        // apply log entry `index` to the state machine
+        auto apply(uint64_t index) -> bool;
+
+        /**
+         * Load a durable log. The entries after the persisted applied index of
+         * the state machine may not be committed, they are applied once the
+         * leader's commit index reaches them.
+         */
+        auto recover() -> bool;
 
-        auto prepare_heartbeat(cloud::CloudMessage &hb) -> void {
+        // ships the entries from `first_index` on, up to max_append_bytes
+        auto prepare_heartbeat(cloud::CloudMessage &hb, uint64_t first_index = 1) -> void {
             hb.set_operation(cloud::CloudMessage_Operation_RAFT_APPEND_ENTRIES);
             hb.set_type(cloud::CloudMessage_Type_REQUEST);
             auto addr = hb.mutable_address();
             addr->set_address(own_addr);
-            auto tmp = hb.add_partition();
-            tmp->set_id(term());
-            tmp->set_peer("");
-            for (auto &msg: log) {
-                auto tmp1 = hb.add_kvp();
-                tmp1->set_key(msg);
-                tmp1->set_value("");
-            }
+            auto *request = hb.mutable_append_entries();
+            request->set_term(term());
+            // the log length; the records may already hold more entries, or
+            // fewer if they are capped
+            request->set_log_size(size_log());
+            request->set_commit_index(commit_index);
+            request->set_first_index(first_index);
+            request->set_prev_log_term(log.term_at(first_index - 1));
+            request->set_entries(log.records(first_index, max_append_bytes));
         }
         auto prepare_election(cloud::CloudMessage &vt) -> void {
             vt.set_operation(cloud::CloudMessage_Operation_RAFT_VOTE);
             vt.set_type(cloud::CloudMessage_Type_REQUEST);
             auto addr = vt.mutable_address();
             addr->set_address(own_addr);
-            auto tmp = vt.add_partition();
-            tmp->set_id(term());
-            tmp->set_peer("");
-            tmp = vt.add_partition();
-            tmp->set_id(size_log());
-            tmp->set_peer("");
+            auto *request = vt.mutable_request_vote();
+            request->set_term(term());
+            request->set_log_size(size_log());
+            request->set_last_log_term(log.term_at(size_log()));
         }
 
 
+        // end the current wait of the worker early, e.g. after a role change
+        auto wake() -> void;
+
     private:
-        auto worker(Routing &routing, std::mutex &mtx) -> void;
+        auto worker(Routing &routing) -> void;
+
+        // wait until `deadline` or wake(), the timer service wakes the worker,
+        // so no thread waits per round
+        auto wait_until(std::chrono::steady_clock::time_point deadline) -> void;
+
+        // start a new term as candidate that votes for itself, requires state_mtx
+        auto become_candidate() -> void;
+
+        // adopt the membership of a CONFIG entry
+        auto load_config(const LogEntryView &entry, uint64_t index) -> void;
+
+        // adopt the membership of the last CONFIG entry up to `index`
+        auto restore_config(uint64_t index) -> void;
+
+        // raise the commit index and apply the entries up to it, requires
+        // log_mtx; it never moves back
+        auto set_commit_index(uint64_t index) -> void;
+
+        // follower: drop the entries from `first` on, requires log_mtx
+        auto truncate_log(uint64_t first) -> bool;
+
+        // leader: append an entry without waiting for its commit; returns its
+        // index, 0 if this node does not lead or hands over the leadership
+        auto append(std::string entry) -> uint64_t;
+
+        // leader: wait until entry `index` is committed and applied, false if
+        // it was not in time or a new leader replaced it
+        auto await_commit(uint64_t index) -> bool;
+
+        // a CONFIG entry takes effect once it is logged, committed or not
+        auto adopt_config(uint64_t index) -> void;
+
+        // leader: log a new membership, returns the index of the entry
+        auto replicate_config(const RaftConfig &next) -> uint64_t;
+
+        // leader, after a heartbeat round that shipped `shipped` entries;
+        // true if it logged a new membership
+        auto advance_configuration(uint64_t shipped) -> bool;
+
+        // leader: this node and the peers that hold entry `index`
+        auto holding(uint64_t index) const -> std::unordered_set<SocketAddress>;
+
+        // leader: commit and apply the last entry of the current term that a
+        // quorum of the voters holds, after a heartbeat round; true if the
+        // commit index advanced
+        auto advance_commit_index() -> bool;
+
+        // leader: a leader that removed itself leads until the membership
+        // without it is committed, then it steps down; true if it did
+        auto step_down_if_removed() -> bool;
+
+        // make the dropped peers visible to status(), requires state_mtx
+        auto publish_dropped_peers() -> void {
+            std::vector<std::string> dropped;
+            for (auto &peer: dropped_peers) {
+                dropped.emplace_back(peer.string());
+            }
+            published_dropped_peers.store(std::make_shared<const std::vector<std::string>>(std::move(dropped)),
+                                          std::memory_order_release);
+        }
 
         // the actual kvs
         KVS kvs;
 
+        // the consensus lock, see above
+        std::mutex state_mtx;
+
         // every peer is initially a follower
-        RaftRole role{RaftRole::FOLLOWER};
+        std::atomic<RaftRole> role{RaftRole::FOLLOWER};
+        std::atomic<bool> learner{false};
 
         std::string own_addr{""};
         std::string leader_addr{""};
 
         // persistent state on all servers
-        uint64_t current_term{};
+        std::atomic<uint64_t> current_term{};
         std::optional<SocketAddress> voted_for{};
 
         // for returning dropped followers
         std::unordered_set<SocketAddress> dropped_peers;
-        std::atomic_uint16_t votes_received{0};
+        // leader, only used by the worker: the entries to ship to a follower
+        std::unordered_map<SocketAddress, PeerIndices> peer_indices;
+        std::atomic<std::shared_ptr<const std::vector<std::string>>> published_dropped_peers;
+        // candidate: the nodes that voted for us, requires state_mtx
+        std::unordered_set<SocketAddress> votes;
+        std::atomic<std::shared_ptr<const RaftConfig>> config{std::make_shared<const RaftConfig>()};
+        // set by run(), CONFIG entries update the members of the routing
+        Routing *routing{};
+        // one membership change at a time
+        std::mutex config_mtx;
         // election timer
-        std::chrono::high_resolution_clock::time_point election_timer;
-        std::chrono::high_resolution_clock::duration election_timeout_val{};
-        // log
-        uint32_t lastapplied{};
-        std::vector<std::string> log{};
+        std::atomic<std::chrono::steady_clock::time_point> election_timer;
+        // advance the applied index and wake the reads waiting for it
+        auto set_applied(uint64_t index) -> void {
+            {
+                std::lock_guard<std::mutex> lock(applied_mtx);
+                lastapplied = index;
+            }
+            applied_cv.notify_all();
+        }
+
+        // wakeups of the worker
+        std::mutex wake_mtx;
+        std::condition_variable wake_cv;
+        bool woken{false};
+        // log; the log lock orders appends with applies
+        std::mutex log_mtx;
+        // leader: refuses new entries during transfer_leadership()
+        std::atomic<bool> transferring{false};
+        std::atomic<uint64_t> lastapplied{};
+        // reads waiting for an applied index
+        std::mutex applied_mtx;
+        std::condition_variable applied_cv;
+        std::atomic<uint64_t> commit_index{};
+        // followers: when the last heartbeat left us with the leader's log
+        std::atomic<std::chrono::steady_clock::time_point> caught_up{};
+        RaftLog log;
 
 
     };
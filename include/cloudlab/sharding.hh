@@ -0,0 +1,120 @@
+#ifndef CLOUDLAB_SHARDING_HH
+#define CLOUDLAB_SHARDING_HH
+
+#include "cloudlab/network/address.hh"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cloudlab {
+
+    // keys hash into a fixed number of buckets, partitions own sets of buckets
+    const auto hash_buckets = 840;
+
+    // number of nodes that hold a replica of every partition
+    const auto placement_replicas = 2;
+
+    // a partition is split once it serves this many times its fair share
+    const auto split_factor = 2;
+
+    // ... and at least this many requests per rebalance round
+    const uint64_t split_min_requests = 1000;
+
+    struct Load {
+        uint64_t requests{};
+        uint64_t bytes{};
+    };
+
+    /**
+     * Maps keys to partitions. A key hashes into one of `hash_buckets`
+     * buckets and every bucket belongs to exactly one partition. Splitting a
+     * partition reassigns some of its buckets to a new partition, so no other
+     * key changes its partition. Lookups are lock-free; every node applies the
+     * same splits in raft log order, which keeps the maps identical.
+     */
+    class PartitionMap {
+    public:
+        // bucket b initially belongs to partition b % initial
+        explicit PartitionMap(size_t initial);
+
+        PartitionMap(const PartitionMap &) = delete;
+
+        auto operator=(const PartitionMap &) -> PartitionMap & = delete;
+
+        static auto bucket(std::string_view key) -> size_t {
+            return std::hash<std::string_view>{}(key) % hash_buckets;
+        }
+
+        auto partition(std::string_view key) const -> size_t {
+            return partition_of_bucket(bucket(key));
+        }
+
+        auto partition_of_bucket(size_t bucket) const -> size_t {
+            return buckets[bucket].load(std::memory_order_acquire);
+        }
+
+        auto buckets_of(size_t id) const -> std::vector<uint32_t>;
+
+        // all partitions of the cluster in ascending order
+        auto ids() const -> std::vector<size_t>;
+
+        // an id that is not used by any partition yet
+        auto next_id() const -> size_t;
+
+        auto assign(const std::vector<uint32_t> &moved, size_t id) -> void;
+
+        auto serialize() const -> std::string;
+
+        auto deserialize(const std::string &data) -> bool;
+
+    private:
+        std::array<std::atomic<uint32_t>, hash_buckets> buckets;
+    };
+
+    /**
+     * Request and byte counters per hash bucket. Counting buckets instead of
+     * partitions keeps the counters valid across splits and tells where to
+     * cut a hot partition.
+     */
+    class LoadTracker {
+    public:
+        auto record(std::string_view key, size_t bytes) -> void {
+            auto b = PartitionMap::bucket(key);
+            requests[b].fetch_add(1, std::memory_order_relaxed);
+            this->bytes[b].fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        // the load per bucket since the last call
+        auto take() -> std::vector<Load>;
+
+    private:
+        std::array<std::atomic<uint64_t>, hash_buckets> requests{};
+        std::array<std::atomic<uint64_t>, hash_buckets> bytes{};
+    };
+
+    // owners per partition, the first owner serves reads
+    using Placement = std::map<uint32_t, std::vector<SocketAddress>>;
+
+    /**
+     * Returns the buckets of partition `id` that carry about half of its
+     * load, or nothing if the partition cannot be split.
+     */
+    auto plan_split(const PartitionMap &map, size_t id, const std::vector<Load> &load) -> std::vector<uint32_t>;
+
+    /**
+     * Assigns `replicas` owners to every partition. Current owners are kept
+     * where possible, missing replicas go to the least loaded nodes, and then
+     * partitions move from the hottest to the coldest node while that lowers
+     * the maximum node load.
+     */
+    auto plan_placement(const std::map<uint32_t, uint64_t> &load, std::vector<SocketAddress> nodes,
+                        const Placement &current, size_t replicas) -> Placement;
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_SHARDING_HH
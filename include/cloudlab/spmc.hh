@@ -32,9 +32,15 @@ class SPMCQueue {
     return tmp;
   }
 
+  // items waiting for a consumer
+  auto size() const -> size_t {
+    std::lock_guard<std::mutex> lock_guard(mtx);
+    return q.size();
+  }
+
  private:
   std::deque<T> q{};
-  std::mutex mtx{};
+  mutable std::mutex mtx{};
   std::condition_variable cond{};
 };
 
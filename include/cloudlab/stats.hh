@@ -0,0 +1,170 @@
+#ifndef CLOUDLAB_STATS_HH
+#define CLOUDLAB_STATS_HH
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cloudlab {
+
+    // sub-buckets per power of two, the relative error of a bucket is 1/32
+    const auto histogram_sub_bucket_bits = 5;
+
+    // operation histograms, indexed by cloud::CloudMessage_Operation
+    const auto max_operations = 32;
+
+    /**
+     * Latency histogram in the spirit of HdrHistogram: values are counted in
+     * log-linear buckets, i.e. every power of two is split into 32 linear
+     * sub-buckets. Recording is a few relaxed atomic increments and never
+     * blocks, so it can sit on the hot path of every request.
+     */
+    class Histogram {
+    public:
+        // values are in nanoseconds, percentiles are reported in microseconds
+        struct Summary {
+            uint64_t count;
+            uint64_t mean;
+            uint64_t p50;
+            uint64_t p90;
+            uint64_t p99;
+            uint64_t p999;
+            uint64_t max;
+        };
+
+        Histogram() = default;
+
+        Histogram(const Histogram &) = delete;
+
+        auto operator=(const Histogram &) -> Histogram & = delete;
+
+        auto record(uint64_t value) -> void;
+
+        auto record(std::chrono::steady_clock::duration elapsed) -> void {
+            record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+        }
+
+        [[nodiscard]] auto count() const -> uint64_t {
+            return total.load(std::memory_order_relaxed);
+        }
+
+        // the upper bound of the bucket holding quantile `q` in [0, 1]
+        [[nodiscard]] auto percentile(double q) const -> uint64_t;
+
+        [[nodiscard]] auto summary() const -> Summary;
+
+        // (upper bound, cumulative count) of every non-empty bucket
+        [[nodiscard]] auto buckets() const -> std::vector<std::pair<uint64_t, uint64_t>>;
+
+        [[nodiscard]] auto sum() const -> uint64_t {
+            return total_value.load(std::memory_order_relaxed);
+        }
+
+    private:
+        static const auto sub_buckets = 1 << histogram_sub_bucket_bits;
+        static const auto bucket_count = (64 - histogram_sub_bucket_bits + 1) * sub_buckets;
+
+        static auto index(uint64_t value) -> size_t;
+
+        static auto upper_bound(size_t index) -> uint64_t;
+
+        std::array<std::atomic<uint64_t>, bucket_count> counts{};
+        std::atomic<uint64_t> total{0};
+        std::atomic<uint64_t> total_value{0};
+        std::atomic<uint64_t> maximum{0};
+    };
+
+    /**
+     * Stages a request passes through on a node. QUEUE is the time a ready
+     * connection waits for a worker, LOCK the wait for the raft log lock,
+     * LOG_APPEND the raft log append (including the sync of a durable log),
+     * STORAGE_* the time spent in the storage engine, and REPLICATION the
+     * round trip of a heartbeat to a follower.
+     */
+    enum class Stage {
+        QUEUE,
+        LOCK,
+        LOG_APPEND,
+        STORAGE_READ,
+        STORAGE_WRITE,
+        REPLICATION,
+        COUNT,
+    };
+
+    auto stage_name(Stage stage) -> const char *;
+
+    /**
+     * Process-wide registry of the latency histograms: one per operation
+     * type, one per pipeline stage, and the replication round trip and lag
+     * per follower.
+     */
+    class Stats {
+    public:
+        struct Peer {
+            Histogram rtt;
+            // log entries the follower is behind the leader
+            std::atomic<uint64_t> lag{0};
+        };
+
+        Stats() = default;
+
+        Stats(const Stats &) = delete;
+
+        auto operator=(const Stats &) -> Stats & = delete;
+
+        auto operation(int op) -> Histogram & {
+            return operations[op < 0 || op >= max_operations ? max_operations - 1 : op];
+        }
+
+        auto stage(Stage stage) -> Histogram & {
+            return stages[static_cast<size_t>(stage)];
+        }
+
+        // the entry of a follower, created on first use
+        auto peer(const std::string &address) -> Peer &;
+
+        // followers in address order
+        auto peers() -> std::vector<std::pair<std::string, Peer *>>;
+
+    private:
+        std::array<Histogram, max_operations> operations;
+        std::array<Histogram, static_cast<size_t>(Stage::COUNT)> stages;
+
+        std::mutex peers_mtx;
+        std::map<std::string, std::unique_ptr<Peer>> peer_stats;
+    };
+
+    auto stats() -> Stats &;
+
+    /**
+     * Records the lifetime of the object into a histogram.
+     */
+    class ScopedLatency {
+    public:
+        explicit ScopedLatency(Histogram &histogram)
+                : histogram{histogram}, start{std::chrono::steady_clock::now()} {
+        }
+
+        ~ScopedLatency() {
+            histogram.record(std::chrono::steady_clock::now() - start);
+        }
+
+        ScopedLatency(const ScopedLatency &) = delete;
+
+        auto operator=(const ScopedLatency &) -> ScopedLatency & = delete;
+
+    private:
+        Histogram &histogram;
+        const std::chrono::steady_clock::time_point start;
+    };
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_STATS_HH
@@ -0,0 +1,138 @@
+#ifndef CLOUDLAB_STORAGE_ENGINE_HH
+#define CLOUDLAB_STORAGE_ENGINE_HH
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace cloudlab {
+
+    enum class EngineType {
+        ROCKSDB,
+        MEMORY,
+    };
+
+    /**
+     * One write of a batch, see StorageEngine::apply().
+     */
+    struct Mutation {
+        size_t partition;
+        std::string_view key;
+        std::string_view value;
+        bool remove;
+    };
+
+    /**
+     * Ordered cursor over the key-value pairs of one partition. Cursors are
+     * created unpositioned; call seek_to_first() or seek() before use.
+     */
+    class Cursor {
+    public:
+        virtual ~Cursor() = default;
+
+        [[nodiscard]] virtual auto valid() const -> bool = 0;
+
+        virtual auto seek_to_first() -> void = 0;
+
+        // position the cursor at the first key >= key
+        virtual auto seek(std::string_view key) -> void = 0;
+
+        virtual auto next() -> void = 0;
+
+        [[nodiscard]] virtual auto key() const -> std::string_view = 0;
+
+        [[nodiscard]] virtual auto value() const -> std::string_view = 0;
+    };
+
+    /**
+     * Storage engine underneath the KVS. An engine stores a set of partitions,
+     * each of which is an ordered map from keys to values. Implementations
+     * must be thread-safe.
+     */
+    class StorageEngine {
+    public:
+        virtual ~StorageEngine() = default;
+
+        virtual auto open() -> bool = 0;
+
+        virtual auto get(size_t partition, const std::string &key, std::string &value) -> bool = 0;
+
+        virtual auto put(size_t partition, const std::string &key, const std::string &value) -> bool = 0;
+
+        virtual auto remove(size_t partition, const std::string &key) -> bool = 0;
+
+        /**
+         * Apply a batch of writes atomically together with the index of the
+         * raft log entry it stems from. The index is persisted in the same
+         * atomic write, so after a crash applied_index() tells which log
+         * entries still have to be replayed. Writes to partitions the engine
+         * does not hold are skipped, those partitions live on other nodes.
+         */
+        virtual auto apply(const std::vector<Mutation> &batch, uint64_t index) -> bool = 0;
+
+        /**
+         * Apply a batch of writes atomically that is not part of the raft log,
+         * e.g. the catch-up of a partition transfer. Nothing replays these
+         * writes after a crash, so they are as durable as the engine gets
+         * when write() returns.
+         */
+        virtual auto write(const std::vector<Mutation> &batch) -> bool = 0;
+
+        // index of the last raft log entry that reached the engine
+        virtual auto applied_index() -> uint64_t = 0;
+
+        virtual auto create_partition(size_t id) -> bool = 0;
+
+        virtual auto drop_partition(size_t id) -> bool = 0;
+
+        virtual auto has_partition(size_t id) -> bool = 0;
+
+        virtual auto partition_ids() -> std::vector<size_t> = 0;
+
+        /**
+         * One cursor per requested partition. The cursors of an engine with
+         * snapshots (rocksdb) observe the same point in time, so merging them
+         * yields a consistent view; see the engine for weaker guarantees.
+         */
+        virtual auto cursors(const std::vector<size_t> &ids) -> std::vector<std::unique_ptr<Cursor>> = 0;
+
+        /**
+         * Write the current content of a partition to files in `dir` that
+         * ingest_partition() of the same engine type accepts. Files are
+         * appended to `files`; an empty partition produces no file.
+         */
+        virtual auto export_partition(size_t id, const std::string &dir, std::vector<std::string> &files)
+        -> bool = 0;
+
+        // add the content of exported files to partition `id`
+        virtual auto ingest_partition(size_t id, const std::vector<std::string> &files) -> bool = 0;
+
+        /**
+         * Persist the engine state. A no-op for engines that are durable on
+         * every write.
+         */
+        virtual auto snapshot() -> bool {
+            return true;
+        }
+
+        // engine-specific counters as (name, value), e.g. for STATS
+        virtual auto statistics() -> std::vector<std::pair<std::string, uint64_t>> {
+            return {};
+        }
+    };
+
+    /**
+     * With `disable_wal` the engine skips its own write-ahead log, see
+     * RocksDBEngine. Only use it when the raft log is durable and replayed on
+     * recovery.
+     */
+    auto make_engine(EngineType type, const std::string &path, bool disable_wal = false)
+    -> std::unique_ptr<StorageEngine>;
+
+    auto parse_engine_type(const std::string &name) -> EngineType;
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_STORAGE_ENGINE_HH
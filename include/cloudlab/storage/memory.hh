@@ -0,0 +1,97 @@
+#ifndef CLOUDLAB_STORAGE_MEMORY_HH
+#define CLOUDLAB_STORAGE_MEMORY_HH
+
+#include "cloudlab/storage/engine.hh"
+
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <memory_resource>
+#include <shared_mutex>
+
+namespace cloudlab {
+
+    /**
+     * In-memory storage engine for a pure cache tier. Every partition is an
+     * ordered map whose nodes, keys and values are carved out of a per-
+     * partition arena: a pool resource on top of large monotonic blocks keeps
+     * neighbouring nodes close together and recycles freed nodes without going
+     * back to malloc. Dropping a partition releases its arena at once.
+     * Cursors copy a partition in small batches and release its lock in
+     * between, so scans see every batch at its own point in time.
+     *
+     * With a non-empty path the state is loaded on open() and written back on
+     * snapshot(); otherwise the engine is purely volatile. A snapshot records
+     * the applied raft index, so a restart only replays the newer log entries.
+     */
+    class MemoryEngine : public StorageEngine {
+    public:
+        explicit MemoryEngine(const std::string &path = {}) : path{path} {
+        }
+
+        auto open() -> bool override;
+
+        auto get(size_t partition, const std::string &key, std::string &value) -> bool override;
+
+        auto put(size_t partition, const std::string &key, const std::string &value) -> bool override;
+
+        auto remove(size_t partition, const std::string &key) -> bool override;
+
+        auto apply(const std::vector<Mutation> &batch, uint64_t index) -> bool override;
+
+        auto write(const std::vector<Mutation> &batch) -> bool override;
+
+        auto applied_index() -> uint64_t override {
+            return applied.load();
+        }
+
+        auto export_partition(size_t id, const std::string &dir, std::vector<std::string> &files)
+        -> bool override;
+
+        auto ingest_partition(size_t id, const std::vector<std::string> &files) -> bool override;
+
+        auto create_partition(size_t id) -> bool override;
+
+        auto drop_partition(size_t id) -> bool override;
+
+        auto has_partition(size_t id) -> bool override;
+
+        auto partition_ids() -> std::vector<size_t> override;
+
+        auto cursors(const std::vector<size_t> &ids) -> std::vector<std::unique_ptr<Cursor>> override;
+
+        auto snapshot() -> bool override;
+
+        struct Partition {
+            Partition() : arena{arena_block_size}, pool{&arena}, map{&pool} {
+            }
+
+            mutable std::shared_mutex mtx;
+            std::pmr::monotonic_buffer_resource arena;
+            std::pmr::unsynchronized_pool_resource pool;
+            std::pmr::map<std::pmr::string, std::pmr::string, std::less<>> map;
+        };
+
+    private:
+        static constexpr size_t arena_block_size = 1 << 20;
+
+        auto partition(size_t id) -> std::shared_ptr<Partition>;
+
+        auto set(size_t id, std::string_view key, std::string_view value) -> bool;
+
+        auto erase(size_t id, std::string_view key) -> bool;
+
+        auto load() -> bool;
+
+        std::filesystem::path path;
+
+        // guards the partition map; every partition has its own lock
+        std::shared_mutex mtx;
+        std::map<size_t, std::shared_ptr<Partition>> partitions;
+
+        std::atomic<uint64_t> applied{0};
+    };
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_STORAGE_MEMORY_HH
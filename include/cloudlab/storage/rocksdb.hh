@@ -0,0 +1,99 @@
+#ifndef CLOUDLAB_STORAGE_ROCKSDB_HH
+#define CLOUDLAB_STORAGE_ROCKSDB_HH
+
+#include "cloudlab/storage/engine.hh"
+
+#include <filesystem>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace rocksdb {
+    class DB;
+
+    class ColumnFamilyHandle;
+
+    class Statistics;
+
+    class WriteBatch;
+}  // namespace rocksdb
+
+namespace cloudlab {
+
+    /**
+     * Storage engine backed by rocksdb. Every partition is a column family
+     * named after its ID; the applied raft index lives in the default column
+     * family and is written in the same batch as the data it covers.
+     *
+     * With `disable_wal` no write goes through the WAL. Column families are
+     * flushed together (atomic flush), so the persisted data always matches
+     * the persisted applied index: after a crash, the raft log replays the
+     * entries behind it. Writes outside the raft log (put(), remove(),
+     * write()) have nothing to replay them and are flushed before they
+     * return.
+     */
+    class RocksDBEngine : public StorageEngine {
+    public:
+        explicit RocksDBEngine(const std::string &path, bool disable_wal = false)
+                : path{path}, disable_wal{disable_wal} {
+        }
+
+        ~RocksDBEngine() override;
+
+        RocksDBEngine(const RocksDBEngine &) = delete;
+
+        auto operator=(const RocksDBEngine &) -> RocksDBEngine & = delete;
+
+        auto open() -> bool override;
+
+        auto get(size_t partition, const std::string &key, std::string &value) -> bool override;
+
+        auto put(size_t partition, const std::string &key, const std::string &value) -> bool override;
+
+        auto remove(size_t partition, const std::string &key) -> bool override;
+
+        auto apply(const std::vector<Mutation> &batch, uint64_t index) -> bool override;
+
+        auto write(const std::vector<Mutation> &batch) -> bool override;
+
+        auto applied_index() -> uint64_t override;
+
+        auto export_partition(size_t id, const std::string &dir, std::vector<std::string> &files)
+        -> bool override;
+
+        auto ingest_partition(size_t id, const std::vector<std::string> &files) -> bool override;
+
+        auto create_partition(size_t id) -> bool override;
+
+        auto drop_partition(size_t id) -> bool override;
+
+        auto has_partition(size_t id) -> bool override;
+
+        auto partition_ids() -> std::vector<size_t> override;
+
+        auto cursors(const std::vector<size_t> &ids) -> std::vector<std::unique_ptr<Cursor>> override;
+
+        auto statistics() -> std::vector<std::pair<std::string, uint64_t>> override;
+
+    private:
+        auto handle(size_t id) -> rocksdb::ColumnFamilyHandle *;
+
+        // adds the mutations of partitions we hold to `write_batch`
+        auto prepare(const std::vector<Mutation> &batch, rocksdb::WriteBatch &write_batch) -> void;
+
+        // flush all column families at once
+        auto flush() -> bool;
+
+        std::filesystem::path path;
+        const bool disable_wal;
+        rocksdb::DB *db{};
+        std::shared_ptr<rocksdb::Statistics> db_statistics;
+
+        // guards the handle map, the DB itself is thread-safe
+        std::shared_mutex mtx;
+        std::unordered_map<size_t, rocksdb::ColumnFamilyHandle *> handles;
+        rocksdb::ColumnFamilyHandle *default_handle{};
+    };
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_STORAGE_ROCKSDB_HH
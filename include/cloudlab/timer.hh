@@ -0,0 +1,106 @@
+#ifndef CLOUDLAB_TIMER_HH
+#define CLOUDLAB_TIMER_HH
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace cloudlab {
+
+    // resolution of the timer wheel
+    const auto timer_tick = std::chrono::milliseconds(1);
+
+    /**
+     * Hierarchical timer wheel (Varghese & Lauck) with one service thread.
+     * Level 0 has one slot per tick, every further level has slots 64 times
+     * as wide; a timer moves down a level whenever the wheel reaches its slot,
+     * so scheduling and cancelling are O(1). Timers never fire early and,
+     * unless the callbacks before them are slow, within a tick of their
+     * deadline. Callbacks run on the service thread one after another, so
+     * they must be short and must not cancel themselves.
+     */
+    class TimerWheel {
+    public:
+        using Clock = std::chrono::steady_clock;
+        using Id = uint64_t;
+
+        TimerWheel();
+
+        ~TimerWheel();
+
+        TimerWheel(const TimerWheel &) = delete;
+
+        auto operator=(const TimerWheel &) -> TimerWheel & = delete;
+
+        // run `callback` once at `deadline`, timers in the past fire right away
+        auto schedule(Clock::time_point deadline, std::function<void()> callback) -> Id;
+
+        auto schedule(Clock::duration delay, std::function<void()> callback) -> Id {
+            return schedule(Clock::now() + delay, std::move(callback));
+        }
+
+        // returns false if the timer already fired; if it fires right now,
+        // waits for the callback, so its captures may be released afterwards
+        auto cancel(Id id) -> bool;
+
+    private:
+        static constexpr auto slot_bits = 6;
+        static constexpr auto slots = uint64_t{1} << slot_bits;
+        static constexpr auto levels = 4;
+
+        struct Timer {
+            Id id;
+            uint64_t expiry;
+            std::function<void()> callback;
+        };
+
+        using Slot = std::list<Timer>;
+
+        auto service() -> void;
+
+        // moves the timer at `it` of `from` into its slot, requires mtx
+        auto place(Slot &from, Slot::iterator it) -> void;
+
+        // advance to tick `target`, collecting due timers, requires mtx
+        auto advance(uint64_t target) -> void;
+
+        // the tick to wake up for, requires mtx
+        auto next_tick() const -> uint64_t;
+
+        auto ticks(Clock::time_point time) const -> uint64_t;
+
+        const Clock::time_point start;
+
+        std::mutex mtx;
+        std::condition_variable changed;
+        std::condition_variable fired;
+        bool stopping{false};
+
+        std::array<std::array<Slot, slots>, levels> wheel;
+        // timers that are due, in firing order
+        Slot due;
+        // where every pending timer is
+        std::unordered_map<Id, std::pair<Slot *, Slot::iterator>> pending;
+        // the last tick the wheel processed
+        uint64_t current{};
+        // the tick the service thread sleeps until
+        uint64_t wakeup{};
+        Id next_id{1};
+        // the timer whose callback runs
+        Id running{};
+
+        std::thread thread;
+    };
+
+    // the timer service of this node, shared by all raft groups
+    auto timers() -> TimerWheel &;
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_TIMER_HH
@@ -0,0 +1,174 @@
+#ifndef CLOUDLAB_TRACE_HH
+#define CLOUDLAB_TRACE_HH
+
+#include "cloudlab/stats.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cloud {
+class CloudMessage;
+class CloudMessage_Trace;
+}
+
+namespace cloudlab {
+
+    // spans waiting for the next flush, more are dropped
+    const auto max_buffered_spans = 100000;
+
+    /**
+     * Trace context of the request the current thread works on. The context
+     * travels in CloudMessage::trace from the API to the P2P handler of the
+     * leader and, within the logged request, to the followers.
+     */
+    struct TraceContext {
+        uint64_t trace_id{};
+        // the innermost open span, parent of new spans
+        uint64_t span_id{};
+        bool sampled{false};
+    };
+
+    auto current_trace() -> TraceContext &;
+
+    /**
+     * Collects the spans of sampled requests and writes them to a file in the
+     * Chrome trace event format (JSON array format, chrome://tracing or
+     * Perfetto). Every node writes its own file with wall-clock timestamps, so
+     * the files of a cluster can be loaded together.
+     */
+    class Tracer {
+    public:
+        struct Span {
+            std::string name;
+            uint64_t trace_id;
+            uint64_t span_id;
+            uint64_t parent_id;
+            std::chrono::system_clock::time_point start;
+            std::chrono::system_clock::duration duration;
+        };
+
+        Tracer() = default;
+
+        Tracer(const Tracer &) = delete;
+
+        auto operator=(const Tracer &) -> Tracer & = delete;
+
+        // start tracing `sample_rate` of the requests into `path`
+        auto open(const std::string &path, double sample_rate, const std::string &node) -> bool;
+
+        [[nodiscard]] auto enabled() const -> bool {
+            return rate > 0;
+        }
+
+        // head-based sampling decision for a new request
+        auto sample() -> bool;
+
+        auto record(Span span) -> void;
+
+        // append the buffered spans to the file
+        auto flush() -> bool;
+
+    private:
+        std::atomic<double> rate{0};
+
+        std::mutex mtx;
+        std::vector<Span> spans;
+        std::ofstream out;
+        uint64_t dropped{};
+    };
+
+    auto tracer() -> Tracer &;
+
+    // a fresh random trace or span ID
+    auto new_trace_id() -> uint64_t;
+
+    /**
+     * Makes the trace context of a message the current one, e.g. for a
+     * received request. Without a sampled context in the message, nothing is
+     * traced. Restores the previous context on destruction.
+     */
+    class TraceScope {
+    public:
+        explicit TraceScope(const cloud::CloudMessage_Trace &trace);
+
+        explicit TraceScope(const TraceContext &context) : previous{current_trace()} {
+            current_trace() = context;
+        }
+
+        ~TraceScope() {
+            current_trace() = previous;
+        }
+
+        TraceScope(const TraceScope &) = delete;
+
+        auto operator=(const TraceScope &) -> TraceScope & = delete;
+
+    private:
+        const TraceContext previous;
+    };
+
+    /**
+     * A span of the current trace from construction to destruction. Spans
+     * opened while this one is open become its children. A no-op if the
+     * current request is not sampled.
+     */
+    class TraceSpan {
+    public:
+        explicit TraceSpan(std::string_view name);
+
+        ~TraceSpan();
+
+        TraceSpan(const TraceSpan &) = delete;
+
+        auto operator=(const TraceSpan &) -> TraceSpan & = delete;
+
+        // record a finished child span of the current span, e.g. a stage that
+        // ended before the trace context was known
+        static auto record(std::string_view name, std::chrono::system_clock::time_point start,
+                           std::chrono::system_clock::time_point end) -> void;
+
+    private:
+        bool active{false};
+        std::string name;
+        uint64_t span_id{};
+        uint64_t parent_id{};
+        std::chrono::system_clock::time_point start;
+    };
+
+    /**
+     * Times a request stage into its histogram and, for sampled requests,
+     * into a span.
+     */
+    class ScopedStage {
+    public:
+        explicit ScopedStage(Stage stage) : latency{stats().stage(stage)}, span{stage_name(stage)} {
+        }
+
+    private:
+        ScopedLatency latency;
+        TraceSpan span;
+    };
+
+    /**
+     * Starts a sampled trace in `msg` if it carries none. Only client
+     * requests start traces.
+     */
+    auto start_trace(cloud::CloudMessage &msg) -> void;
+
+    // set the current span as parent of the spans `msg` causes elsewhere
+    auto propagate_trace(cloud::CloudMessage &msg) -> void;
+
+    // when the connection of the current request became ready, see Server
+    auto set_ready_time(std::chrono::system_clock::time_point ready) -> void;
+
+    auto ready_time() -> std::chrono::system_clock::time_point;
+
+}  // namespace cloudlab
+
+#endif  // CLOUDLAB_TRACE_HH
@@ -0,0 +1,44 @@
+#include "cloudlab/arena.hh"
+
+#include <memory>
+
+namespace cloudlab {
+
+    namespace {
+
+        struct ThreadArena {
+            ThreadArena() : block{std::make_unique<char[]>(request_arena_block)}, arena{options()} {
+            }
+
+            auto options() -> google::protobuf::ArenaOptions {
+                google::protobuf::ArenaOptions result;
+                // Reset() keeps the initial block
+                result.initial_block = block.get();
+                result.initial_block_size = request_arena_block;
+                return result;
+            }
+
+            std::unique_ptr<char[]> block;
+            google::protobuf::Arena arena;
+            int depth{};
+        };
+
+        auto thread_arena() -> ThreadArena & {
+            thread_local ThreadArena instance;
+            return instance;
+        }
+
+    }  // namespace
+
+    ArenaScope::ArenaScope() {
+        auto &current = thread_arena();
+        current.depth++;
+        arena = &current.arena;
+    }
+
+    ArenaScope::~ArenaScope() {
+        auto &current = thread_arena();
+        if (--current.depth == 0) current.arena.Reset();
+    }
+
+}  // namespace cloudlab
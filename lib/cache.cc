@@ -0,0 +1,117 @@
+#include "cloudlab/cache.hh"
+
+namespace cloudlab {
+
+    Cache::Cache(size_t capacity) : capacity{capacity}, shard_capacity{capacity / cache_shards} {
+    }
+
+    auto Cache::get(const std::string &key, std::string &value) -> bool {
+        if (!enabled()) return false;
+        auto &s = shard(key);
+        std::shared_lock<std::shared_mutex> lock(s.mtx);
+        auto it = s.index.find(key);
+        if (it == s.index.end()) {
+            misses.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        auto &slot = s.slots[it->second];
+        value = slot.value;
+        slot.referenced.store(true, std::memory_order_relaxed);
+        hits.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    auto Cache::put(const std::string &key, const std::string &value) -> void {
+        if (!enabled()) return;
+        auto cost = charge(key, value);
+        if (cost > shard_capacity) return;
+
+        auto &s = shard(key);
+        std::unique_lock<std::shared_mutex> lock(s.mtx);
+        auto it = s.index.find(key);
+        if (it != s.index.end()) {
+            auto &slot = s.slots[it->second];
+            s.bytes -= charge(slot.key, slot.value);
+            slot.value = value;
+            s.bytes += cost;
+            slot.referenced.store(true, std::memory_order_relaxed);
+            evict(s, 0);
+            return;
+        }
+
+        evict(s, cost);
+        size_t id;
+        if (!s.free.empty()) {
+            id = s.free.back();
+            s.free.pop_back();
+        } else {
+            id = s.slots.size();
+            s.slots.emplace_back();
+        }
+        auto &slot = s.slots[id];
+        slot.key = key;
+        slot.value = value;
+        // new entries have to earn their second chance
+        slot.referenced.store(false, std::memory_order_relaxed);
+        slot.used = true;
+        s.index.emplace(key, id);
+        s.bytes += cost;
+        inserts.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    auto Cache::erase(const std::string &key) -> void {
+        if (!enabled()) return;
+        auto &s = shard(key);
+        std::unique_lock<std::shared_mutex> lock(s.mtx);
+        auto it = s.index.find(key);
+        if (it != s.index.end()) {
+            release(s, it->second);
+            invalidations.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    auto Cache::clear() -> void {
+        for (auto &s: shards) {
+            std::unique_lock<std::shared_mutex> lock(s.mtx);
+            s.index.clear();
+            s.slots.clear();
+            s.free.clear();
+            s.hand = 0;
+            s.bytes = 0;
+        }
+    }
+
+    auto Cache::stats() const -> Cache::Stats {
+        Stats result{hits.load(), misses.load(), inserts.load(), evictions.load(), invalidations.load(), 0, 0,
+                     capacity};
+        for (const auto &s: shards) {
+            std::shared_lock<std::shared_mutex> lock(s.mtx);
+            result.entries += s.index.size();
+            result.bytes += s.bytes;
+        }
+        return result;
+    }
+
+    auto Cache::evict(Shard &s, size_t needed) -> void {
+        // sweep the clock hand until the new entry fits into the shard budget
+        while (s.bytes + needed > shard_capacity && !s.index.empty()) {
+            s.hand = (s.hand + 1) % s.slots.size();
+            auto &slot = s.slots[s.hand];
+            if (!slot.used) continue;
+            if (slot.referenced.exchange(false, std::memory_order_relaxed)) continue;
+            release(s, s.hand);
+            evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    auto Cache::release(Shard &s, size_t id) -> void {
+        auto &slot = s.slots[id];
+        s.bytes -= charge(slot.key, slot.value);
+        s.index.erase(slot.key);
+        std::string().swap(slot.key);
+        std::string().swap(slot.value);
+        slot.used = false;
+        s.free.emplace_back(id);
+    }
+
+}  // namespace cloudlab
@@ -0,0 +1,249 @@
+#include "cloudlab/client/async_client.hh"
+
+#include <limits>
+
+namespace cloudlab {
+
+AsyncClient::AsyncClient(const std::vector<std::string>& seeds,
+                         const AsyncClientOptions& options)
+    : options{options}, client{seeds} {
+  for (size_t i = 0; i < std::max<size_t>(options.connections, 1); i++) {
+    lanes.emplace_back(std::make_unique<Lane>());
+  }
+  for (auto& lane : lanes) {
+    lane->receiver = std::thread(&AsyncClient::receiver, this, std::ref(*lane));
+  }
+  dispatch_thread = std::thread(&AsyncClient::dispatcher, this);
+}
+
+AsyncClient::~AsyncClient() {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    stopping = true;
+  }
+  cv.notify_all();
+  dispatch_thread.join();
+  flush();
+
+  closed = true;
+  for (auto& lane : lanes) {
+    {
+      std::lock_guard<std::mutex> lock(lane->mtx);
+    }
+    lane->cv.notify_all();
+    lane->receiver.join();
+  }
+}
+
+auto AsyncClient::get(const std::string& key, Callback done) -> void {
+  submit({cloud::CloudMessage_Operation_GET, key, {}, std::move(done)});
+}
+
+auto AsyncClient::put(const std::string& key, const std::string& value,
+                      Callback done) -> void {
+  submit({cloud::CloudMessage_Operation_PUT, key, value, std::move(done)});
+}
+
+auto AsyncClient::remove(const std::string& key, Callback done) -> void {
+  submit({cloud::CloudMessage_Operation_DELETE, key, {}, std::move(done)});
+}
+
+auto AsyncClient::get(const std::string& key)
+    -> std::future<std::optional<std::string>> {
+  auto promise = std::make_shared<std::promise<std::optional<std::string>>>();
+  auto future = promise->get_future();
+  get(key, [promise](bool ok, const std::string& value) {
+    promise->set_value(ok ? std::optional<std::string>{value} : std::nullopt);
+  });
+  return future;
+}
+
+auto AsyncClient::put(const std::string& key, const std::string& value)
+    -> std::future<bool> {
+  auto promise = std::make_shared<std::promise<bool>>();
+  auto future = promise->get_future();
+  put(key, value,
+      [promise](bool ok, const std::string&) { promise->set_value(ok); });
+  return future;
+}
+
+auto AsyncClient::remove(const std::string& key) -> std::future<bool> {
+  auto promise = std::make_shared<std::promise<bool>>();
+  auto future = promise->get_future();
+  remove(key,
+         [promise](bool ok, const std::string&) { promise->set_value(ok); });
+  return future;
+}
+
+auto AsyncClient::flush() -> void {
+  std::unique_lock<std::mutex> lock(done_mtx);
+  done_cv.wait(lock, [this] { return outstanding.load() == 0; });
+}
+
+auto AsyncClient::submit(Op op) -> void {
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!stopping) {
+      outstanding++;
+      queue.emplace_back(std::move(op));
+      cv.notify_one();
+      return;
+    }
+  }
+  op.done(false, {});
+}
+
+auto AsyncClient::dispatcher() -> void {
+  std::deque<Op> ops;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv.wait(lock, [this] { return stopping || !queue.empty(); });
+      if (queue.empty()) return;
+      // everything that queued up while the last batches were sent goes out
+      // together
+      ops.swap(queue);
+    }
+
+    // one open batch per operation type
+    std::shared_ptr<Batch> open[3]{};
+    for (auto& op : ops) {
+      auto& batch = open[op.operation];
+      if (!batch) {
+        batch = std::make_shared<Batch>();
+        batch->request.set_type(cloud::CloudMessage_Type_REQUEST);
+        batch->request.set_operation(op.operation);
+      }
+      auto* kvp = batch->request.add_kvp();
+      kvp->set_key(std::move(op.key));
+      kvp->set_value(std::move(op.value));
+      batch->done.emplace_back(std::move(op.done));
+      if (batch->done.size() >= options.max_batch) send(std::move(batch));
+    }
+    ops.clear();
+    for (auto& batch : open) {
+      if (batch) send(std::move(batch));
+    }
+  }
+}
+
+auto AsyncClient::send(std::shared_ptr<Batch> batch) -> void {
+  while (true) {
+    // the least loaded lane that is connected to the leader
+    Lane* best = nullptr;
+    auto best_load = std::numeric_limits<size_t>::max();
+    for (auto& lane : lanes) {
+      std::lock_guard<std::mutex> lock(lane->mtx);
+      if (lane->stale && lane->in_flight.empty()) connect(*lane);
+      if (!lane->stale && lane->in_flight.size() < best_load) {
+        best = lane.get();
+        best_load = lane->in_flight.size();
+      }
+    }
+    if (best == nullptr) {
+      // no leader connection right now, the synchronous client waits for one
+      retry(*batch);
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(best->mtx);
+    best->cv.wait(lock, [&] {
+      return best->stale || best->in_flight.size() < options.max_in_flight;
+    });
+    if (best->stale) continue;
+    best->in_flight.emplace_back(batch);
+    best->cv.notify_all();
+    auto* con = best->con.get();
+    lock.unlock();
+
+    // never send under the lock: a full socket buffer waits for the receiver
+    if (!con->send(batch->request)) {
+      lock.lock();
+      best->stale = true;
+    }
+    return;
+  }
+}
+
+auto AsyncClient::connect(Lane& lane) -> bool {
+  auto leader = client.leader();
+  if (!leader && client.refresh_leader()) leader = client.leader();
+  if (!leader) return false;
+
+  auto con = std::make_unique<Connection>(*leader);
+  if (con->connect_failed) return false;
+  lane.con = std::move(con);
+  lane.stale = false;
+  return true;
+}
+
+auto AsyncClient::receiver(Lane& lane) -> void {
+  while (true) {
+    std::shared_ptr<Batch> batch;
+    Connection* con;
+    {
+      std::unique_lock<std::mutex> lock(lane.mtx);
+      lane.cv.wait(lock, [&] { return closed || !lane.in_flight.empty(); });
+      if (lane.in_flight.empty()) return;
+      batch = lane.in_flight.front();
+      con = lane.con.get();
+    }
+
+    cloud::CloudMessage response{};
+    bool ok = false;
+    try {
+      ok = con->receive(response);
+    } catch (std::runtime_error&) {
+      // a truncated response, the connection is unusable
+    }
+
+    // followers answer with the address of the leader
+    if (ok && (response.success() || !response.has_address())) {
+      {
+        std::lock_guard<std::mutex> lock(lane.mtx);
+        lane.in_flight.pop_front();
+      }
+      lane.cv.notify_all();
+      complete(*batch, response, true);
+      continue;
+    }
+
+    // the connection broke or the leader changed: every request still in
+    // flight on this connection is lost or redirected as well
+    std::deque<std::shared_ptr<Batch>> failed;
+    {
+      std::lock_guard<std::mutex> lock(lane.mtx);
+      lane.stale = true;
+      failed.swap(lane.in_flight);
+    }
+    lane.cv.notify_all();
+    for (auto& tmp : failed) {
+      retry(*tmp);
+    }
+  }
+}
+
+auto AsyncClient::retry(Batch& batch) -> void {
+  cloud::CloudMessage response{};
+  auto ok = client.execute(batch.request, response);
+  complete(batch, response, ok);
+}
+
+auto AsyncClient::complete(Batch& batch, const cloud::CloudMessage& response,
+                           bool ok) -> void {
+  // values are returned per key, in request order
+  ok = ok && response.success();
+  for (size_t i = 0; i < batch.done.size(); i++) {
+    auto found = ok && static_cast<int>(i) < response.kvp_size() &&
+                 response.kvp(i).value() != "ERROR";
+    batch.done[i](found, found ? response.kvp(i).value() : std::string{});
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(done_mtx);
+    outstanding -= batch.done.size();
+  }
+  done_cv.notify_all();
+}
+
+}  // namespace cloudlab
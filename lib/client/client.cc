@@ -0,0 +1,201 @@
+#include "cloudlab/client/client.hh"
+
+#include "cloud.pb.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace cloudlab {
+
+Client::Client(const std::vector<std::string>& seeds) {
+  for (const auto& seed : seeds) {
+    this->seeds.emplace_back(seed);
+  }
+}
+
+auto Client::get(const std::string& key, std::string& value) -> bool {
+  cloud::CloudMessage request{}, response{};
+  request.set_type(cloud::CloudMessage_Type_REQUEST);
+  request.set_operation(cloud::CloudMessage_Operation_GET);
+  request.add_kvp()->set_key(key);
+
+  if (!execute(request, response) || !response.success() ||
+      response.kvp_size() != 1 || response.kvp(0).value() == "ERROR") {
+    return false;
+  }
+  value = response.kvp(0).value();
+  return true;
+}
+
+auto Client::put(const std::string& key, const std::string& value) -> bool {
+  cloud::CloudMessage request{}, response{};
+  request.set_type(cloud::CloudMessage_Type_REQUEST);
+  request.set_operation(cloud::CloudMessage_Operation_PUT);
+  auto* kvp = request.add_kvp();
+  kvp->set_key(key);
+  kvp->set_value(value);
+
+  return execute(request, response) && response.success();
+}
+
+auto Client::follower_get(const std::string& key, std::string& value,
+                          std::chrono::milliseconds max_staleness,
+                          uint64_t min_applied_index) -> bool {
+  cloud::CloudMessage request{}, response{};
+  request.set_type(cloud::CloudMessage_Type_REQUEST);
+  request.set_operation(cloud::CloudMessage_Operation_RAFT_DIRECT_GET);
+  request.add_kvp()->set_key(key);
+  auto* bound = request.mutable_read_bound();
+  bound->set_max_staleness_ms(max_staleness.count());
+
+  auto served = false;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    bound->set_min_applied_index(std::max(min_applied_index, session_index));
+    if (!seeds.empty()) {
+      const auto node = seeds[next_seed++ % seeds.size()];
+      served = round_trip(node, request, response) && response.success();
+      if (served) {
+        session_index = std::max(session_index,
+                                 response.read_bound().applied_index());
+      }
+    }
+  }
+  // too stale or unreachable, the leader never is
+  if (!served && (!execute(request, response) || !response.success())) {
+    return false;
+  }
+  if (response.kvp_size() != 1 || response.kvp(0).value() == "ERROR") {
+    return false;
+  }
+  value = response.kvp(0).value();
+  return true;
+}
+
+auto Client::remove(const std::string& key) -> bool {
+  cloud::CloudMessage request{}, response{};
+  request.set_type(cloud::CloudMessage_Type_REQUEST);
+  request.set_operation(cloud::CloudMessage_Operation_DELETE);
+  request.add_kvp()->set_key(key);
+
+  return execute(request, response) && response.success() &&
+         response.kvp_size() == 1 && response.kvp(0).value() == "OK";
+}
+
+auto Client::scan(const std::string& start, const std::string& end,
+                  uint32_t limit,
+                  std::vector<std::pair<std::string, std::string>>& buffer,
+                  std::string& next) -> bool {
+  cloud::CloudMessage request{}, response{};
+  request.set_type(cloud::CloudMessage_Type_REQUEST);
+  request.set_operation(cloud::CloudMessage_Operation_SCAN);
+  auto* range = request.mutable_range();
+  range->set_start(start);
+  range->set_end(end);
+  range->set_limit(limit);
+
+  if (!execute(request, response) || !response.success()) return false;
+  for (const auto& kvp : response.kvp()) {
+    buffer.emplace_back(kvp.key(), kvp.value());
+  }
+  next = response.range().token();
+  return true;
+}
+
+auto Client::execute(const cloud::CloudMessage& request,
+                     cloud::CloudMessage& response) -> bool {
+  std::lock_guard<std::mutex> lock(mtx);
+
+  for (auto attempt = 0; attempt < client_max_attempts; attempt++) {
+    if (!leader_address && !refresh_leader_locked()) {
+      std::this_thread::sleep_for(client_retry_delay);
+      continue;
+    }
+
+    auto target = *leader_address;
+    if (!round_trip(target, request, response)) {
+      // the leader is gone, find the new one; the seeds may still point to
+      // the old leader until the election is over
+      leader_address.reset();
+      if (attempt > 0) std::this_thread::sleep_for(client_retry_delay);
+      continue;
+    }
+
+    // followers answer with the address of the leader they know, the leader
+    // itself never sets it
+    if (response.success()) {
+      session_index =
+          std::max(session_index, response.read_bound().applied_index());
+      return true;
+    }
+    if (!response.has_address()) return true;
+
+    const auto& redirect = response.address().address();
+    if (redirect.empty()) {
+      // election in progress
+      leader_address.reset();
+      std::this_thread::sleep_for(client_retry_delay);
+    } else if (SocketAddress{redirect} == target) {
+      // a stale redirect to the node we just asked, wait for the election
+      leader_address.reset();
+      std::this_thread::sleep_for(client_retry_delay);
+    } else {
+      leader_address = SocketAddress{redirect};
+    }
+  }
+  return false;
+}
+
+auto Client::session_token() -> uint64_t {
+  std::lock_guard<std::mutex> lock(mtx);
+  return session_index;
+}
+
+auto Client::leader() -> std::optional<SocketAddress> {
+  std::lock_guard<std::mutex> lock(mtx);
+  return leader_address;
+}
+
+auto Client::refresh_leader() -> bool {
+  std::lock_guard<std::mutex> lock(mtx);
+  return refresh_leader_locked();
+}
+
+auto Client::refresh_leader_locked() -> bool {
+  cloud::CloudMessage request{}, response{};
+  request.set_type(cloud::CloudMessage_Type_REQUEST);
+  request.set_operation(cloud::CloudMessage_Operation_RAFT_GET_LEADER);
+
+  for (const auto& seed : seeds) {
+    if (!round_trip(seed, request, response)) continue;
+    if (!response.success() || response.message().empty()) continue;
+    leader_address = SocketAddress{response.message()};
+    return true;
+  }
+  return false;
+}
+
+auto Client::round_trip(const SocketAddress& peer,
+                        const cloud::CloudMessage& request,
+                        cloud::CloudMessage& response) -> bool {
+  auto it = connections.find(peer);
+  if (it == connections.end()) {
+    auto con = std::make_unique<Connection>(peer);
+    if (con->connect_failed) return false;
+    it = connections.emplace(peer, std::move(con)).first;
+  }
+
+  response.Clear();
+  try {
+    if (it->second->send(request) && it->second->receive(response)) {
+      return true;
+    }
+  } catch (std::runtime_error&) {
+    // a truncated response, the connection is unusable
+  }
+  // reconnect on the next attempt
+  connections.erase(it);
+  return false;
+}
+
+}  // namespace cloudlab
@@ -1,13 +1,17 @@
 #include "cloud.pb.h"
 
+#include "cloudlab/arena.hh"
 #include "cloudlab/handler/api.hh"
+#include "cloudlab/trace.hh"
 
 #include "fmt/core.h"
 
 namespace cloudlab {
 
 void APIHandler::handle_connection(Connection& con) {
-  cloud::CloudMessage request{}, response{};
+  ArenaScope arena;
+  auto& request = arena.create<cloud::CloudMessage>();
+  auto& response = arena.create<cloud::CloudMessage>();
 
   if (!con.receive(request)) {
     return;
@@ -17,6 +21,12 @@ void APIHandler::handle_connection(Connection& con) {
     throw std::runtime_error("expected a request");
   }
 
+  // sampled requests are traced from here on, the backend continues the trace
+  start_trace(request);
+  TraceScope trace{request.trace()};
+  TraceSpan span{"api"};
+  TraceSpan::record("queue", ready_time(), std::chrono::system_clock::now());
+
   auto backend_address = routing.get_backend_address();
 
   Connection backend{backend_address};
@@ -25,10 +35,19 @@ void APIHandler::handle_connection(Connection& con) {
     case cloud::CloudMessage_Operation_PUT:
     case cloud::CloudMessage_Operation_GET:
     case cloud::CloudMessage_Operation_DELETE:
+    case cloud::CloudMessage_Operation_SCAN:
     case cloud::CloudMessage_Operation_JOIN_CLUSTER:
+    case cloud::CloudMessage_Operation_STEAL_PARTITIONS:
+    case cloud::CloudMessage_Operation_TRANSFER_PARTITION:
     case cloud::CloudMessage_Operation_RAFT_GET_LEADER:
     case cloud::CloudMessage_Operation_RAFT_DIRECT_GET:
-    case cloud::CloudMessage_Operation_RAFT_DROPPED_NODE: {   
+    case cloud::CloudMessage_Operation_STATS:
+    case cloud::CloudMessage_Operation_RAFT_DROPPED_NODE:
+    case cloud::CloudMessage_Operation_RAFT_ADD_NODE:
+    case cloud::CloudMessage_Operation_RAFT_REMOVE_NODE:
+    case cloud::CloudMessage_Operation_RAFT_TRANSFER_LEADERSHIP: {
+      TraceSpan hop{"backend"};
+      propagate_trace(request);
       backend.send(request);
       backend.receive(response);
       break;
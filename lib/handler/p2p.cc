@@ -1,4 +1,9 @@
 #include "cloudlab/handler/p2p.hh"
+#include "cloudlab/arena.hh"
+#include "cloudlab/handler/transfer.hh"
+#include "cloudlab/stats.hh"
+#include "cloudlab/trace.hh"
+#include <algorithm>
 #include <condition_variable>
 
 #include "fmt/core.h"
@@ -7,20 +12,30 @@
 
 namespace cloudlab {
 
-    P2PHandler::P2PHandler(Routing &routing) : routing{routing} {
+    P2PHandler::P2PHandler(Routing &routing, const StorageOptions &options) : routing{routing} {
         auto hash = std::hash<SocketAddress>()(routing.get_backend_address());
         auto path = fmt::format("/tmp/{}-initial", hash);
         auto raft_path = fmt::format("/tmp/{}-raft", hash);
+        staging_prefix = fmt::format("/tmp/{}", hash);
         partitions.insert({0, std::make_unique<KVS>(path)});
-        raft = std::make_unique<Raft>(raft_path, routing.get_backend_address().string());
+        raft = std::make_unique<Raft>(raft_path, routing.get_backend_address().string(), false, options);
     }
 
     auto P2PHandler::handle_connection(Connection &con) -> void {
-        cloud::CloudMessage request{}, response{};
+        // the messages of the request live on the arena of this worker
+        ArenaScope arena;
+        auto &request = arena.create<cloud::CloudMessage>();
+        auto &response = arena.create<cloud::CloudMessage>();
 
         if (!con.receive(request)) {
             return;
         }
+        // from a received request to its response on the wire
+        ScopedLatency latency{stats().operation(request.operation())};
+        start_trace(request);
+        TraceScope trace{request.trace()};
+        TraceSpan span{cloud::CloudMessage_Operation_Name(request.operation())};
+        TraceSpan::record("queue", ready_time(), std::chrono::system_clock::now());
 
         switch (request.operation()) {
             case cloud::CloudMessage_Operation_PUT: {
@@ -47,6 +62,10 @@ namespace cloudlab {
                 }
                 break;
             }
+            case cloud::CloudMessage_Operation_SCAN: {
+                handle_scan(con, request);
+                break;
+            }
             case cloud::CloudMessage_Operation_JOIN_CLUSTER: {
                 handle_join_cluster(con, request);
                 break;
@@ -67,6 +86,10 @@ namespace cloudlab {
                 handle_transfer_partition(con, request);
                 break;
             }
+            case cloud::CloudMessage_Operation_PARTITIONS_ADDED: {
+                handle_partitions_added(con, request);
+                break;
+            }
             case cloud::CloudMessage_Operation_RAFT_APPEND_ENTRIES: {
                 handle_raft_append_entries(con, request);
                 break;
@@ -79,6 +102,22 @@ namespace cloudlab {
                 handle_raft_dropped_node(con, request);
                 break;
             }
+            case cloud::CloudMessage_Operation_RAFT_ADD_NODE: {
+                handle_raft_add_node(con, request);
+                break;
+            }
+            case cloud::CloudMessage_Operation_RAFT_REMOVE_NODE: {
+                handle_raft_remove_node(con, request);
+                break;
+            }
+            case cloud::CloudMessage_Operation_RAFT_TRANSFER_LEADERSHIP: {
+                handle_raft_transfer_leadership(con, request);
+                break;
+            }
+            case cloud::CloudMessage_Operation_RAFT_TIMEOUT_NOW: {
+                handle_raft_timeout_now(con, request);
+                break;
+            }
             case cloud::CloudMessage_Operation_RAFT_GET_LEADER: {
                 handle_raft_get_leader(con, request);
                 break;
@@ -87,6 +126,10 @@ namespace cloudlab {
                 handle_raft_direct_get(con, request);
                 break;
             }
+            case cloud::CloudMessage_Operation_STATS: {
+                handle_stats(con, request);
+                break;
+            }
             default:
                 response.set_type(cloud::CloudMessage_Type_RESPONSE);
                 response.set_operation(request.operation());
@@ -101,7 +144,8 @@ namespace cloudlab {
 
     auto P2PHandler::handle_put(Connection &con, const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
 
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_PUT);
@@ -116,7 +160,8 @@ namespace cloudlab {
 
     auto P2PHandler::handle_get(Connection &con, const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_GET);
         std::string tmp;
@@ -130,7 +175,8 @@ namespace cloudlab {
 
     auto P2PHandler::handle_delete(Connection &con, const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
 
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_DELETE);
@@ -146,10 +192,10 @@ namespace cloudlab {
 
     auto P2PHandler::handle_key_operation_leader(Connection &con, const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
         response.set_operation(msg.operation());
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
-        mtx.lock();
         if (!raft->leader()) {
             response.set_success(false);
             response.set_message("ERROR");
@@ -160,15 +206,25 @@ namespace cloudlab {
         } else {
             response.set_success(true);
             response.set_message("OK");
-            raft->add_to_log(msg.SerializeAsString());
             switch (msg.operation()) {
                 case cloud::CloudMessage_Operation_GET: {
+                    // the reads see at least this index
+                    response.mutable_read_bound()->set_applied_index(raft->applied_index());
                     std::string value;
                     for (const auto &kvp: msg.kvp()) {
 
                         auto *tmp = response.add_kvp();
                         tmp->set_key(kvp.key());
-                        if (raft->get(kvp.key(), value)) {
+                        // partitions placed on other nodes are read there
+                        bool found = false;
+                        if (raft->storage().has_partition_for_key(kvp.key())) {
+                            found = raft->get(kvp.key(), value);
+                        } else if (!forward_get(kvp.key(), value, found)) {
+                            // the key may exist, so it is not reported missing
+                            response.set_success(false);
+                            response.set_message("UNAVAILABLE");
+                        }
+                        if (found) {
                             tmp->set_value(value);
                         } else {
                             tmp->set_value("ERROR");
@@ -176,29 +232,43 @@ namespace cloudlab {
                     }
                     break;
                 }
-                case cloud::CloudMessage_Operation_PUT: {
+                case cloud::CloudMessage_Operation_PUT:
+                case cloud::CloudMessage_Operation_DELETE: {
+                    // only writes go through the log, the whole request is
+                    // applied as one atomic batch; partitions frozen by a
+                    // transfer delay it for the final catch-up. The entry of
+                    // a sampled request links the followers' spans to this one
+                    const auto &trace = current_trace();
+                    LogEntryBuilder entry{
+                            msg.operation() == cloud::CloudMessage_Operation_DELETE ? EntryType::DELETE
+                                                                                    : EntryType::PUT,
+                            trace.sampled ? trace.trace_id : 0, trace.span_id};
                     for (const auto &kvp: msg.kvp()) {
-                        auto *tmp = response.add_kvp();
-                        tmp->set_key(kvp.key());
-                        if (raft->put(kvp.key(), kvp.value())) {
-                            tmp->set_value("OK");
-                        } else {
-                            tmp->set_value("ERROR");
-                            response.set_success(false);
-                            response.set_message("ERROR");
-                        }
+                        entry.add(kvp.key(), kvp.value());
                     }
-                    break;
-                }
-                case cloud::CloudMessage_Operation_DELETE: {
+                    auto index = raft->replicate(entry.release());
+                    auto ok = index != 0;
+                    // the read-your-writes token of the client; replicate()
+                    // returns once the entry is committed and applied, so
+                    // the index is at most the commit index
+                    if (ok) response.mutable_read_bound()->set_applied_index(index);
                     for (const auto &kvp: msg.kvp()) {
                         auto *tmp = response.add_kvp();
                         tmp->set_key(kvp.key());
-                        if (raft->remove(kvp.key())) {
-                            tmp->set_value("OK");
-                        } else {
-                            tmp->set_value("ERROR");
-                        }
+                        tmp->set_value(ok ? "OK" : "ERROR");
+                    }
+                    if (!ok && msg.operation() == cloud::CloudMessage_Operation_PUT) {
+                        response.set_success(false);
+                        response.set_message("ERROR");
+                    }
+                    // handed over the leadership meanwhile, the client
+                    // retries at the new leader
+                    if (!ok && !raft->leader()) {
+                        std::string tmp;
+                        raft->get_leader_addr(tmp);
+                        response.mutable_address()->set_address(tmp);
+                        response.set_success(false);
+                        response.set_message("ERROR");
                     }
                     break;
                 }
@@ -209,74 +279,96 @@ namespace cloudlab {
         }
         // This function should be similar to the RouterHandler::handle_key_operation()
         // in task 2.
-        mtx.unlock();
+        con.send(response);
+    }
+
+    auto P2PHandler::handle_scan(Connection &con, const cloud::CloudMessage &msg)
+    -> void {
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_SCAN);
+        if (msg.type() == cloud::CloudMessage_Type_NOTIFICATION) {
+            // part of a scan of the leader, only covers the listed partitions
+            // and only once they caught up with the leader, see direct_get
+            const auto &bound = msg.read_bound();
+            if (raft->applied_index() < bound.min_applied_index() && raft->follower()) {
+                raft->wait_applied(bound.min_applied_index(), follower_read_wait);
+            }
+            std::vector<size_t> ids;
+            for (const auto &partition: msg.partition()) ids.emplace_back(partition.id());
+            std::vector<std::pair<std::string, std::string>> page;
+            std::string next;
+            const auto &range = msg.range();
+            auto ok = !ids.empty() && raft->applied_index() >= bound.min_applied_index() &&
+                      raft->scan(range.start(), range.end(), range.limit(), max_scan_bytes, page, next, ids);
+            for (auto &[key, value]: page) {
+                auto *kvp = response.add_kvp();
+                kvp->set_key(key);
+                kvp->set_value(value);
+            }
+            response.mutable_range()->set_token(next);
+            response.set_success(ok);
+            response.set_message(ok ? "OK" : "ERROR");
+            con.send(response);
+            return;
+        }
+        auto leader = raft->leader();
+        std::string tmp;
+        raft->get_leader_addr(tmp);
+        if (!leader) {
+            auto leaderaddress = response.mutable_address();
+            leaderaddress->set_address(tmp);
+            response.set_success(false);
+            response.set_message("ERROR");
+            con.send(response);
+            return;
+        }
+
+        const auto &range = msg.range();
+        auto limit = range.limit() == 0 ? max_scan_limit : std::min<size_t>(range.limit(), max_scan_limit);
+        std::vector<std::pair<std::string, std::string>> page;
+        std::string next;
+        if (scan_cluster(range.token().empty() ? range.start() : range.token(), range.end(), limit, page, next)) {
+            for (auto &[key, value]: page) {
+                auto *kvp = response.add_kvp();
+                kvp->set_key(key);
+                kvp->set_value(value);
+            }
+            auto *out = response.mutable_range();
+            out->set_start(range.start());
+            out->set_end(range.end());
+            out->set_limit(limit);
+            out->set_token(next);
+            response.set_success(true);
+            response.set_message("OK");
+        } else {
+            response.set_success(false);
+            response.set_message("ERROR");
+        }
         con.send(response);
     }
 
     auto P2PHandler::handle_join_cluster(Connection &con,
                                          const cloud::CloudMessage &msg) -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_JOIN_CLUSTER);
-        mtx.lock();
         switch (msg.type()) {
             case cloud::CloudMessage_Type_NOTIFICATION : {
                 response.set_message("OK");
                 response.set_success(true);
 
-                for (const auto &kvp: msg.kvp()) {
-                    if (kvp.value() != routing.get_backend_address().string())
-                        routing.add_peer(0, SocketAddress(
-                                kvp.value()));
-                }
-                std::string leader_addr;
-                raft->get_leader_addr(leader_addr);
-                if (leader_addr.empty()) {
+                if (raft->join(msg.address().address(), msg.append_entries().term())) {
                     routing.set_cluster_address(SocketAddress(msg.address().address()));
-                    raft->set_leader_addr(msg.address().address());
-                    raft->set_follower();
-                    raft->set_term(msg.partition(0).id());
-                    raft->reset_election_timer();
-
                 }
                 break;
             }
             case cloud::CloudMessage_Type_REQUEST : {
-                response.set_message("OK");
-                response.set_success(true);
-                routing.add_peer(0, SocketAddress(msg.address().address()));
-                cloud::CloudMessage notif;
-                notif.set_type(cloud::CloudMessage_Type_NOTIFICATION);
-                notif.set_operation(cloud::CloudMessage_Operation_JOIN_CLUSTER);
-                auto addr = notif.mutable_address();
-                std::string la;
-                raft->get_leader_addr(la);
-                addr->set_address(la);
-                auto peers = routing.partitions_by_peer();
-                for (auto &peer: peers) {
-                    auto tmp = notif.add_kvp();
-                    tmp->set_key("");
-                    tmp->set_value(peer.first.string());
-                }
-                auto tmp = notif.add_kvp();
-                tmp->set_key("");
-                tmp->set_value(routing.get_backend_address().string());
-                auto tmp1 = notif.add_partition();
-                tmp1->set_id(raft->term());
-                std::vector<std::pair<SocketAddress, std::unique_ptr<Connection>>> connections;
-                int i = 0;
-                for (auto &peer: peers) {
-                    connections.emplace_back(peer.first, std::make_unique<Connection>(SocketAddress(peer.first)));
-                    connections.at(i).second->send(notif);
-                    ++i;
-                }
-                i = 0;
-                for (auto &con2: connections) {
-                    if (!con2.second->connect_failed) {
-                        con2.second->receive(notif);
-                    }
-                    ++i;
-                }
+                auto ok = add_node(SocketAddress(msg.address().address()));
+                response.set_message(ok ? "OK" : "ERROR");
+                response.set_success(ok);
                 break;
             }
             default: {
@@ -285,16 +377,53 @@ namespace cloudlab {
         }
 
         // Handle join cluster request. Leader might operate differently from followers.
-        mtx.unlock();
         con.send(response);
     }
 
+    auto P2PHandler::add_node(const SocketAddress &node) -> bool {
+        // new nodes start as learners and vote once they caught up, see
+        // Raft::heartbeat()
+        if (!raft->add_learner(node)) return false;
+        // the first heartbeat would tell it as well
+        ArenaScope arena;
+        auto &notif = arena.create<cloud::CloudMessage>();
+        notif.set_type(cloud::CloudMessage_Type_NOTIFICATION);
+        notif.set_operation(cloud::CloudMessage_Operation_JOIN_CLUSTER);
+        std::string la;
+        raft->get_leader_addr(la);
+        notif.mutable_address()->set_address(la);
+        notif.mutable_append_entries()->set_term(raft->term());
+        Connection peer{node};
+        if (!peer.connect_failed && peer.send(notif)) {
+            auto &reply = arena.create<cloud::CloudMessage>();
+            peer.receive(reply);
+        }
+        return true;
+    }
+
     auto P2PHandler::handle_create_partitions(Connection &con,
                                               const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_CREATE_PARTITIONS);
 
-        // TODO from the 2nd task - not required
+        // partitions are created empty and are ready to receive a transfer
+        bool ok = true;
+        auto &kvs = raft->storage();
+        std::lock_guard<std::mutex> lock(imports_mtx);
+        expire_imports();
+        for (const auto &partition: msg.partition()) {
+            // a previous import of the partition is given up first
+            imports.erase(partition.id());
+            kvs.remove_partition(partition.id());
+            ok = kvs.create_partition(partition.id()) && ok;
+            imports[partition.id()] = std::make_unique<PartitionImport>(
+                    kvs, partition.id(), fmt::format("{}-import", staging_prefix));
+        }
+        response.set_success(ok);
+        response.set_message(ok ? "OK" : "ERROR");
 
         con.send(response);
     }
@@ -302,9 +431,36 @@ namespace cloudlab {
     auto P2PHandler::handle_steal_partitions(Connection &con,
                                              const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_STEAL_PARTITIONS);
 
-        // TODO from the 2nd task - not required
+        // ask the current owner of every partition to transfer it to us
+        bool ok = true;
+        auto self = routing.get_backend_address();
+        for (const auto &partition: msg.partition()) {
+            // the arena only frees at the end of the request, messages per
+            // iteration live on the stack
+            cloud::CloudMessage request{}, reply{};
+            request.set_type(cloud::CloudMessage_Type_REQUEST);
+            request.set_operation(cloud::CloudMessage_Operation_TRANSFER_PARTITION);
+            auto *tmp = request.add_partition();
+            tmp->set_id(partition.id());
+            tmp->set_peer(self.string());
+
+            Connection owner{partition.peer()};
+            if (owner.connect_failed || !owner.send(request) || !owner.receive(reply) || !reply.success()) {
+                ok = false;
+                continue;
+            }
+            mtx.lock();
+            routing.remove_peer(partition.id(), SocketAddress{partition.peer()});
+            routing.add_peer(partition.id(), self);
+            mtx.unlock();
+        }
+        response.set_success(ok);
+        response.set_message(ok ? "OK" : "ERROR");
 
         con.send(response);
     }
@@ -312,9 +468,21 @@ namespace cloudlab {
     auto P2PHandler::handle_drop_partitions(Connection &con,
                                             const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_DROP_PARTITIONS);
 
-        // TODO from the 2nd task - not required
+        bool ok = true;
+        auto self = routing.get_backend_address();
+        for (const auto &partition: msg.partition()) {
+            ok = raft->storage().remove_partition(partition.id()) && ok;
+            mtx.lock();
+            routing.remove_peer(partition.id(), self);
+            mtx.unlock();
+        }
+        response.set_success(ok);
+        response.set_message(ok ? "OK" : "ERROR");
 
         con.send(response);
     }
@@ -322,72 +490,315 @@ namespace cloudlab {
     auto P2PHandler::handle_transfer_partition(Connection &con,
                                                const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_TRANSFER_PARTITION);
 
-        // TODO from the 2nd task - not required
+        bool ok = true;
+        if (msg.type() == cloud::CloudMessage_Type_NOTIFICATION) {
+            // receiving side: one chunk of a transfer
+            std::lock_guard<std::mutex> lock(imports_mtx);
+            auto it = msg.partition_size() > 0 ? imports.find(msg.partition(0).id()) : imports.end();
+            ok = it != imports.end() && it->second->receive(msg);
+            // a failed import drops the partition, see PartitionImport
+            if (it != imports.end() && (!ok || it->second->finished())) imports.erase(it);
+        } else {
+            // sending side: move every partition to the given peer
+            auto &kvs = raft->storage();
+            auto self = routing.get_backend_address();
+            for (const auto &partition: msg.partition()) {
+                auto id = partition.id();
+                SocketAddress destination{partition.peer()};
+                auto keep = partition.keep();
+                ok = transfer_partition(kvs, id, destination, fmt::format("{}-export", staging_prefix), [&]() {
+                    mtx.lock();
+                    routing.add_peer(id, destination);
+                    if (!keep) routing.remove_peer(id, self);
+                    mtx.unlock();
+                    if (!keep) kvs.remove_partition(id);
+                }) && ok;
+            }
+        }
+        response.set_success(ok);
+        response.set_message(ok ? "OK" : "ERROR");
 
         con.send(response);
     }
 
-    auto P2PHandler::handle_raft_append_entries(Connection &con,
-                                                const cloud::CloudMessage &msg)
+    auto P2PHandler::handle_partitions_added(Connection &con,
+                                             const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
-        response.set_operation(cloud::CloudMessage_Operation_RAFT_APPEND_ENTRIES);
+        response.set_operation(cloud::CloudMessage_Operation_PARTITIONS_ADDED);
+
+        // the leader broadcasts the whole placement, one entry per owner
+        std::unordered_map<uint32_t, std::vector<SocketAddress>> placement;
+        for (const auto &partition: msg.partition()) {
+            placement[partition.id()].emplace_back(partition.peer());
+        }
         mtx.lock();
-        auto currentterm = raft->term();
+        routing.set_placement(std::move(placement));
+        drop_unowned_partitions();
+        mtx.unlock();
 
-        uint32_t size = raft->size_log();
-        cloud::CloudMessage msg1;
-        if (currentterm <= msg.partition(0).id()) {
-            raft->set_term(msg.partition(0).id());
-            if (msg.kvp().size() >= size) {
-                response.set_success(true);
-                response.set_message("OK");
-                raft->set_follower();
-                raft->set_leader_addr(msg.address().address());
-                routing.set_cluster_address(SocketAddress(msg.address().address()));
-                int i = 0;
-                for (const auto &kvp: msg.kvp()) {
-                    if (i < size) {
-                        ++i;
-                        continue;
-                    }
-                    raft->add_to_log(kvp.key());
-                    msg1.ParseFromString(kvp.key());
-                    switch (msg1.operation()) {
-                        case cloud::CloudMessage_Operation_PUT: {
-                            for (const auto &kvp1: msg1.kvp()) {
-                                raft->put(kvp1.key(), kvp1.value());
-                            }
-                            break;
-                        }
-                        case cloud::CloudMessage_Operation_DELETE: {
-                            for (const auto &kvp1: msg1.kvp()) {
-                                raft->remove(kvp1.key());
-                            }
-                            break;
-                        }
-                        default: {
-                            break;
-                        }
-                    }
+        response.set_success(true);
+        response.set_message("OK");
+        con.send(response);
+    }
+
+    auto P2PHandler::expire_imports() -> void {
+        std::erase_if(imports, [](const auto &import) { return import.second->idle() > transfer_idle_timeout; });
+    }
+
+    auto P2PHandler::drop_unowned_partitions() -> void {
+        auto table = routing.snapshot();
+        const auto &placement = table->placement;
+        auto self = routing.get_backend_address();
+        auto &kvs = raft->storage();
+        {
+            std::lock_guard<std::mutex> lock(imports_mtx);
+            expire_imports();
+        }
+        for (auto id: kvs.partition_ids()) {
+            auto it = placement.find(id);
+            // partitions the leader has not placed yet stay where they are
+            if (it == placement.end()) continue;
+            if (std::find(it->second.begin(), it->second.end(), self) != it->second.end()) continue;
+            {
+                std::lock_guard<std::mutex> lock(imports_mtx);
+                if (imports.contains(id)) continue;
+            }
+            kvs.remove_partition(id);
+        }
+    }
+
+    auto P2PHandler::forward_get(const std::string &key, std::string &value, bool &found) -> bool {
+        found = false;
+        auto owner = routing.find_peer(raft->storage().key_to_partition(key));
+        if (!owner) return false;
+
+        // called per key of a request, see arena.hh
+        cloud::CloudMessage request{}, reply{};
+        request.set_type(cloud::CloudMessage_Type_REQUEST);
+        request.set_operation(cloud::CloudMessage_Operation_RAFT_DIRECT_GET);
+        request.add_kvp()->set_key(key);
+        // the owner must have applied every write the leader acknowledged
+        request.mutable_read_bound()->set_min_applied_index(raft->applied_index());
+
+        Connection peer{*owner};
+        if (peer.connect_failed || !peer.send(request) || !peer.receive(reply) || !reply.success() ||
+            reply.kvp_size() != 1) {
+            return false;
+        }
+        found = reply.kvp(0).value() != "ERROR";
+        if (!found) return true;
+        value = reply.kvp(0).value();
+        raft->storage().record_load(key, value.size());
+        return true;
+    }
+
+    auto P2PHandler::scan_cluster(const std::string &start, const std::string &end, size_t limit,
+                                  std::vector<std::pair<std::string, std::string>> &page, std::string &next) -> bool {
+        // partitions that are not stored here are scanned by their first owner;
+        // a page without a partition would silently miss its keys, so the
+        // scan fails until the placement names an owner
+        auto &kvs = raft->storage();
+        auto table = routing.snapshot();
+        std::unordered_map<SocketAddress, std::vector<uint32_t>> remote;
+        for (auto id: kvs.cluster_partition_ids()) {
+            if (kvs.has_partition(id)) continue;
+            const auto *owner = table->find_peer(id);
+            if (owner == nullptr) return false;
+            remote[*owner].emplace_back(id);
+        }
+
+        if (!raft->scan(start, end, limit, max_scan_bytes, page, next)) return false;
+        if (remote.empty()) return true;
+
+        // every source returns its first `limit` keys from `start`, so the
+        // first `limit` keys of the merged result are the page
+        std::vector<std::string> cuts;
+        if (!next.empty()) cuts.emplace_back(next);
+        for (auto &[owner, ids]: remote) {
+            cloud::CloudMessage request{}, reply{};
+            request.set_type(cloud::CloudMessage_Type_NOTIFICATION);
+            request.set_operation(cloud::CloudMessage_Operation_SCAN);
+            auto *range = request.mutable_range();
+            range->set_start(start);
+            range->set_end(end);
+            range->set_limit(limit);
+            for (auto id: ids) request.add_partition()->set_id(id);
+            request.mutable_read_bound()->set_min_applied_index(raft->applied_index());
+
+            Connection peer{owner};
+            if (peer.connect_failed || !peer.send(request) || !peer.receive(reply) || !reply.success()) return false;
+            for (const auto &kvp: reply.kvp()) page.emplace_back(kvp.key(), kvp.value());
+            if (!reply.range().token().empty()) cuts.emplace_back(reply.range().token());
+        }
+
+        std::sort(page.begin(), page.end());
+        next.clear();
+        if (page.size() > limit) {
+            next = page[limit].first;
+            page.resize(limit);
+        }
+        // a source that was cut may continue before the overflow of the others
+        for (auto &cut: cuts) {
+            if (next.empty() || cut < next) next = cut;
+        }
+        while (!page.empty() && !next.empty() && page.back().first >= next) page.pop_back();
+        return true;
+    }
+
+    auto P2PHandler::copy_partition(uint32_t id, const SocketAddress &source, const SocketAddress &destination)
+    -> bool {
+        if (source == routing.get_backend_address()) {
+            return transfer_partition(raft->storage(), id, destination, fmt::format("{}-export", staging_prefix),
+                                      [&]() {
+                                          mtx.lock();
+                                          routing.add_peer(id, destination);
+                                          mtx.unlock();
+                                      });
+        }
+
+        // called per moved partition, see arena.hh
+        cloud::CloudMessage request{}, reply{};
+        request.set_type(cloud::CloudMessage_Type_REQUEST);
+        request.set_operation(cloud::CloudMessage_Operation_TRANSFER_PARTITION);
+        auto *partition = request.add_partition();
+        partition->set_id(id);
+        partition->set_peer(destination.string());
+        partition->set_keep(true);
+
+        Connection peer{source};
+        return !peer.connect_failed && peer.send(request) && peer.receive(reply) && reply.success();
+    }
+
+    auto P2PHandler::rebalance() -> bool {
+        if (!raft->leader()) return true;
+        auto &kvs = raft->storage();
+        const auto &map = kvs.partition_map();
+
+        // the leader sees every write and every read it serves or forwards
+        auto bucket_load = kvs.take_load();
+        std::map<uint32_t, uint64_t> load;
+        uint64_t total{};
+        for (auto id: map.ids()) load[id] = 0;
+        for (size_t b = 0; b < hash_buckets; b++) {
+            load[map.partition_of_bucket(b)] += bucket_load[b].requests;
+            total += bucket_load[b].requests;
+        }
+
+        auto routing_table = routing.snapshot();
+        std::vector<SocketAddress> nodes{routing.get_backend_address()};
+        std::vector<std::string> dropped;
+        raft->get_dropped_peers(dropped);
+        for (const auto &member: routing_table->members) {
+            if (std::find(dropped.begin(), dropped.end(), member.string()) == dropped.end()) {
+                nodes.emplace_back(member);
+            }
+        }
+
+        // before the first placement every node stores every partition
+        Placement placement;
+        for (const auto &[id, owners]: routing_table->placement) placement[id] = owners;
+        for (const auto &[id, _]: load) {
+            if (!placement.contains(id)) placement[id] = nodes;
+        }
+
+        // split the hottest partition if it serves more than its fair share
+        auto hot = std::max_element(load.begin(), load.end(), [](const auto &lhs, const auto &rhs) {
+            return lhs.second < rhs.second;
+        });
+        if (hot->second >= split_min_requests && hot->second * load.size() > split_factor * total) {
+            auto buckets = plan_split(map, hot->first, bucket_load);
+            if (!buckets.empty()) {
+                auto source = hot->first;
+                auto target = map.next_id();
+                LogEntryBuilder split{EntryType::SPLIT};
+                split.set_split(source, target, buckets);
+
+                if (raft->replicate(split.release())) {
+                    uint64_t moved{};
+                    for (auto b: buckets) moved += bucket_load[b].requests;
+                    placement[target] = placement[source];
+                    load[target] = moved;
+                    hot->second -= moved;
+                }
+            }
+        }
+
+        // copy partitions to their new owners; the old owners drop them once
+        // the new placement reaches them
+        auto plan = plan_placement(load, nodes, placement, placement_replicas);
+        bool ok = true;
+        for (auto &[id, owners]: plan) {
+            const auto &old = placement[id];
+            for (const auto &owner: owners) {
+                if (std::find(old.begin(), old.end(), owner) != old.end()) continue;
+                if (old.empty() || !copy_partition(id, old.front(), owner)) {
+                    // try again in the next round
+                    owners = old;
+                    ok = false;
+                    break;
                 }
-                raft->reset_election_timer();
-            } else {
-                response.set_success(false);
-                response.set_message("ERROR");
             }
+        }
+
+        cloud::CloudMessage notification{};
+        notification.set_type(cloud::CloudMessage_Type_NOTIFICATION);
+        notification.set_operation(cloud::CloudMessage_Operation_PARTITIONS_ADDED);
+        std::unordered_map<uint32_t, std::vector<SocketAddress>> table;
+        for (auto &[id, owners]: plan) {
+            for (const auto &owner: owners) {
+                auto *partition = notification.add_partition();
+                partition->set_id(id);
+                partition->set_peer(owner.string());
+            }
+            table[id] = std::move(owners);
+        }
+
+        mtx.lock();
+        routing.set_placement(std::move(table));
+        drop_unowned_partitions();
+        mtx.unlock();
+
+        for (const auto &member: routing.snapshot()->members) {
+            if (std::find(nodes.begin(), nodes.end(), member) == nodes.end()) continue;
+            cloud::CloudMessage reply{};
+            Connection peer{member};
+            if (peer.connect_failed || !peer.send(notification) || !peer.receive(reply)) ok = false;
+        }
+        return ok;
+    }
+
+    auto P2PHandler::handle_raft_append_entries(Connection &con,
+                                                const cloud::CloudMessage &msg)
+    -> void {
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_RAFT_APPEND_ENTRIES);
+        const auto &request = msg.append_entries();
+        auto *result = response.mutable_append_entries();
+        if (raft->accept_leader(msg.address().address(), request.term())) {
+            response.set_success(true);
+            response.set_message("OK");
+            routing.set_cluster_address(SocketAddress(msg.address().address()));
+            result->set_match_index(raft->append_entries(request));
+            raft->reset_election_timer();
         } else {
             response.set_success(false);
             response.set_message("ERROR");
         }
-        auto tmp = response.add_partition();
-        tmp->set_id(raft->term());
-        tmp->set_peer("");
+        result->set_term(raft->term());
+        // the leader ships from the end of our log and derives the
+        // replication lag from it
+        result->set_log_size(raft->size_log());
         // Do things when receiving heartbeat from the leader.
-        mtx.unlock();
 
         con.send(response);
     }
@@ -395,39 +806,30 @@ namespace cloudlab {
     auto P2PHandler::handle_raft_vote(Connection &con,
                                       const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_RAFT_VOTE);
-        mtx.lock();
-        auto currentterm = raft->term();
-        if (currentterm < msg.partition(0).id() && raft->size_log() <= msg.partition(1).id()) {
+        if (raft->handle_vote(msg.address().address(), msg.request_vote())) {
             response.set_success(true);
             response.set_message("OK");
-            raft->set_voted_for(SocketAddress(msg.address().address()));
-            raft->set_term(msg.partition(0).id());
-            raft->set_follower();
             routing.set_cluster_address(SocketAddress(msg.address().address()));
-            raft->reset_election_timer();
-
         } else {
             response.set_success(false);
             response.set_message("ERROR");
         }
-        auto tmp = response.add_partition();
-        tmp->set_id(raft->term());
-        tmp->set_peer("");
+        response.mutable_request_vote()->set_term(raft->term());
         // Decide whether to vote for the sender.
-        mtx.unlock();
         con.send(response);
     }
 
     auto P2PHandler::handle_raft_dropped_node(Connection &con,
                                               const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_RAFT_DROPPED_NODE);
-        mtx.lock();
         if (raft->leader()) {
             std::vector<std::string> dropped;
             raft->get_dropped_peers(dropped);
@@ -446,46 +848,240 @@ namespace cloudlab {
             response.set_message("ERROR");
         }
         // Return the address of dropped nodes
-        mtx.unlock();
+        con.send(response);
+    }
+
+    auto P2PHandler::handle_raft_add_node(Connection &con,
+                                          const cloud::CloudMessage &msg)
+    -> void {
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_RAFT_ADD_NODE);
+        if (!raft->leader() || !add_node(SocketAddress(msg.address().address()))) {
+            std::string tmp;
+            raft->get_leader_addr(tmp);
+            response.mutable_address()->set_address(tmp);
+            response.set_success(false);
+            response.set_message("ERROR");
+        } else {
+            response.set_success(true);
+            response.set_message("OK");
+        }
+        con.send(response);
+    }
+
+    auto P2PHandler::handle_raft_remove_node(Connection &con,
+                                             const cloud::CloudMessage &msg)
+    -> void {
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_RAFT_REMOVE_NODE);
+        if (msg.type() == cloud::CloudMessage_Type_NOTIFICATION) {
+            // we left the group: forget it and never campaign
+            raft->set_learner(true);
+            routing.set_membership({}, {});
+            routing.set_cluster_address({});
+            response.set_success(true);
+            response.set_message("OK");
+            con.send(response);
+            return;
+        }
+        SocketAddress node{msg.address().address()};
+        // only one change of the voters at a time, the joint phase lasts about
+        // one heartbeat round; a leader that removes itself steps down once
+        // the new membership is committed
+        if (!raft->remove_node(node)) {
+            std::string tmp;
+            raft->get_leader_addr(tmp);
+            response.mutable_address()->set_address(tmp);
+            response.set_success(false);
+            response.set_message("ERROR");
+            con.send(response);
+            return;
+        }
+        response.set_success(true);
+        response.set_message("OK");
+        con.send(response);
+    }
+
+    auto P2PHandler::handle_raft_transfer_leadership(Connection &con,
+                                                     const cloud::CloudMessage &msg)
+    -> void {
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_RAFT_TRANSFER_LEADERSHIP);
+        // without a target, the first other voter takes over
+        std::optional<SocketAddress> target;
+        if (!msg.address().address().empty()) {
+            target.emplace(msg.address().address());
+        } else {
+            for (const auto &voter: raft->configuration()->voters) {
+                if (voter == routing.get_backend_address()) continue;
+                target = voter;
+                break;
+            }
+        }
+        if (target && raft->transfer_leadership(*target)) {
+            response.mutable_address()->set_address(target->string());
+            response.set_success(true);
+            response.set_message("OK");
+        } else {
+            std::string tmp;
+            raft->get_leader_addr(tmp);
+            response.mutable_address()->set_address(tmp);
+            response.set_success(false);
+            response.set_message("ERROR");
+        }
+        con.send(response);
+    }
+
+    auto P2PHandler::handle_raft_timeout_now(Connection &con,
+                                             const cloud::CloudMessage &msg)
+    -> void {
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_RAFT_TIMEOUT_NOW);
+        auto ok = raft->timeout_now(msg.append_entries().term());
+        response.set_success(ok);
+        response.set_message(ok ? "OK" : "ERROR");
         con.send(response);
     }
 
     auto P2PHandler::handle_raft_get_leader(Connection &con,
                                             const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
         response.set_operation(cloud::CloudMessage_Operation_RAFT_GET_LEADER);
         std::string tmp;
-        mtx.lock();
         raft->get_leader_addr(tmp);
         response.set_message(tmp);
         response.set_success(true);
-        mtx.unlock();
+        con.send(response);
+    }
+
+    auto P2PHandler::handle_stats(Connection &con, const cloud::CloudMessage &msg)
+    -> void {
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
+        response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        response.set_operation(cloud::CloudMessage_Operation_STATS);
+
+        auto add_histogram = [&](const std::string &name, const Histogram &histogram) {
+            if (histogram.count() == 0) return;
+            auto summary = histogram.summary();
+            auto *out = response.add_histogram();
+            out->set_name(name);
+            out->set_count(summary.count);
+            out->set_mean(summary.mean);
+            out->set_p50(summary.p50);
+            out->set_p90(summary.p90);
+            out->set_p99(summary.p99);
+            out->set_p999(summary.p999);
+            out->set_max(summary.max);
+        };
+        auto add_counter = [&](const std::string &name, uint64_t value) {
+            auto *kvp = response.add_kvp();
+            kvp->set_key(name);
+            kvp->set_value(std::to_string(value));
+        };
+
+        auto &registry = stats();
+        for (auto op = 0; op < max_operations; op++) {
+            if (!cloud::CloudMessage_Operation_IsValid(op)) continue;
+            add_histogram(fmt::format("op.{}", cloud::CloudMessage_Operation_Name(op)), registry.operation(op));
+        }
+        for (auto stage = 0; stage < static_cast<int>(Stage::COUNT); stage++) {
+            add_histogram(fmt::format("stage.{}", stage_name(static_cast<Stage>(stage))),
+                          registry.stage(static_cast<Stage>(stage)));
+        }
+
+        auto status = raft_status();
+        add_counter("raft.term", status.term);
+        add_counter("raft.log_size", status.log_size);
+        add_counter("raft.commit_index", status.commit_index);
+        add_counter("raft.applied_index", status.applied_index);
+        add_counter("raft.leader", status.role == RaftRole::LEADER ? 1 : 0);
+        add_counter("raft.learner", status.learner ? 1 : 0);
+        // only the leader replicates, followers keep the numbers of their
+        // last term as leader
+        for (auto &[address, peer]: registry.peers()) {
+            add_histogram(fmt::format("replication.{}", address), peer->rtt);
+            add_counter(fmt::format("replication.{}.lag", address), peer->lag.load(std::memory_order_relaxed));
+        }
+
+        auto cache = cache_stats();
+        add_counter("cache.hits", cache.hits);
+        add_counter("cache.misses", cache.misses);
+        add_counter("cache.evictions", cache.evictions);
+        add_counter("cache.entries", cache.entries);
+        add_counter("cache.bytes", cache.bytes);
+        for (auto &[name, value]: storage_statistics()) {
+            add_counter(name, value);
+        }
+
+        response.set_success(true);
+        response.set_message("OK");
         con.send(response);
     }
 
     auto P2PHandler::handle_raft_direct_get(Connection &con,
                                             const cloud::CloudMessage &msg)
     -> void {
-        cloud::CloudMessage response{};
+        ArenaScope arena;
+        auto &response = arena.create<cloud::CloudMessage>();
         response.set_operation(cloud::CloudMessage_Operation_RAFT_DIRECT_GET);
         response.set_type(cloud::CloudMessage_Type_RESPONSE);
+        // without bounds any node serves what it has, e.g. the forwarded reads
+        // of partitions stored here
+        const auto &bound = msg.read_bound();
+        // the entries a session wrote may still be on their way
+        if (raft->applied_index() < bound.min_applied_index() && raft->follower()) {
+            raft->wait_applied(bound.min_applied_index(), follower_read_wait);
+        }
+        auto applied = raft->applied_index();
+        response.mutable_read_bound()->set_applied_index(applied);
+        // a follower only knows the keys of the partitions it stores and
+        // serves; an imported partition counts once the transfer is done
+        auto &kvs = raft->storage();
+        auto hosted = std::all_of(msg.kvp().begin(), msg.kvp().end(),
+                                  [&](const auto &kvp) { return kvs.has_partition_for_key(kvp.key()); });
+        if (applied < bound.min_applied_index() || (!hosted && !raft->leader()) ||
+            (bound.max_staleness_ms() != 0 &&
+             raft->staleness() > std::chrono::milliseconds(bound.max_staleness_ms()))) {
+            response.set_success(false);
+            response.set_message("STALE");
+            // followers redirect to the leader; the leader itself is never
+            // stale, it only lacks indexes that were never written
+            if (!raft->leader()) {
+                std::string tmp;
+                raft->get_leader_addr(tmp);
+                response.mutable_address()->set_address(tmp);
+            }
+            con.send(response);
+            return;
+        }
         response.set_success(true);
         response.set_message("OK");
         std::string value;
         for (const auto &kvp: msg.kvp()) {
             auto *tmp = response.add_kvp();
             tmp->set_key(kvp.key());
-            if (raft->get(kvp.key(), value)) {
-                tmp->set_value(value);
-            } else {
-                tmp->set_value("ERROR");
+            // the leader reads the partitions placed on other nodes there
+            bool found = false;
+            if (kvs.has_partition_for_key(kvp.key())) {
+                found = raft->get(kvp.key(), value);
+            } else if (!forward_get(kvp.key(), value, found)) {
+                response.set_success(false);
+                response.set_message("UNAVAILABLE");
             }
+            tmp->set_value(found ? value : "ERROR");
         }
-        std::cout << response.DebugString();
-        // Return the get request from clt directly, regardless if you are leader
-        // or not.
         con.send(response);
     }
 
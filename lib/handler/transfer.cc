@@ -0,0 +1,196 @@
+#include "cloudlab/handler/transfer.hh"
+#include "cloudlab/network/connection.hh"
+
+#include "fmt/core.h"
+
+#include "cloud.pb.h"
+
+#include <filesystem>
+#include <fstream>
+
+namespace cloudlab {
+
+    namespace {
+
+        auto chunk_message(uint32_t id) -> cloud::CloudMessage {
+            cloud::CloudMessage msg{};
+            msg.set_type(cloud::CloudMessage_Type_NOTIFICATION);
+            msg.set_operation(cloud::CloudMessage_Operation_TRANSFER_PARTITION);
+            auto *partition = msg.add_partition();
+            partition->set_id(id);
+            return msg;
+        }
+
+        // send one message of the transfer and wait for its acknowledgement
+        auto exchange(Connection &con, const cloud::CloudMessage &msg) -> bool {
+            if (!con.send(msg)) return false;
+            cloud::CloudMessage response{};
+            return con.receive(response) && response.success();
+        }
+
+        auto send_writes(Connection &con, uint32_t id, const KVS::Writes &writes) -> bool {
+            auto msg = chunk_message(id);
+            size_t bytes{};
+            for (const auto &[key, value]: writes) {
+                if (value) {
+                    auto *kvp = msg.mutable_chunk()->add_puts();
+                    kvp->set_key(key);
+                    kvp->set_value(*value);
+                    bytes += key.size() + value->size();
+                } else {
+                    msg.mutable_chunk()->add_deletes(key);
+                    bytes += key.size();
+                }
+                if (bytes >= transfer_chunk_size) {
+                    if (!exchange(con, msg)) return false;
+                    msg = chunk_message(id);
+                    bytes = 0;
+                }
+            }
+            return !msg.has_chunk() || exchange(con, msg);
+        }
+
+        auto send_file(Connection &con, uint32_t id, const std::string &file) -> bool {
+            std::ifstream in(file, std::ios::binary);
+            if (!in) return false;
+            auto name = std::filesystem::path(file).filename().string();
+            std::string buffer(transfer_chunk_size, '\0');
+            uint64_t offset{};
+            while (in) {
+                in.read(buffer.data(), transfer_chunk_size);
+                auto n = in.gcount();
+                if (n <= 0) break;
+                auto msg = chunk_message(id);
+                auto *chunk = msg.mutable_chunk();
+                chunk->set_file(name);
+                chunk->set_offset(offset);
+                chunk->set_data(buffer.data(), n);
+                if (!exchange(con, msg)) return false;
+                offset += n;
+            }
+            return in.eof();
+        }
+
+    }  // namespace
+
+    auto transfer_partition(KVS &kvs, uint32_t id, const SocketAddress &destination,
+                            const std::string &staging_dir,
+                            const std::function<void()> &on_switch) -> bool {
+        std::vector<std::string> files;
+        auto finish = [&](bool success) {
+            kvs.end_capture(id);
+            for (auto &file: files) {
+                std::filesystem::remove(file);
+            }
+            return success;
+        };
+
+        kvs.begin_capture(id);
+        if (!kvs.export_partition(id, staging_dir, files)) return finish(false);
+
+        Connection con{destination};
+        if (con.connect_failed) return finish(false);
+
+        // (re)create the partition empty on the destination
+        cloud::CloudMessage create{};
+        create.set_type(cloud::CloudMessage_Type_REQUEST);
+        create.set_operation(cloud::CloudMessage_Operation_CREATE_PARTITIONS);
+        create.add_partition()->set_id(id);
+        if (!exchange(con, create)) return finish(false);
+
+        // the destination drops the partition right away instead of waiting
+        // for the idle timeout
+        auto fail = [&]() {
+            auto abort = chunk_message(id);
+            abort.mutable_chunk()->set_done(true);
+            exchange(con, abort);
+            return finish(false);
+        };
+
+        for (const auto &file: files) {
+            if (!send_file(con, id, file)) return fail();
+        }
+        auto ingest = chunk_message(id);
+        ingest.mutable_chunk()->set_ingest(true);
+        if (!exchange(con, ingest)) return fail();
+
+        // writes keep flowing while the bulk of the catch-up is shipped ...
+        if (!send_writes(con, id, kvs.take_capture(id, false))) return fail();
+        // ... and only wait for the last, small delta
+        if (!send_writes(con, id, kvs.take_capture(id, true))) return fail();
+
+        // applies of later entries wait for the freeze, so the copy covers
+        // every entry up to this index
+        auto done = chunk_message(id);
+        done.set_success(true);
+        done.mutable_chunk()->set_done(true);
+        done.mutable_chunk()->set_applied_index(kvs.applied_index());
+        if (!exchange(con, done)) return finish(false);
+
+        on_switch();
+        return finish(true);
+    }
+
+    PartitionImport::PartitionImport(KVS &kvs, uint32_t id, std::string staging_dir)
+            : kvs{kvs}, id{id}, staging_dir{std::move(staging_dir)}, last_chunk{std::chrono::steady_clock::now()} {
+        kvs.begin_import(id);
+    }
+
+    PartitionImport::~PartitionImport() {
+        remove_files();
+        if (done) return;
+        kvs.abort_import(id);
+        kvs.remove_partition(id);
+    }
+
+    auto PartitionImport::remove_files() -> void {
+        for (auto &file: files) {
+            std::filesystem::remove(file);
+        }
+        files.clear();
+    }
+
+    auto PartitionImport::receive(const cloud::CloudMessage &msg) -> bool {
+        const auto &chunk = msg.chunk();
+        last_chunk = std::chrono::steady_clock::now();
+
+        if (!chunk.file().empty()) {
+            // never trust a path from the wire, only keep the file name
+            auto file = (std::filesystem::path(staging_dir) /
+                         fmt::format("{}-{}", id, std::filesystem::path(chunk.file()).filename().string())).string();
+            if (chunk.offset() == 0) {
+                std::filesystem::create_directories(staging_dir);
+                if (std::find(files.begin(), files.end(), file) == files.end()) files.emplace_back(file);
+            } else if (!std::filesystem::exists(file) || std::filesystem::file_size(file) != chunk.offset()) {
+                return false;
+            }
+            std::ofstream out(file, std::ios::binary | (chunk.offset() == 0 ? std::ios::trunc : std::ios::app));
+            out.write(chunk.data().data(), static_cast<std::streamsize>(chunk.data().size()));
+            if (!out) return false;
+        }
+
+        if (chunk.ingest()) {
+            auto ok = kvs.ingest_partition(id, files);
+            remove_files();
+            if (!ok) return false;
+        }
+
+        if (chunk.puts_size() > 0 || chunk.deletes_size() > 0) {
+            KVS::Writes writes;
+            for (const auto &kvp: chunk.puts()) {
+                writes[kvp.key()] = kvp.value();
+            }
+            for (const auto &key: chunk.deletes()) {
+                writes[key] = std::nullopt;
+            }
+            if (!kvs.apply_writes(id, writes)) return false;
+        }
+
+        if (chunk.done()) {
+            if (!msg.success() || !kvs.end_import(id, chunk.applied_index())) return false;
+            done = true;
+        }
+        return true;
+    }
+
+}  // namespace cloudlab
@@ -1,46 +1,46 @@
 #include "cloudlab/kvs.hh"
-
-#include "fmt/core.h"
-#include "rocksdb/db.h"
+#include "cloudlab/trace.hh"
 
 #include <algorithm>
-#include <limits>
-#include <random>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <utility>
 
 namespace cloudlab {
 
     auto KVS::open() -> bool {
-        // only open db if it was not opened yet
-        if (!db) {
-            rocksdb::Options options;
-            options.create_if_missing = true;
-            bool b = rocksdb::DB::Open(options, path.string(), &db).ok();
-            if (b) {
-                for (int i = 0; i < partitions; i++) {
-                    create_partition(i);
-                }
-            } else {
-                std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
-                column_families.emplace_back(
-                        rocksdb::kDefaultColumnFamilyName, rocksdb::ColumnFamilyOptions());
-                for (int i = 0; i < 4; i++) {
-                    column_families.emplace_back(
-                            std::to_string(i), rocksdb::ColumnFamilyOptions());
-                }
-                b = rocksdb::DB::Open(options, path.string(), column_families, &partition_handles, &db).ok();
-
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        // only open the engine if it was not opened yet
+        if (opened.load()) return true;
+        if (!engine->open()) return false;
+        load_map();
+        // a fresh store starts with all partitions, later on the partitions
+        // follow the placement of the cluster
+        if (engine->partition_ids().empty()) {
+            for (auto id: map.ids()) {
+                engine->create_partition(id);
             }
-            return b;
         }
+        opened.store(true, std::memory_order_release);
         return true;
     }
 
     auto KVS::get(const std::string &key, std::string &result) -> bool {
-        mtx.lock();
-        if (!db) open();
-        auto x =partition(key_to_partition(key)).handle;
-        bool b = db && db->Get(rocksdb::ReadOptions(), x , key, &result).ok();
-        mtx.unlock();
+        // hot keys are answered without touching the mutex or the engine
+        if (cache.get(key, result)) {
+            load.record(key, result.size());
+            return true;
+        }
+        ensure_open();
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        bool b;
+        {
+            ScopedStage stage{Stage::STORAGE_READ};
+            b = engine->get(key_to_partition(key), key, result);
+        }
+        if (b) cache.put(key, result);
+        load.record(key, result.size());
         return b;
     }
 
@@ -54,61 +54,327 @@ namespace cloudlab {
     }
 
     auto KVS::put(const std::string &key, const std::string &value) -> bool {
-        mtx.lock();
-        if (!db) open();
-        bool b = db && db->Put(rocksdb::WriteOptions(), partition(key_to_partition(key)).handle, key, value).ok();
-        mtx.unlock();
+        ensure_open();
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        wait_unfrozen(lock, {{key_to_partition(key), key, value, false}});
+        capture(key, value);
+        bool b;
+        {
+            ScopedStage stage{Stage::STORAGE_WRITE};
+            b = engine->put(key_to_partition(key), key, value);
+        }
+        cache.erase(key);
+        load.record(key, key.size() + value.size());
         return b;
     }
 
     auto KVS::remove(const std::string &key) -> bool {
-        mtx.lock();
-        if (!db) open();
-        bool b = db && db->Delete(rocksdb::WriteOptions(), partition(key_to_partition(key)).handle, key).ok();
-        mtx.unlock();
+        ensure_open();
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        wait_unfrozen(lock, {{key_to_partition(key), key, {}, true}});
+        capture(key, std::nullopt);
+        bool b;
+        {
+            ScopedStage stage{Stage::STORAGE_WRITE};
+            b = engine->remove(key_to_partition(key), key);
+        }
+        cache.erase(key);
+        load.record(key, key.size());
+        return b;
+    }
+
+    auto KVS::apply(std::vector<Mutation> &batch, uint64_t index) -> bool {
+        ensure_open();
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        for (auto &m: batch) {
+            m.partition = key_to_partition(m.key);
+        }
+        // an entry is never skipped: the replicas must not drift apart, so it
+        // waits for the short freeze at the end of a transfer
+        wait_unfrozen(lock, batch);
+        for (auto &m: batch) {
+            capture(m.key, m.remove ? std::nullopt : std::optional<std::string_view>{m.value});
+        }
+        hold_back(batch, index);
+        bool b;
+        {
+            ScopedStage stage{Stage::STORAGE_WRITE};
+            b = engine->apply(batch, index);
+        }
+        for (auto &m: batch) {
+            cache.erase(std::string{m.key});
+            load.record(m.key, m.key.size() + m.value.size());
+        }
+        return b;
+    }
+
+    auto KVS::split_partition(size_t source, size_t target, const std::vector<uint32_t> &buckets, uint64_t index)
+    -> bool {
+        ensure_open();
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        // a partition in transfer keeps its buckets until the transfer is done
+        if (captures.contains(source)) return false;
+
+        std::vector<bool> moved(hash_buckets);
+        for (auto b: buckets) {
+            if (b < hash_buckets && map.partition_of_bucket(b) == source) moved[b] = true;
+        }
+        map.assign(buckets, target);
+        // the map is stored first, replaying the split after a crash moves
+        // the remaining keys again
+        bool b = store_map();
+
+        std::vector<std::string> keys, values;
+        if (engine->has_partition(source)) {
+            engine->create_partition(target);
+            // the cursor has to be gone before the batch writes the partition
+            for (auto &cursor: engine->cursors({source})) {
+                for (cursor->seek_to_first(); cursor->valid(); cursor->next()) {
+                    if (!moved[PartitionMap::bucket(cursor->key())]) continue;
+                    keys.emplace_back(cursor->key());
+                    values.emplace_back(cursor->value());
+                }
+            }
+        }
+        std::vector<Mutation> batch;
+        for (size_t i = 0; i < keys.size(); i++) {
+            batch.push_back({target, keys[i], values[i], false});
+            batch.push_back({source, keys[i], {}, true});
+        }
+        // the split is a log entry, so the applied index advances either way
+        return engine->apply(batch, index) && b;
+    }
+
+    auto KVS::applied_index() -> uint64_t {
+        ensure_open();
+        return engine->applied_index();
+    }
+
+    auto KVS::wait_unfrozen(std::unique_lock<std::shared_mutex> &lock, const std::vector<Mutation> &batch) -> void {
+        unfrozen.wait(lock, [&] {
+            return std::none_of(batch.begin(), batch.end(), [&](const auto &m) {
+                auto it = captures.find(m.partition);
+                return it != captures.end() && it->second.frozen;
+            });
+        });
+    }
+
+    auto KVS::capture(std::string_view key, const std::optional<std::string_view> &value) -> void {
+        if (captures.empty()) return;
+        auto it = captures.find(key_to_partition(key));
+        if (it == captures.end()) return;
+        it->second.writes[std::string{key}] = value ? std::optional<std::string>{*value} : std::nullopt;
+    }
+
+    auto KVS::hold_back(std::vector<Mutation> &batch, uint64_t index) -> void {
+        if (imports.empty()) return;
+        std::erase_if(batch, [&](const auto &m) {
+            auto it = imports.find(m.partition);
+            if (it == imports.end()) return false;
+            auto &import = it->second;
+            if (!import.covered) {
+                import.held.push_back({index, std::string{m.key},
+                                       m.remove ? std::nullopt : std::optional<std::string>{m.value}});
+                return true;
+            }
+            return index <= *import.covered;
+        });
+        // the transfer covered everything up to its end, the partition is ours
+        std::erase_if(imports, [&](const auto &import) {
+            return import.second.covered && index > *import.second.covered;
+        });
+    }
+
+    auto KVS::begin_capture(size_t id) -> void {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        captures[id] = {};
+    }
+
+    auto KVS::take_capture(size_t id, bool freeze) -> KVS::Writes {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        auto it = captures.find(id);
+        if (it == captures.end()) return {};
+        it->second.frozen = freeze;
+        if (!freeze) unfrozen.notify_all();
+        return std::exchange(it->second.writes, {});
+    }
+
+    auto KVS::end_capture(size_t id) -> void {
+        {
+            std::unique_lock<std::shared_mutex> lock(mtx);
+            captures.erase(id);
+        }
+        unfrozen.notify_all();
+    }
+
+    auto KVS::begin_import(size_t id) -> void {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        imports[id] = {};
+    }
+
+    auto KVS::end_import(size_t id, uint64_t covered) -> bool {
+        ensure_open();
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        auto it = imports.find(id);
+        if (it == imports.end() || it->second.covered) return false;
+        auto &import = it->second;
+        std::vector<Mutation> batch;
+        for (const auto &write: import.held) {
+            if (write.index <= covered) continue;
+            batch.push_back({id, write.key, write.value ? std::string_view{*write.value} : std::string_view{},
+                             !write.value});
+            cache.erase(write.key);
+        }
+        // the held writes were applied as far as the raft log is concerned
+        bool b = engine->write(batch);
+        if (engine->applied_index() >= covered) {
+            imports.erase(it);
+        } else {
+            import.held.clear();
+            import.covered = covered;
+        }
         return b;
     }
 
+    auto KVS::abort_import(size_t id) -> void {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        imports.erase(id);
+    }
+
+    auto KVS::export_partition(size_t id, const std::string &dir, std::vector<std::string> &files) -> bool {
+        ensure_open();
+        return engine->export_partition(id, dir, files);
+    }
+
+    auto KVS::ingest_partition(size_t id, const std::vector<std::string> &files) -> bool {
+        ensure_open();
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        cache.clear();
+        return engine->ingest_partition(id, files);
+    }
+
+    auto KVS::apply_writes(size_t id, const KVS::Writes &writes) -> bool {
+        ensure_open();
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        std::vector<Mutation> batch;
+        for (const auto &[key, value]: writes) {
+            batch.push_back({id, key, value ? std::string_view{*value} : std::string_view{}, !value});
+            cache.erase(key);
+        }
+        return engine->write(batch);
+    }
+
+    auto KVS::create_partition(size_t id) -> bool {
+        ensure_open();
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        return engine->create_partition(id);
+    }
+
+    auto KVS::remove_partition(size_t id) -> bool {
+        ensure_open();
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        cache.clear();
+        return engine->drop_partition(id);
+    }
+
+    auto KVS::has_partition(size_t id) -> bool {
+        ensure_open();
+        {
+            std::shared_lock<std::shared_mutex> lock(mtx);
+            if (importing(id)) return false;
+        }
+        return engine->has_partition(id);
+    }
+
+    auto KVS::partition_ids() -> std::vector<size_t> {
+        ensure_open();
+        return engine->partition_ids();
+    }
+
+    auto KVS::load_map() -> void {
+        if (path.empty()) return;
+        std::ifstream in{path.string() + "-partitions"};
+        if (!in) return;
+        std::stringstream data;
+        data << in.rdbuf();
+        map.deserialize(data.str());
+    }
+
+    auto KVS::store_map() -> bool {
+        if (path.empty()) return true;
+        auto file = path.string() + "-partitions";
+        {
+            std::ofstream out{file + ".tmp", std::ios::trunc};
+            out << map.serialize();
+            if (!out.flush()) return false;
+        }
+        std::error_code ec;
+        std::filesystem::rename(file + ".tmp", file, ec);
+        return !ec;
+    }
+
     auto KVS::clear() -> bool {
-        mtx.lock();
-        if (!db) open();
+        ensure_open();
+        std::unique_lock<std::shared_mutex> lock(mtx);
         bool b = true;
-        for (auto &handle: partition_handles) {
-            b = db->DropColumnFamily(handle).ok() && b;
-            b = db->DestroyColumnFamilyHandle(handle).ok() && b;
+        cache.clear();
+        for (auto id: engine->partition_ids()) {
+            b = engine->drop_partition(id) && b;
+            b = engine->create_partition(id) && b;
         }
-        mtx.unlock();
         return b;
     }
 
     auto KVS::clear_partition(size_t id) -> bool {
-        mtx.lock();
-        if (!db) open();
-        auto k = std::find_if(partition_handles.begin(), partition_handles.end(),
-                              [&id](rocksdb::ColumnFamilyHandle *handle) {
-                                  return handle->GetName() == std::to_string(id);
-                              });
-        if (k != partition_handles.end()) {
-            bool b = db->DropColumnFamily(*k).ok();
-            b = db->DestroyColumnFamilyHandle(*k).ok() && b;
-            partition_handles.erase(k);
-            mtx.unlock();
-            return b;
-        }
-        mtx.unlock();
+        ensure_open();
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        if (!engine->has_partition(id)) return true;
+        cache.clear();
+        bool b = engine->drop_partition(id);
+        return engine->create_partition(id) && b;
+    }
+
+    auto KVS::snapshot() -> bool {
+        ensure_open();
+        // writers are blocked, so the snapshot is a consistent cut
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        return engine->snapshot();
+    }
+
+    auto KVS::scan(const std::string &start, const std::string &end, size_t limit,
+                   size_t max_bytes,
+                   std::vector<std::pair<std::string, std::string>> &buffer,
+                   std::string &next, const std::vector<size_t> &ids) -> bool {
+        size_t bytes{};
+        next.clear();
+        for (auto it = seek(start, ids); it != this->end(); ++it) {
+            auto [key, value] = *it;
+            if (!end.empty() && key >= end) break;
+            if (buffer.size() >= limit || (!buffer.empty() && bytes + key.size() + value.size() > max_bytes)) {
+                next = key;
+                break;
+            }
+            bytes += key.size() + value.size();
+            buffer.emplace_back(key, value);
+        }
         return true;
     }
 
     auto KVS::begin() -> KVS::Iterator {
-        mtx.lock();
-        if (!db) open();
-        std::vector<rocksdb::Iterator *> its;
-        db->NewIterators(rocksdb::ReadOptions(), partition_handles, &its);
-        KVS::Iterator iterator;
-        for (auto &it: its) {
-            iterator.iterators.emplace_back(it);
-        }
-        mtx.unlock();
+        return seek({});
+    }
+
+    auto KVS::seek(const std::string &key, const std::vector<size_t> &ids) -> KVS::Iterator {
+        ensure_open();
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        std::vector<size_t> local;
+        for (auto id: engine->partition_ids()) {
+            if (importing(id)) continue;
+            if (ids.empty() || std::find(ids.begin(), ids.end(), id) != ids.end()) local.emplace_back(id);
+        }
+        KVS::Iterator iterator{engine->cursors(local)};
+        lock.unlock();
+        iterator.seek(key);
         return iterator;
     }
 
@@ -117,72 +383,58 @@ namespace cloudlab {
         return {};
     }
 
-    auto KVS::Iterator::operator*()
-    -> std::pair<std::string_view, std::string_view> {
-        for (auto its = this->iterators.begin(); its != this->iterators.end();) {
-            if (*its == nullptr || !(*its)->Valid()) {
-                delete *its;
-                its = this->iterators.erase(its);
-            } else {
-                return {(*its)->key().ToStringView(), (*its)->value().ToStringView()};
-            }
-        }
-        return {};
+    // min-heap on the current key of every partition cursor
+    static auto heap_order(Cursor *lhs, Cursor *rhs) -> bool {
+        return lhs->key() > rhs->key();
     }
 
-    auto KVS::Iterator::operator++() -> KVS::Iterator & {
-        bool i{};
-        for (auto its = this->iterators.begin(); its != this->iterators.end();) {
-            if (*its == nullptr || !(*its)->Valid()) {
-                i = true;
-                delete *its;
-                its = this->iterators.erase(its);
+    KVS::Iterator::Iterator(std::vector<std::unique_ptr<Cursor>> cursors) : cursors{std::move(cursors)} {
+    }
+
+    auto KVS::Iterator::seek(const std::string &key) -> void {
+        for (auto &cursor: cursors) {
+            if (key.empty()) {
+                cursor->seek_to_first();
             } else {
-                if (!i) {
-                    (*its)->Next();
-                    continue;
-                }
-                break;
+                cursor->seek(key);
             }
         }
-        return *this;
+        rebuild_heap();
     }
 
-    auto operator==(const KVS::Iterator &it, const KVS::Sentinel &) -> bool {
-        if (it.iterators.empty()) return true;
-        for (auto *its: it.iterators) {
-            if (its != nullptr && its->Valid()) return false;
+    auto KVS::Iterator::rebuild_heap() -> void {
+        heap.clear();
+        for (auto &cursor: cursors) {
+            if (cursor->valid()) heap.emplace_back(cursor.get());
         }
-        return true;
+        std::make_heap(heap.begin(), heap.end(), heap_order);
     }
 
-    auto operator!=(const KVS::Iterator &lhs, const KVS::Sentinel &rhs) -> bool {
-        return !(lhs == rhs);
-    }
-
-    KVS::~KVS() {
-        for (auto handle: partition_handles) {
-            db->DestroyColumnFamilyHandle(handle);
-        }
-        delete db;
+    auto KVS::Iterator::operator*()
+    -> std::pair<std::string_view, std::string_view> {
+        if (heap.empty()) return {};
+        return {heap.front()->key(), heap.front()->value()};
     }
 
-    KVS::Iterator::~Iterator() {
-        for (auto &it: iterators) {
-            delete it;
+    auto KVS::Iterator::operator++() -> KVS::Iterator & {
+        if (heap.empty()) return *this;
+        std::pop_heap(heap.begin(), heap.end(), heap_order);
+        auto *cursor = heap.back();
+        cursor->next();
+        if (cursor->valid()) {
+            std::push_heap(heap.begin(), heap.end(), heap_order);
+        } else {
+            heap.pop_back();
         }
+        return *this;
     }
 
-    auto KVS::Partition::begin() const -> KVS::Iterator {
-        auto it = db->NewIterator(rocksdb::ReadOptions(), handle);
-        KVS::Iterator iterator;
-        iterator.iterators.emplace_back(it);
-        return iterator;
+    auto operator==(const KVS::Iterator &it, const KVS::Sentinel &) -> bool {
+        return it.heap.empty();
     }
 
-// NOLINTNEXTLINE(readability-convert-member-functions-to-static)
-    auto KVS::Partition::end() const -> KVS::Sentinel {
-        return {};
+    auto operator!=(const KVS::Iterator &lhs, const KVS::Sentinel &rhs) -> bool {
+        return !(lhs == rhs);
     }
 
 }  // namespace cloudlab
\ No newline at end of file
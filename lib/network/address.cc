@@ -8,12 +8,18 @@
 
 namespace cloudlab {
 
-SocketAddress::SocketAddress(const std::string& address) {
-  union {
-    struct sockaddr_in v4;
-    struct sockaddr_in6 v6;
-  } buffer{};
+// FNV-1a over the resolved address, computed once per address
+static auto hash_bytes(const void* data, size_t size) -> std::size_t {
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return static_cast<std::size_t>(hash);
+}
 
+SocketAddress::SocketAddress(const std::string& address) {
   // split address string by last colon
   auto cut = address.find_last_of(":\\");
 
@@ -22,6 +28,7 @@ SocketAddress::SocketAddress(const std::string& address) {
     auto port_str = address.substr(cut + 1);
 
     // 1. parse port
+    uint16_t port;
     try {
       port = static_cast<uint16_t>(std::stoi(port_str));
     } catch (std::invalid_argument&) {
@@ -39,17 +46,24 @@ SocketAddress::SocketAddress(const std::string& address) {
         std::remove(ip_address_str.begin(), ip_address_str.end(), ']'),
         ip_address_str.end());
 
-    ip_address = ip_address_str;
-
     // valid IPv4 address?
-    if (inet_pton(AF_INET, ip_address_str.c_str(), &buffer)) {
-      type = IPAddressType::V4;
+    auto* v4 = reinterpret_cast<struct sockaddr_in*>(&storage);
+    if (inet_pton(AF_INET, ip_address_str.c_str(), &v4->sin_addr) == 1) {
+      v4->sin_family = AF_INET;
+      v4->sin_port = htons(port);
+      length = sizeof(struct sockaddr_in);
+      hash_value = hash_bytes(&storage, length);
       return;
     }
 
     // valid IPv6 address?
-    if (inet_pton(AF_INET6, ip_address_str.c_str(), &buffer)) {
-      type = IPAddressType::V6;
+    storage = {};
+    auto* v6 = reinterpret_cast<struct sockaddr_in6*>(&storage);
+    if (inet_pton(AF_INET6, ip_address_str.c_str(), &v6->sin6_addr) == 1) {
+      v6->sin6_family = AF_INET6;
+      v6->sin6_port = htons(port);
+      length = sizeof(struct sockaddr_in6);
+      hash_value = hash_bytes(&storage, length);
       return;
     }
   }
@@ -58,12 +72,31 @@ SocketAddress::SocketAddress(const std::string& address) {
       fmt::format("{} could not be parsed as <IP address>:<port>", address));
 }
 
+auto SocketAddress::get_ip_address() const -> std::string {
+  char buffer[INET6_ADDRSTRLEN]{};
+  if (is_ipv4()) {
+    const auto* v4 = reinterpret_cast<const struct sockaddr_in*>(&storage);
+    inet_ntop(AF_INET, &v4->sin_addr, buffer, sizeof(buffer));
+  } else {
+    const auto* v6 = reinterpret_cast<const struct sockaddr_in6*>(&storage);
+    inet_ntop(AF_INET6, &v6->sin6_addr, buffer, sizeof(buffer));
+  }
+  return buffer;
+}
+
+auto SocketAddress::get_port() const -> uint16_t {
+  if (is_ipv4()) {
+    return ntohs(reinterpret_cast<const struct sockaddr_in*>(&storage)->sin_port);
+  }
+  return ntohs(reinterpret_cast<const struct sockaddr_in6*>(&storage)->sin6_port);
+}
+
 auto SocketAddress::string() const -> std::string {
-  if (type == IPAddressType::V4) {
-    return fmt::format("{}:{}", ip_address, port);
+  if (is_ipv4()) {
+    return fmt::format("{}:{}", get_ip_address(), get_port());
   }
 
-  return fmt::format("[{}]:{}", ip_address, port);
+  return fmt::format("[{}]:{}", get_ip_address(), get_port());
 }
 
-}  // namespace cloudlab
\ No newline at end of file
+}  // namespace cloudlab
@@ -1,5 +1,6 @@
 #include "cloudlab/network/connection.hh"
 #include "cloudlab/network/address.hh"
+#include "cloudlab/arena.hh"
 
 #include "fmt/core.h"
 
@@ -7,33 +8,16 @@
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
 
-#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 namespace cloudlab {
 
     Connection::Connection(const SocketAddress &address) {
-        addrinfo hints{}, *req = nullptr;
-        memset(&hints, 0, sizeof(addrinfo));
-
-        if (address.is_ipv4()) {
-            hints.ai_family = AF_INET;
-            hints.ai_addrlen = sizeof(struct sockaddr_in);
-        } else {
-            hints.ai_family = AF_INET6;
-            hints.ai_addrlen = sizeof(struct sockaddr_in6);
-        }
-
-        hints.ai_socktype = SOCK_STREAM;
-        hints.ai_flags = IPPROTO_TCP;
-
-        if (getaddrinfo(address.get_ip_address().c_str(),
-                        std::to_string(address.get_port()).c_str(), &hints,
-                        &req) != 0) {
-            throw std::runtime_error("getaddrinfo() failed");
-        }
-
-        fd = socket(req->ai_family, req->ai_socktype, req->ai_protocol);
+        // the address is already resolved, no getaddrinfo() needed
+        fd = socket(address.sockaddr()->sa_family, SOCK_STREAM, IPPROTO_TCP);
         if (fd == -1) {
             throw std::runtime_error("socket() failed");
         }
@@ -44,12 +28,10 @@ namespace cloudlab {
             throw std::runtime_error("setsockopt() failed");
         }
 
-        if (connect(fd, req->ai_addr, req->ai_addrlen) == -1) {
+        if (connect(fd, address.sockaddr(), address.sockaddr_length()) == -1) {
             // throw std::runtime_error("perform_connect() failed");
             connect_failed = true;
         }
-
-        freeaddrinfo(req);
     }
 
     Connection::Connection(const std::string &address)
@@ -60,15 +42,68 @@ namespace cloudlab {
         close(fd);
     }
 
-    auto Connection::receive(cloud::CloudMessage &msg) const -> bool {
-        uint32_t size{}, read_bytes{};
+    auto Connection::shutdown() const -> void {
+        int sock = bev ? bufferevent_getfd(static_cast<struct bufferevent *>(bev)) : fd;
+        if (sock != -1) ::shutdown(sock, SHUT_RDWR);
+    }
+
+    auto Connection::read_fully(void *buf, size_t size) const -> size_t {
+        auto *out = static_cast<uint8_t *>(buf);
+        size_t done{};
+        int sock = fd;
 
         if (bev) {
+            // first drain what libevent already buffered for us
             auto *input = bufferevent_get_input(static_cast<struct bufferevent *>(bev));
-            read_bytes = evbuffer_remove(input, &size, 4);
-        } else {
-            read_bytes = read(fd, &size, 4);
+            auto n = evbuffer_remove(input, out, size);
+            if (n > 0) done += n;
+            sock = bufferevent_getfd(static_cast<struct bufferevent *>(bev));
+        }
+
+        // the rest of a large message is read from the socket directly; read
+        // events of the bufferevent are disabled while a worker handles it
+        while (done < size) {
+            auto n = read(sock, out + done, size - done);
+            if (n > 0) {
+                done += n;
+            } else if (n == 0) {
+                break;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                pollfd pfd{sock, POLLIN, 0};
+                poll(&pfd, 1, -1);
+            } else if (errno != EINTR) {
+                break;
+            }
+        }
+        return done;
+    }
+
+    auto Connection::write_fully(const void *buf, size_t size) const -> bool {
+        const auto *in = static_cast<const uint8_t *>(buf);
+        size_t done{};
+        int sock = bev ? bufferevent_getfd(static_cast<struct bufferevent *>(bev)) : fd;
+
+        while (done < size) {
+            // a closed peer must not kill the process with SIGPIPE
+            auto n = ::send(sock, in + done, size - done, MSG_NOSIGNAL);
+            if (n > 0) {
+                done += n;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                pollfd pfd{sock, POLLOUT, 0};
+                poll(&pfd, 1, -1);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else {
+                return false;
+            }
         }
+        return true;
+    }
+
+    auto Connection::receive(cloud::CloudMessage &msg) const -> bool {
+        uint32_t size{}, read_bytes{};
+
+        read_bytes = read_fully(&size, 4);
 
         if (read_bytes < 4) {
             if (read_bytes == 0) {
@@ -89,17 +124,17 @@ namespace cloudlab {
                     "Connection received a message that exceeds the maximum message size");
         }
 
-        auto buf = std::make_unique<uint8_t[]>(size);
+        // messages of a request scope take their buffer from the same arena,
+        // unless it would outgrow the block the arena keeps
+        std::unique_ptr<uint8_t[]> heap_buf;
+        auto *buf = msg.GetArena() != nullptr && size <= request_arena_block
+                    ? google::protobuf::Arena::CreateArray<uint8_t>(msg.GetArena(), size)
+                    : (heap_buf = std::make_unique<uint8_t[]>(size)).get();
 
         // read rest of the message
-        if (bev) {
-            auto *input = bufferevent_get_input(static_cast<struct bufferevent *>(bev));
-            read_bytes = evbuffer_remove(input, buf.get(), size);
-        } else {
-            read_bytes = read(fd, buf.get(), size);
-        }
+        read_bytes = read_fully(buf, size);
 
-        msg.ParseFromArray(buf.get(), size);
+        msg.ParseFromArray(buf, size);
 
         return (read_bytes == size);
     }
@@ -115,17 +150,8 @@ namespace cloudlab {
         // serialize message
         msg.SerializeToArray(buffer.get() + 4, size);
 
-        bool success{};
-
         // write everything out
-        if (bev) {
-            auto fd = bufferevent_getfd(static_cast<struct bufferevent *>(bev));
-            success = write(fd, buffer.get(), size + 4) == size + 4;
-        } else {
-            success = write(fd, buffer.get(), size + 4) == size + 4;
-        }
-
-        return success;
+        return write_fully(buffer.get(), size + 4);
     }
 
 }  // namespace cloudlab
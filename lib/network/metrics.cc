@@ -0,0 +1,214 @@
+#include "cloudlab/network/metrics.hh"
+#include "cloudlab/stats.hh"
+
+#include "fmt/core.h"
+
+#include "cloud.pb.h"
+#include <event2/buffer.h>
+#include <event2/event.h>
+#include <event2/http.h>
+
+#include <algorithm>
+#include <cctype>
+
+namespace cloudlab {
+
+namespace {
+
+// bucket bounds of the exported latency histograms, in nanoseconds; the
+// counts are read from the log-linear buckets of Histogram, so a bound is off
+// by at most the bucket width (about 3%)
+const uint64_t latency_bounds[] = {
+    25'000,        50'000,        100'000,       250'000,      500'000,
+    1'000'000,     2'500'000,     5'000'000,     10'000'000,   25'000'000,
+    50'000'000,    100'000'000,   250'000'000,   500'000'000,  1'000'000'000,
+    2'500'000'000, 5'000'000'000, 10'000'000'000};
+
+auto seconds(uint64_t ns) -> double {
+  return static_cast<double>(ns) / 1e9;
+}
+
+// metric names may only contain [a-zA-Z0-9_:]
+auto metric_name(const std::string& name) -> std::string {
+  std::string result{"kvs_"};
+  for (auto c : name) {
+    result += std::isalnum(static_cast<unsigned char>(c)) ? c : '_';
+  }
+  return result;
+}
+
+auto header(std::string& out, const std::string& name, const char* type,
+            const char* help) -> void {
+  out += fmt::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+}
+
+auto histogram(std::string& out, const std::string& name,
+               const std::string& labels, const Histogram& h) -> void {
+  auto buckets = h.buckets();
+  size_t next{};
+  uint64_t below{};
+  for (auto bound : latency_bounds) {
+    for (; next < buckets.size() && buckets[next].first <= bound; next++) {
+      below = buckets[next].second;
+    }
+    out += fmt::format("{}_bucket{{{},le=\"{}\"}} {}\n", name, labels,
+                       seconds(bound), below);
+  }
+  // the buckets are read one by one, so the total is taken from them as well
+  auto total = buckets.empty() ? 0 : buckets.back().second;
+  out += fmt::format("{}_bucket{{{},le=\"+Inf\"}} {}\n", name, labels, total);
+  out += fmt::format("{}_sum{{{}}} {}\n", name, labels, seconds(h.sum()));
+  out += fmt::format("{}_count{{{}}} {}\n", name, labels, total);
+}
+
+}  // namespace
+
+auto MetricsServer::run() -> std::thread {
+  return std::thread(&MetricsServer::serve, this);
+}
+
+auto MetricsServer::serve() -> void {
+  auto socket_address = SocketAddress{address};
+
+  auto* base = event_base_new();
+  if (!base) {
+    throw std::runtime_error{"could not initialize libevent\n"};
+  }
+  auto* http = evhttp_new(base);
+  if (!http || evhttp_bind_socket(http,
+                                  socket_address.get_ip_address().c_str(),
+                                  socket_address.get_port()) != 0) {
+    throw std::runtime_error{"could not bind the metrics listener\n"};
+  }
+
+  auto metrics_handler = [](struct evhttp_request* request, void* user_data) {
+    auto* server = static_cast<MetricsServer*>(user_data);
+    auto body = server->render();
+    auto* buffer = evbuffer_new();
+    evbuffer_add(buffer, body.data(), body.size());
+    evhttp_add_header(evhttp_request_get_output_headers(request),
+                      "Content-Type", "text/plain; version=0.0.4");
+    evhttp_send_reply(request, HTTP_OK, "OK", buffer);
+    evbuffer_free(buffer);
+  };
+  evhttp_set_cb(http, "/metrics", metrics_handler, this);
+
+  event_base_dispatch(base);
+
+  evhttp_free(http);
+  event_base_free(base);
+}
+
+auto MetricsServer::render() -> std::string {
+  std::string out;
+  auto& registry = stats();
+
+  // requests by operation
+  header(out, "kvs_requests_total", "counter", "Requests handled.");
+  for (auto op = 0; op < max_operations; op++) {
+    if (!cloud::CloudMessage_Operation_IsValid(op)) continue;
+    out += fmt::format("kvs_requests_total{{operation=\"{}\"}} {}\n",
+                       cloud::CloudMessage_Operation_Name(op),
+                       registry.operation(op).count());
+  }
+  header(out, "kvs_request_duration_seconds", "histogram",
+         "Time from a received request to the sent response.");
+  for (auto op = 0; op < max_operations; op++) {
+    if (!cloud::CloudMessage_Operation_IsValid(op)) continue;
+    if (registry.operation(op).count() == 0) continue;
+    histogram(out, "kvs_request_duration_seconds",
+              fmt::format("operation=\"{}\"",
+                          cloud::CloudMessage_Operation_Name(op)),
+              registry.operation(op));
+  }
+  header(out, "kvs_stage_duration_seconds", "histogram",
+         "Time spent per request stage.");
+  for (auto i = 0; i < static_cast<int>(Stage::COUNT); i++) {
+    auto stage = static_cast<Stage>(i);
+    histogram(out, "kvs_stage_duration_seconds",
+              fmt::format("stage=\"{}\"", stage_name(stage)),
+              registry.stage(stage));
+  }
+
+  // workers
+  header(out, "kvs_worker_queue_depth", "gauge",
+         "Connections with pending requests waiting for a worker.");
+  for (const auto& [name, server] : servers) {
+    out += fmt::format("kvs_worker_queue_depth{{server=\"{}\"}} {}\n", name,
+                       server->queue_depth());
+  }
+
+  // raft
+  auto status = handler.raft_status();
+  header(out, "kvs_raft_term", "gauge", "Current raft term.");
+  out += fmt::format("kvs_raft_term {}\n", status.term);
+  header(out, "kvs_raft_role", "gauge", "1 for the current raft role.");
+  const std::pair<RaftRole, const char*> roles[] = {
+      {RaftRole::LEADER, "leader"},
+      {RaftRole::CANDIDATE, "candidate"},
+      {RaftRole::FOLLOWER, "follower"}};
+  for (const auto& [role, name] : roles) {
+    out += fmt::format("kvs_raft_role{{role=\"{}\"}} {}\n", name,
+                       status.role == role ? 1 : 0);
+  }
+  header(out, "kvs_raft_learner", "gauge",
+         "1 while this node receives the log without voting.");
+  out += fmt::format("kvs_raft_learner {}\n", status.learner ? 1 : 0);
+  header(out, "kvs_raft_commit_index", "gauge", "Highest committed entry.");
+  out += fmt::format("kvs_raft_commit_index {}\n", status.commit_index);
+  header(out, "kvs_raft_applied_index", "gauge",
+         "Highest entry applied to the state machine.");
+  out += fmt::format("kvs_raft_applied_index {}\n", status.applied_index);
+  header(out, "kvs_raft_log_entries", "gauge", "Entries in the raft log.");
+  out += fmt::format("kvs_raft_log_entries {}\n", status.log_size);
+  header(out, "kvs_raft_dropped_peers", "gauge",
+         "Peers that missed the last heartbeat (leader only).");
+  out += fmt::format("kvs_raft_dropped_peers {}\n",
+                     status.dropped_peers.size());
+  header(out, "kvs_raft_dropped_peer", "gauge", "1 for every dropped peer.");
+  for (const auto& peer : status.dropped_peers) {
+    out += fmt::format("kvs_raft_dropped_peer{{peer=\"{}\"}} 1\n", peer);
+  }
+
+  // replication, only the leader has numbers
+  auto peers = registry.peers();
+  header(out, "kvs_replication_lag_entries", "gauge",
+         "Log entries a follower is behind.");
+  for (const auto& [peer, entry] : peers) {
+    out += fmt::format("kvs_replication_lag_entries{{peer=\"{}\"}} {}\n", peer,
+                       entry->lag.load(std::memory_order_relaxed));
+  }
+  header(out, "kvs_replication_rtt_seconds", "histogram",
+         "Heartbeat round trip per follower.");
+  for (const auto& [peer, entry] : peers) {
+    histogram(out, "kvs_replication_rtt_seconds",
+              fmt::format("peer=\"{}\"", peer), entry->rtt);
+  }
+
+  // cache
+  auto cache = handler.cache_stats();
+  const std::pair<const char*, uint64_t> cache_counters[] = {
+      {"hits", cache.hits},
+      {"misses", cache.misses},
+      {"inserts", cache.inserts},
+      {"evictions", cache.evictions},
+      {"invalidations", cache.invalidations}};
+  for (const auto& [name, value] : cache_counters) {
+    auto metric = fmt::format("kvs_cache_{}_total", name);
+    header(out, metric, "counter", "Hot-key cache events.");
+    out += fmt::format("{} {}\n", metric, value);
+  }
+  header(out, "kvs_cache_bytes", "gauge", "Memory used by the hot-key cache.");
+  out += fmt::format("kvs_cache_bytes {}\n", cache.bytes);
+
+  // storage engine, e.g. the rocksdb tickers and memory usage; the names are
+  // engine-specific, so the type is left open
+  for (const auto& [name, value] : handler.storage_statistics()) {
+    auto metric = metric_name(name);
+    header(out, metric, "untyped", "Storage engine statistic.");
+    out += fmt::format("{} {}\n", metric, value);
+  }
+  return out;
+}
+
+}  // namespace cloudlab
@@ -1,6 +1,8 @@
 #include "cloudlab/network/server.hh"
 #include "cloudlab/network/address.hh"
 #include "cloudlab/spmc.hh"
+#include "cloudlab/stats.hh"
+#include "cloudlab/trace.hh"
 
 #include <cstring>
 #include <thread>
@@ -27,30 +29,10 @@ auto Server::run() -> std::thread {
   return thread;
 }
 
-auto Server::server(const std::string &address, SPMCQueue<void *> &bev_queue)
-    -> void {
+auto Server::server(const std::string &address,
+                    SPMCQueue<ReadyConnection> &bev_queue) -> void {
   auto socket_address = SocketAddress{address};
 
-  addrinfo hints{}, *req = nullptr;
-  memset(&hints, 0, sizeof(addrinfo));
-
-  if (socket_address.is_ipv4()) {
-    hints.ai_family = AF_INET;
-    hints.ai_addrlen = sizeof(struct sockaddr_in);
-  } else {
-    hints.ai_family = AF_INET6;
-    hints.ai_addrlen = sizeof(struct sockaddr_in6);
-  }
-
-  hints.ai_socktype = SOCK_STREAM;
-  hints.ai_flags = IPPROTO_TCP;
-
-  if (getaddrinfo(socket_address.get_ip_address().c_str(),
-                  std::to_string(socket_address.get_port()).c_str(), &hints,
-                  &req) != 0) {
-    throw std::runtime_error{"getaddrinfo() failed"};
-  }
-
   struct event_base *base{};
   struct evconnlistener *listener{};
 
@@ -64,12 +46,12 @@ auto Server::server(const std::string &address, SPMCQueue<void *> &bev_queue)
   auto listen_handler = [](struct evconnlistener *, evutil_socket_t fd,
                            struct sockaddr *, int, void *user_data) {
     auto read_handler = [](struct bufferevent *bev, void *user_data) {
-      auto *bev_queue = static_cast<SPMCQueue<void *> *>(user_data);
+      auto *bev_queue = static_cast<SPMCQueue<ReadyConnection> *>(user_data);
 
       // disable read event handler before passing event to worker thread s.t.
       // no more events are triggered before and during connection handling
       bufferevent_disable(bev, EV_READ);
-      bev_queue->produce(bev);
+      bev_queue->produce({bev, std::chrono::steady_clock::now()});
     };
 
     auto event_handler = [](struct bufferevent *bev, short events, void *) {
@@ -83,8 +65,8 @@ auto Server::server(const std::string &address, SPMCQueue<void *> &bev_queue)
     };
 
     auto *base_and_bev_queue =
-        static_cast<std::pair<struct event_base *, SPMCQueue<void *> *> *>(
-            user_data);
+        static_cast<std::pair<struct event_base *, SPMCQueue<ReadyConnection> *>
+                        *>(user_data);
 
     auto *base = base_and_bev_queue->first;
     auto *bev_queue = base_and_bev_queue->second;
@@ -101,7 +83,7 @@ auto Server::server(const std::string &address, SPMCQueue<void *> &bev_queue)
   listener = evconnlistener_new_bind(
       base, listen_handler, &base_and_bev_queue,
       LEV_OPT_REUSEABLE | LEV_OPT_CLOSE_ON_FREE | LEV_OPT_THREADSAFE, -1,
-      req->ai_addr, req->ai_addrlen);
+      socket_address.sockaddr(), socket_address.sockaddr_length());
 
   if (!listener) {
     throw std::runtime_error{"could not create a listener\n"};
@@ -113,17 +95,33 @@ auto Server::server(const std::string &address, SPMCQueue<void *> &bev_queue)
   event_base_free(base);
 }
 
-auto Server::worker(ServerHandler &handler, SPMCQueue<void *> &bev_queue)
-    -> void {
+auto Server::worker(ServerHandler &handler,
+                    SPMCQueue<ReadyConnection> &bev_queue) -> void {
+  auto &queue_latency = stats().stage(Stage::QUEUE);
   while (true) {
-    auto *bev = bev_queue.consume();
+    auto [bev, ready] = bev_queue.consume();
 
     // exit worker thread on nullptr
     if (!bev) return;
+    auto waited = std::chrono::steady_clock::now() - ready;
+    queue_latency.record(waited);
+    set_ready_time(std::chrono::system_clock::now() -
+                   std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                       waited));
 
     Connection con{static_cast<void *>(bev)};
     handler.handle_connection(con);
 
+    // pipelining clients send the next requests before the first response;
+    // libevent only signals new data, so serve what is already buffered
+    auto *input = bufferevent_get_input(static_cast<struct bufferevent *>(bev));
+    for (auto pending = evbuffer_get_length(input); pending > 0;) {
+      handler.handle_connection(con);
+      auto left = evbuffer_get_length(input);
+      if (left == pending) break;
+      pending = left;
+    }
+
     // re-enable event handler after connection handling
     bufferevent_enable(static_cast<struct bufferevent *>(bev), EV_READ);
   }
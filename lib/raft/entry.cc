@@ -0,0 +1,140 @@
+#include "cloudlab/raft/entry.hh"
+
+namespace cloudlab {
+
+    namespace {
+
+        const uint8_t traced_flag = 1;
+
+        template<typename T>
+        auto append(std::string &out, T value) -> void {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+        }
+
+    }  // namespace
+
+    LogEntryBuilder::LogEntryBuilder(EntryType type, uint64_t trace_id, uint64_t parent_span_id) {
+        // term and index are stamped on append
+        append<uint64_t>(data, 0);
+        append<uint64_t>(data, 0);
+        append<uint8_t>(data, static_cast<uint8_t>(type));
+        append<uint8_t>(data, trace_id != 0 ? traced_flag : 0);
+        append<uint16_t>(data, 0);
+        append<uint32_t>(data, 0);
+        if (trace_id != 0) {
+            append(data, trace_id);
+            append(data, parent_span_id);
+        }
+    }
+
+    auto LogEntryBuilder::set_count(uint32_t n) -> void {
+        count = n;
+        std::memcpy(data.data() + 20, &count, sizeof(count));
+    }
+
+    auto LogEntryBuilder::add(std::string_view key, std::string_view value) -> void {
+        append<uint32_t>(data, key.size());
+        append<uint32_t>(data, value.size());
+        data += key;
+        data += value;
+        set_count(count + 1);
+    }
+
+    auto LogEntryBuilder::set_split(uint32_t source, uint32_t target, const std::vector<uint32_t> &buckets) -> void {
+        append(data, source);
+        append(data, target);
+        for (auto bucket: buckets) append(data, bucket);
+        set_count(buckets.size());
+    }
+
+    auto LogEntryBuilder::set_config(const std::vector<std::string> &voters,
+                                     const std::vector<std::string> &old_voters,
+                                     const std::vector<std::string> &learners) -> void {
+        append<uint32_t>(data, voters.size());
+        append<uint32_t>(data, old_voters.size());
+        append<uint32_t>(data, learners.size());
+        for (const auto *group: {&voters, &old_voters, &learners}) {
+            for (const auto &address: *group) {
+                append<uint32_t>(data, address.size());
+                data += address;
+            }
+        }
+        set_count(voters.size() + old_voters.size() + learners.size());
+    }
+
+    auto LogEntryView::traced() const -> bool {
+        return (static_cast<uint8_t>(data[17]) & traced_flag) != 0;
+    }
+
+    auto LogEntryView::parse(std::string_view entry) -> bool {
+        data = entry;
+        if (data.size() < entry_header_size) return false;
+        auto offset = body();
+        if (data.size() < offset) return false;
+        switch (type()) {
+            case EntryType::NOOP:
+                return count() == 0 && data.size() == offset;
+            case EntryType::PUT:
+            case EntryType::DELETE: {
+                for (uint32_t i = 0; i < count(); i++) {
+                    if (data.size() - offset < 8) return false;
+                    uint64_t sizes = read<uint32_t>(offset) + uint64_t{read<uint32_t>(offset + 4)};
+                    offset += 8;
+                    if (data.size() - offset < sizes) return false;
+                    offset += sizes;
+                }
+                return offset == data.size();
+            }
+            case EntryType::SPLIT:
+                return data.size() - offset == 8 + uint64_t{count()} * 4;
+            case EntryType::CONFIG: {
+                if (data.size() - offset < 12) return false;
+                if (uint64_t{read<uint32_t>(offset)} + read<uint32_t>(offset + 4) + read<uint32_t>(offset + 8) !=
+                    count()) {
+                    return false;
+                }
+                offset += 12;
+                for (uint32_t i = 0; i < count(); i++) {
+                    if (data.size() - offset < 4) return false;
+                    auto size = read<uint32_t>(offset);
+                    offset += 4;
+                    if (data.size() - offset < size) return false;
+                    offset += size;
+                }
+                return offset == data.size();
+            }
+            default:
+                return false;
+        }
+    }
+
+    auto LogEntryView::split_buckets() const -> std::vector<uint32_t> {
+        std::vector<uint32_t> buckets(count());
+        for (uint32_t i = 0; i < count(); i++) {
+            buckets[i] = read<uint32_t>(body() + 8 + i * 4);
+        }
+        return buckets;
+    }
+
+    auto LogEntryView::config(std::vector<std::string> &voters, std::vector<std::string> &old_voters,
+                              std::vector<std::string> &learners) const -> void {
+        auto offset = body();
+        uint32_t sizes[] = {read<uint32_t>(offset), read<uint32_t>(offset + 4), read<uint32_t>(offset + 8)};
+        offset += 12;
+        std::vector<std::string> *groups[] = {&voters, &old_voters, &learners};
+        for (auto g = 0; g < 3; g++) {
+            groups[g]->clear();
+            for (uint32_t i = 0; i < sizes[g]; i++) {
+                auto size = read<uint32_t>(offset);
+                groups[g]->emplace_back(data.substr(offset + 4, size));
+                offset += 4 + size;
+            }
+        }
+    }
+
+    auto stamp_entry(std::string &entry, uint64_t term, uint64_t index) -> void {
+        std::memcpy(entry.data(), &term, sizeof(term));
+        std::memcpy(entry.data() + 8, &index, sizeof(index));
+    }
+
+}  // namespace cloudlab
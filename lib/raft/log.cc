@@ -0,0 +1,182 @@
+#include "cloudlab/raft/log.hh"
+#include "cloudlab/raft/entry.hh"
+
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cloudlab {
+
+    namespace {
+
+        auto write_fully(int fd, const char *buf, size_t size) -> bool {
+            while (size > 0) {
+                auto written = write(fd, buf, size);
+                if (written < 0) {
+                    if (errno == EINTR) continue;
+                    return false;
+                }
+                buf += written;
+                size -= written;
+            }
+            return true;
+        }
+
+        auto read_fully(int fd, char *buf, size_t size) -> bool {
+            while (size > 0) {
+                auto n = read(fd, buf, size);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                buf += n;
+                size -= n;
+            }
+            return true;
+        }
+
+    }  // namespace
+
+    auto RaftLog::open() -> bool {
+        std::lock_guard<std::mutex> lock(append_mtx);
+        return open_file();
+    }
+
+    auto RaftLog::open_file() -> bool {
+        if (!durable || fd != -1) return true;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd == -1) return false;
+
+        // the file holds the records as they are kept in memory
+        std::string records;
+        std::vector<size_t> starts;
+        uint32_t size;
+        while (read_fully(fd, reinterpret_cast<char *>(&size), sizeof(size))) {
+            std::string entry(size, '\0');
+            if (!read_fully(fd, entry.data(), size)) break;
+            LogEntryView view;
+            if (!view.parse(entry) || view.index() != starts.size() + 1) {
+                // a complete record we cannot read, e.g. of another format:
+                // keep the file as it is
+                close(fd);
+                fd = -1;
+                return false;
+            }
+            starts.push_back(records.size());
+            records.append(reinterpret_cast<const char *>(&size), sizeof(size));
+            records += entry;
+        }
+        auto valid = static_cast<off_t>(records.size());
+        {
+            std::lock_guard<std::shared_mutex> entries_lock(entries_mtx);
+            data = std::move(records);
+            offsets = std::move(starts);
+            length.store(offsets.size(), std::memory_order_release);
+        }
+
+        // cut off a record that was only partially written before a crash
+        if (ftruncate(fd, valid) == -1 || lseek(fd, valid, SEEK_SET) == -1) {
+            return false;
+        }
+        tail = valid;
+        return true;
+    }
+
+    auto RaftLog::append(std::string_view entry) -> uint64_t {
+        std::lock_guard<std::mutex> lock(append_mtx);
+        LogEntryView view;
+        if (!view.parse(entry) || view.index() != size() + 1) return 0;
+
+        uint32_t size = entry.size();
+        std::string record(reinterpret_cast<const char *>(&size), sizeof(size));
+        record += entry;
+        if (durable) {
+            if (fd == -1 && !open_file()) return 0;
+            if (!write_fully(fd, record.data(), record.size()) || fdatasync(fd) == -1) {
+                // never leave a partial record in front of the next append
+                if (ftruncate(fd, tail) == -1 || lseek(fd, tail, SEEK_SET) == -1) {
+                    close(fd);
+                    fd = -1;
+                }
+                return 0;
+            }
+            tail += static_cast<off_t>(record.size());
+        }
+        std::lock_guard<std::shared_mutex> entries_lock(entries_mtx);
+        offsets.push_back(data.size());
+        data += record;
+        length.store(offsets.size(), std::memory_order_release);
+        return offsets.size();
+    }
+
+    auto RaftLog::truncate(uint64_t first) -> bool {
+        std::lock_guard<std::mutex> lock(append_mtx);
+        if (first == 0 || first > size()) return true;
+        // the file holds the records at the same offsets as the buffer
+        auto end = offsets[first - 1];
+        if (durable) {
+            if (fd == -1 && !open_file()) return false;
+            if (ftruncate(fd, static_cast<off_t>(end)) == -1 || lseek(fd, static_cast<off_t>(end), SEEK_SET) == -1 ||
+                fdatasync(fd) == -1) {
+                return false;
+            }
+            tail = static_cast<off_t>(end);
+        }
+        std::lock_guard<std::shared_mutex> entries_lock(entries_mtx);
+        data.resize(end);
+        offsets.resize(first - 1);
+        length.store(offsets.size(), std::memory_order_release);
+        return true;
+    }
+
+    auto RaftLog::at(uint64_t index) const -> std::string {
+        std::shared_lock<std::shared_mutex> lock(entries_mtx);
+        auto offset = offsets.at(index - 1) + sizeof(uint32_t);
+        auto end = index < offsets.size() ? offsets[index] : data.size();
+        return data.substr(offset, end - offset);
+    }
+
+    auto RaftLog::term_at(uint64_t index) const -> uint64_t {
+        if (index == 0) return 0;
+        std::shared_lock<std::shared_mutex> lock(entries_mtx);
+        // the term leads the entry
+        uint64_t term;
+        std::memcpy(&term, data.data() + offsets.at(index - 1) + sizeof(uint32_t), sizeof(term));
+        return term;
+    }
+
+    auto RaftLog::type_at(uint64_t index) const -> EntryType {
+        std::shared_lock<std::shared_mutex> lock(entries_mtx);
+        return static_cast<EntryType>(data[offsets.at(index - 1) + sizeof(uint32_t) + 16]);
+    }
+
+    auto RaftLog::records(uint64_t first, size_t max_bytes) const -> std::string {
+        std::shared_lock<std::shared_mutex> lock(entries_mtx);
+        if (first == 0 || first > offsets.size()) return {};
+        auto begin = offsets[first - 1];
+        if (data.size() - begin <= max_bytes) return data.substr(begin);
+        // whole entries only, the first one however large it is; an entry
+        // ends where the next one starts
+        auto end = first < offsets.size() ? offsets[first] : data.size();
+        for (auto next = first + 1; next < offsets.size() && offsets[next] - begin <= max_bytes; next++) {
+            end = offsets[next];
+        }
+        return data.substr(begin, end - begin);
+    }
+
+    auto RaftLog::split_records(std::string_view records, std::vector<std::string_view> &entries) -> bool {
+        while (!records.empty()) {
+            uint32_t size;
+            if (records.size() < sizeof(size)) return false;
+            std::memcpy(&size, records.data(), sizeof(size));
+            records.remove_prefix(sizeof(size));
+            if (records.size() < size) return false;
+            entries.emplace_back(records.substr(0, size));
+            records.remove_prefix(size);
+        }
+        return true;
+    }
+
+    RaftLog::~RaftLog() {
+        if (fd != -1) close(fd);
+    }
+
+}  // namespace cloudlab
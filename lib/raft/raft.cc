@@ -1,300 +1,754 @@
-#include <condition_variable>
 #include "cloudlab/raft/raft.hh"
 
+#include <algorithm>
 
 namespace cloudlab {
 
+    namespace {
+
+        auto contains(const std::vector<SocketAddress> &group, const SocketAddress &node) -> bool {
+            return std::find(group.begin(), group.end(), node) != group.end();
+        }
+
+        auto majority(const std::vector<SocketAddress> &group, const std::unordered_set<SocketAddress> &nodes) -> bool {
+            auto n = std::count_if(group.begin(), group.end(), [&](const auto &node) { return nodes.contains(node); });
+            return static_cast<size_t>(n) * 2 > group.size();
+        }
+
+        auto strings(const std::vector<SocketAddress> &group) -> std::vector<std::string> {
+            std::vector<std::string> result;
+            for (const auto &node: group) result.emplace_back(node.string());
+            return result;
+        }
+
+    }  // namespace
+
+    auto RaftConfig::votes(const SocketAddress &node) const -> bool {
+        return contains(voters, node) || contains(old_voters, node);
+    }
+
+    auto RaftConfig::learns(const SocketAddress &node) const -> bool {
+        return contains(learners, node);
+    }
+
+    auto RaftConfig::quorum(const std::unordered_set<SocketAddress> &nodes) const -> bool {
+        return majority(voters, nodes) && (!joint() || majority(old_voters, nodes));
+    }
+
 
     auto Raft::put(const std::string &key, const std::string &value) -> bool {
         return kvs.put(key, value);
     }
 
-    auto Raft::perform_election(Routing &routing, std::mutex &mtx) -> void {
+    auto Raft::apply(uint64_t index) -> bool {
+        auto data = log.at(index);
+        LogEntryView entry;
+        if (!entry.parse(data)) return false;
+        // sampled writes are traced on every node that applies them
+        TraceScope trace{TraceContext{entry.trace_id(), entry.parent_span_id(), entry.trace_id() != 0}};
+        TraceSpan span{"apply"};
+        std::vector<Mutation> batch;
+        switch (entry.type()) {
+            case EntryType::PUT:
+            case EntryType::DELETE: {
+                auto remove = entry.type() == EntryType::DELETE;
+                entry.for_each([&](std::string_view key, std::string_view value) {
+                    batch.push_back({0, key, value, remove});
+                });
+                break;
+            }
+            case EntryType::SPLIT: {
+                // split of a hot partition, every node updates its partition map
+                bool b = kvs.split_partition(entry.split_source(), entry.split_target(), entry.split_buckets(),
+                                             index);
+                set_applied(index);
+                return b;
+            }
+            default: {
+                break;
+            }
+        }
+        // entries without writes, e.g. CONFIG entries that took effect when
+        // they were appended, still advance the applied index
+        bool b = kvs.apply(batch, index);
+        set_applied(index);
+        return b;
+    }
+
+    auto Raft::recover() -> bool {
+        if (!log.open() || !kvs.open()) return false;
+        lastapplied = std::min<uint64_t>(kvs.applied_index(), log.size());
+        commit_index = lastapplied.load();
+        // the later entries may never have been committed, they are applied
+        // once the commit index of the leader reaches them; memberships take
+        // effect as soon as they are logged
+        current_term = std::max<uint64_t>(current_term, log.term_at(log.size()));
+        restore_config(log.size());
+        return true;
+    }
+
+    auto Raft::set_commit_index(uint64_t index) -> void {
+        if (index > commit_index) commit_index = index;
+        auto last = std::min<uint64_t>(commit_index, size_log());
+        for (auto i = lastapplied + 1; i <= last; i++) apply(i);
+    }
+
+    auto Raft::append(std::string entry) -> uint64_t {
+        std::unique_lock<std::mutex> lock(log_mtx, std::defer_lock);
+        {
+            ScopedStage stage{Stage::LOCK};
+            lock.lock();
+        }
+        // the leadership may have been handed over while we waited, or is
+        // being handed over right now
+        if (!leader() || transferring) return 0;
+        auto index = add_to_log(std::move(entry));
+        if (index != 0) adopt_config(index);
+        return index;
+    }
+
+    auto Raft::await_commit(uint64_t index) -> bool {
+        auto term = log.term_at(index);
+        // the worker ships the entry right away instead of after the interval
+        wake();
+        {
+            std::unique_lock<std::mutex> lock(applied_mtx);
+            if (!applied_cv.wait_for(lock, commit_timeout, [&] { return lastapplied >= index; })) return false;
+        }
+        // a new leader may have replaced the entry with one of its own
+        return log.size() >= index && log.term_at(index) == term;
+    }
+
+    auto Raft::adopt_config(uint64_t index) -> void {
+        if (log.type_at(index) != EntryType::CONFIG) return;
+        LogEntryView entry;
+        auto data = log.at(index);
+        if (entry.parse(data)) load_config(entry, index);
+    }
+
+    namespace {
+
+        using Connections = std::vector<std::pair<SocketAddress, std::unique_ptr<Connection>>>;
+
+        /**
+         * Deadline of the requests of a round: a peer that accepted the
+         * connection but does not answer in time is cut off, so it cannot
+         * stall the round.
+         */
+        class RpcDeadline {
+        public:
+            RpcDeadline(const Connections &connections, std::chrono::steady_clock::time_point deadline)
+                    : id{timers().schedule(deadline, [&connections] {
+                for (const auto &con: connections) con.second->shutdown();
+            })} {
+            }
+
+            ~RpcDeadline() {
+                timers().cancel(id);
+            }
+
+            RpcDeadline(const RpcDeadline &) = delete;
+
+            auto operator=(const RpcDeadline &) -> RpcDeadline & = delete;
+
+        private:
+            const TimerWheel::Id id;
+        };
+
+        // clears a flag that was set for the duration of a scope
+        class ScopedFlag {
+        public:
+            explicit ScopedFlag(std::atomic<bool> &flag) : flag{flag} {
+            }
+
+            ~ScopedFlag() {
+                flag = false;
+            }
+
+            ScopedFlag(const ScopedFlag &) = delete;
+
+            auto operator=(const ScopedFlag &) -> ScopedFlag & = delete;
+
+        private:
+            std::atomic<bool> &flag;
+        };
+
+    }  // namespace
+
+    auto Raft::wake() -> void {
+        {
+            std::lock_guard<std::mutex> lock(wake_mtx);
+            woken = true;
+        }
+        wake_cv.notify_one();
+    }
+
+    auto Raft::wait_until(std::chrono::steady_clock::time_point deadline) -> void {
+        auto timer = timers().schedule(deadline, [this] { wake(); });
+        {
+            std::unique_lock<std::mutex> lock(wake_mtx);
+            wake_cv.wait(lock, [this] { return woken; });
+            woken = false;
+        }
+        timers().cancel(timer);
+    }
+
+    auto Raft::become_candidate() -> void {
+        role = RaftRole::CANDIDATE;
+        leader_addr = "";
+        ++current_term;
+        votes = {SocketAddress(own_addr)};
+        voted_for = SocketAddress(own_addr);
         reset_election_timer();
-        std::mutex mtx1;
-        std::condition_variable cv;
-        std::mutex mtx2;
-        std::unique_lock<std::mutex> l1(mtx2);
-        std::mutex mtx3;
-        std::unique_lock<std::mutex> l2(mtx3);
-        l1.unlock();
-        l2.unlock();
-        std::condition_variable cv1;
-        auto timer = election_timer;
-        bool timeout;
-        bool timeout1;
-        std::unique_lock<std::mutex> l(mtx1);
+    }
+
+    auto Raft::handle_vote(const std::string &candidate, const cloud::CloudMessage_RequestVote &request) -> bool {
+        // only voters campaign; a removed node that lost track of the group
+        // must not depose its leader with a newer term
+        auto current = configuration();
+        if (current->index != 0 && !current->votes(SocketAddress(candidate))) return false;
+        std::lock_guard<std::mutex> lock(state_mtx);
+        if (current_term >= request.term()) return false;
+        // the later last term wins, the longer log breaks a tie
+        auto last_term = log.term_at(size_log());
+        if (request.last_log_term() < last_term ||
+            (request.last_log_term() == last_term && request.log_size() < size_log())) {
+            return false;
+        }
+        voted_for = SocketAddress(candidate);
+        current_term = request.term();
+        role = RaftRole::FOLLOWER;
+        leader_addr = "";
+        reset_election_timer();
+        return true;
+    }
+
+    auto Raft::accept_leader(const std::string &leader, uint64_t term) -> bool {
+        std::lock_guard<std::mutex> lock(state_mtx);
+        if (current_term > term) return false;
+        current_term = term;
+        role = RaftRole::FOLLOWER;
+        leader_addr = leader;
+        reset_election_timer();
+        return true;
+    }
+
+    auto Raft::join(const std::string &leader, uint64_t term) -> bool {
+        std::lock_guard<std::mutex> lock(state_mtx);
+        if (!leader_addr.empty()) return false;
+        role = RaftRole::FOLLOWER;
+        leader_addr = leader;
+        current_term = term;
+        reset_election_timer();
+        return true;
+    }
 
+    auto Raft::append_entries(const cloud::CloudMessage_AppendEntries &request) -> uint64_t {
+        auto received = std::chrono::steady_clock::now();
+        std::vector<std::string_view> entries;
+        if (!RaftLog::split_records(request.entries(), entries)) return 0;
+        std::lock_guard<std::mutex> lock(log_mtx);
+        auto prev = std::max<uint64_t>(request.first_index(), 1) - 1;
+        // entries behind a gap wait for the leader to ship from our end
+        if (prev > size_log()) return 0;
+        if (log.term_at(prev) != request.prev_log_term()) {
+            // the leader lacks our entry, so it lacks every entry its leader
+            // wrote in that term but the committed ones; the leader ships
+            // from our new end
+            auto conflict = log.term_at(prev);
+            auto first = prev;
+            while (first > lastapplied + 1 && log.term_at(first - 1) == conflict) first--;
+            truncate_log(first);
+            return 0;
+        }
+        // the entries are appended as the leader encoded them
+        auto matched = prev;
+        for (auto data: entries) {
+            LogEntryView entry;
+            if (!entry.parse(data) || entry.index() != matched + 1) break;
+            if (entry.index() <= size_log()) {
+                if (log.term_at(entry.index()) == entry.term()) {
+                    matched = entry.index();
+                    continue;
+                }
+                if (!truncate_log(entry.index())) break;
+            }
+            uint64_t index;
+            {
+                ScopedStage stage{Stage::LOG_APPEND};
+                index = log.append(data);
+            }
+            if (index == 0) break;
+            adopt_config(index);
+            matched = index;
+        }
+        set_commit_index(std::min(request.commit_index(), matched));
+        // the local state is as recent as the heartbeat only if it shipped
+        // everything we lacked
+        if (matched >= request.log_size()) caught_up = received;
+        return matched;
+    }
+
+    auto Raft::truncate_log(uint64_t first) -> bool {
+        // only committed entries are applied, and those never conflict
+        if (first <= lastapplied || !log.truncate(first)) return false;
+        if (configuration()->index >= first) restore_config(first - 1);
+        return true;
+    }
+
+    auto Raft::replicate(std::string entry) -> uint64_t {
+        auto index = append(std::move(entry));
+        return index != 0 && await_commit(index) ? index : 0;
+    }
+
+    auto Raft::perform_election(Routing &routing) -> void {
+        reset_election_timer();
         std::unordered_set<SocketAddress> responded;
 
         while (candidate()) {
-            timeout = false;
-            timeout1 = false;
-            std::thread t([&l1, &timer, &cv, &cv1, &timeout]() {
-                l1.lock();
-                cv1.wait_until(l1, timer);
-                timeout = true;
-                l1.unlock();
-                cv.notify_all();
-
-            });
-            std::thread t1([&l2, &cv, &cv1, &timeout1]() {
-                l2.lock();
-                cv1.wait_for(l2, std::chrono::milliseconds(450));
-                timeout1 = true;
-                l2.unlock();
-                cv.notify_all();
-            });
+            // a round ends after the heartbeat interval or with the election
+            auto round_end = std::min(election_timer.load(), std::chrono::steady_clock::now() + heartbeat_interval);
             cloud::CloudMessage vt;
             prepare_election(vt);
-            std::vector<std::pair<SocketAddress, std::unique_ptr<Connection>>> connections;
-            int i = 0;
-            auto peers = routing.partitions_by_peer();
+            Connections connections;
+            std::vector<bool> reached;
+            auto table = routing.snapshot();
+            const auto &peers = table->members;
             for (auto &peer: peers) {
-                if (!responded.contains(peer.first)) {
-                    connections.emplace_back(peer.first, std::make_unique<Connection>(peer.first));
-                    if (connections.at(i).second->connect_failed || !connections.at(i).second->send(vt)) {
-                        dropped_peers.emplace(peer.first);
+                if (!responded.contains(peer)) {
+                    connections.emplace_back(peer, std::make_unique<Connection>(peer));
+                    const auto &con = *connections.back().second;
+                    reached.push_back(!con.connect_failed && con.send(vt));
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(state_mtx);
+                for (size_t i = 0; i < connections.size(); i++) {
+                    if (reached[i]) {
+                        dropped_peers.erase(connections[i].first);
                     } else {
-                        auto todelete = dropped_peers.find(peer.first);
-                        if (todelete != dropped_peers.end())dropped_peers.erase(todelete);
+                        dropped_peers.emplace(connections[i].first);
                     }
-                    ++i;
                 }
+                publish_dropped_peers();
             }
-            i = 0;
-            for (auto &con: connections) {
-                if (dropped_peers.contains(con.first)) {
-                    ++i;
-                    continue;
-                }
-                mtx.unlock();
-                bool b = connections.at(i).second->receive(vt);
-                mtx.lock();
-                if (follower()) {
-                    cv1.notify_all();
-                    try {
-                        t.join();
-                    } catch (std::system_error &e) {
-
-                    }
-                    try {
-                        t1.join();
-                    } catch (std::system_error &e) {
-
-                    }
-                    return; }
+            RpcDeadline deadline{connections, std::chrono::steady_clock::now() + rpc_timeout};
+            for (size_t i = 0; i < connections.size(); i++) {
+                if (!reached[i]) continue;
+                const auto &[peer, con] = connections[i];
+                bool b = con->receive(vt);
+                std::lock_guard<std::mutex> lock(state_mtx);
+                if (follower()) return;
                 if (election_timeout()) break;
                 if (!b) {
-                    dropped_peers.emplace(con.first);
-                    ++i;
+                    dropped_peers.emplace(peer);
+                    publish_dropped_peers();
                     continue;
                 }
-                responded.emplace(con.first);
-                if (vt.success() && current_term == vt.partition(0).id() &&
-                    ++votes_received > ((peers.size() + 1) / 2) &&
+                responded.emplace(peer);
+                if (vt.success() && current_term == vt.request_vote().term()) votes.emplace(peer);
+                if (vt.success() && current_term == vt.request_vote().term() && configuration()->quorum(votes) &&
                     !election_timeout()) {
-                    set_leader();
-                    cv1.notify_all();
-                    try {
-                        t.join();
-                    } catch (std::system_error &e) {
-
-                    }
-                    try {
-                        t1.join();
-                    } catch (std::system_error &e) {
-
-                    }
+                    role = RaftRole::LEADER;
+                    leader_addr = own_addr;
                     return;
-
-                } else if (!vt.success() && current_term < vt.partition(0).id()) {
-                    set_follower();
-                    set_term(vt.partition(0).id());
-                    cv1.notify_all();
-                    try {
-                        t.join();
-                    } catch (std::system_error &e) {
-
-                    }
-                    try {
-                        t1.join();
-                    } catch (std::system_error &e) {
-
-                    }
+                } else if (!vt.success() && current_term < vt.request_vote().term()) {
+                    role = RaftRole::FOLLOWER;
+                    leader_addr = "";
+                    current_term = vt.request_vote().term();
                     return;
                 }
-                ++i;
             }
-            if (election_timeout()) {
-                set_candidate();
-                ++current_term;
-                votes_received = 1;
-                voted_for = SocketAddress(own_addr);
-                cv1.notify_all();
-                try {
-                    t.join();
-                } catch (std::system_error &e) {
-
-                }
-                try {
-                    t1.join();
-                } catch (std::system_error &e) {
-
+            {
+                std::lock_guard<std::mutex> lock(state_mtx);
+                if (!candidate()) return;
+                if (election_timeout()) {
+                    become_candidate();
+                    return;
                 }
-                responded.clear();
-                reset_election_timer();
-                return;
-            }
-            mtx.unlock();
-            cv.wait_for(l, std::chrono::milliseconds(450), [&timeout, &timeout1] { return timeout || timeout1; });
-            mtx.lock();
-            cv1.notify_all();
-            try {
-                t.join();
-            } catch (std::system_error &e) {
-
             }
-            try {
-                t1.join();
-            } catch (std::system_error &e) {
-
-            }
-            if (election_timeout()) {
-                set_candidate();
-                ++current_term;
-                votes_received = 1;
-                voted_for = SocketAddress(own_addr);
+            wait_until(round_end);
+            std::lock_guard<std::mutex> lock(state_mtx);
+            if (candidate() && election_timeout()) {
+                become_candidate();
                 responded.clear();
-                reset_election_timer();
             }
         }
         // Upon election timeout, the follower changes to candidate and starts election
     }
 
-    auto Raft::heartbeat(Routing &routing, std::mutex &mtx) -> void {
-        std::mutex mtx1;
-        std::condition_variable cv;
-        std::mutex mtx2;
-        std::condition_variable cv1;
-        std::unique_lock<std::mutex> l(mtx1);
-        std::unique_lock<std::mutex> l1(mtx2);
-        bool timeout;
+    auto Raft::heartbeat(Routing &routing) -> void {
+        // a new leader assumes the followers are up to date and moves back
+        // to their actual log length with the first responses
+        peer_indices.clear();
+        // entries of earlier terms only commit along with one of this term
+        append(LogEntryBuilder{EntryType::NOOP}.release());
         while (leader()) {
-            timeout = false;
-            std::thread t([&l1, &cv, &cv1, &timeout]() {
-                cv1.wait_for(l1, std::chrono::milliseconds(450));
-                timeout = true;
-                cv.notify_all();
-            });
-            auto peers = routing.partitions_by_peer();
-            cloud::CloudMessage hb;
-            prepare_heartbeat(hb);
-            std::vector<std::pair<SocketAddress, std::unique_ptr<Connection>>> connections;
-            int i = 0;
+            auto next_round = std::chrono::steady_clock::now() + heartbeat_interval;
+            auto table = routing.snapshot();
+            // learners get the log like the voters
+            auto peers = table->members;
+            peers.insert(peers.end(), table->learners.begin(), table->learners.end());
+            // for the replication lag of the followers
+            auto shipped = size_log();
+            Connections connections;
+            std::vector<std::chrono::steady_clock::time_point> sent;
+            std::vector<bool> reached;
+            // a follower that got capped records and took them gets the rest
+            // with the next round right away
+            auto behind = false;
             for (auto &peer: peers) {
-                connections.emplace_back(peer.first, std::make_unique<Connection>(SocketAddress(peer.first)));
-                if (connections.at(i).second->connect_failed || !connections.at(i).second->send(hb)) {
-                    dropped_peers.emplace(peer.first);
-                } else {
-                    auto todelete = dropped_peers.find(peer.first);
-                    if (todelete != dropped_peers.end())dropped_peers.erase(todelete);
-                }
-                ++i;
+                // every follower gets the entries it lacks
+                auto &indices = peer_indices.try_emplace(peer, PeerIndices{shipped + 1, 0}).first->second;
+                cloud::CloudMessage hb;
+                prepare_heartbeat(hb, std::min(indices.next_index_, shipped + 1));
+                sent.emplace_back(std::chrono::steady_clock::now());
+                connections.emplace_back(peer, std::make_unique<Connection>(SocketAddress(peer)));
+                const auto &con = *connections.back().second;
+                reached.push_back(!con.connect_failed && con.send(hb));
             }
-            i = 0;
-            for (auto &con: connections) {
-                if (dropped_peers.contains(con.first)) {
-                    ++i;
-                    continue;
+            {
+                std::lock_guard<std::mutex> lock(state_mtx);
+                for (size_t i = 0; i < connections.size(); i++) {
+                    if (reached[i]) {
+                        dropped_peers.erase(connections[i].first);
+                    } else {
+                        dropped_peers.emplace(connections[i].first);
+                    }
                 }
-                mtx.unlock();
-                bool b = connections.at(i).second->receive(hb);
-                mtx.lock();
-                if (!leader()) {
-                    cv1.notify_all();
-                    try {
-                        t.join();
-                    } catch (std::system_error &e) {
-
+                publish_dropped_peers();
+            }
+            RpcDeadline deadline{connections, std::chrono::steady_clock::now() + rpc_timeout};
+            for (size_t i = 0; i < connections.size(); i++) {
+                if (!reached[i]) continue;
+                const auto &[peer, con] = connections[i];
+                cloud::CloudMessage hb;
+                bool b = con->receive(hb);
+                {
+                    std::lock_guard<std::mutex> lock(state_mtx);
+                    if (!leader()) {
+                        if (election_timeout()) become_candidate();
+                        return;
                     }
-                    if (election_timeout()) {
-                        set_candidate();
-                        votes_received = 1;
-                        voted_for = SocketAddress(own_addr);
-                        ++current_term;
+                    if (!b) {
+                        dropped_peers.emplace(peer);
+                        publish_dropped_peers();
+                        continue;
+                    }
+                    const auto &result = hb.append_entries();
+                    if (!hb.success()) {
+                        role = RaftRole::FOLLOWER;
+                        leader_addr = "";
+                        if (current_term < result.term()) current_term = result.term();
+                        return;
                     }
-
-                    return;
-                }
-                if (!b) {
-                    dropped_peers.emplace(con.first);
-                    ++i;
-                    continue;
                 }
-                if (!hb.success()) {
-                    set_follower();
-                    if (current_term < hb.partition(0).id()) set_term(hb.partition(0).id());
-                    cv1.notify_all();
-                    try {
-                        t.join();
-                    } catch (std::system_error &e) {
+                // the follower answers with the size of its log, which it cut
+                // back to where it matches ours if the entries did not follow
+                const auto &result = hb.append_entries();
+                auto &indices = peer_indices[peer];
+                if (result.match_index() > indices.match_index_ && result.match_index() < shipped) behind = true;
+                indices.match_index_ = result.match_index();
+                indices.next_index_ = result.log_size() + 1;
+                auto rtt = std::chrono::steady_clock::now() - sent.at(i);
+                auto &entry = stats().peer(peer.string());
+                entry.rtt.record(rtt);
+                stats().stage(Stage::REPLICATION).record(rtt);
+                entry.lag.store(shipped - std::min<uint64_t>(shipped, result.log_size()), std::memory_order_relaxed);
+            }
+            // a new commit index reaches the followers with the next round
+            auto committed = advance_commit_index();
+            if (step_down_if_removed()) return;
+            // a membership change is confirmed by the next round right away
+            if (!advance_configuration(shipped) && !committed && !behind) wait_until(next_round);
+            std::lock_guard<std::mutex> lock(state_mtx);
+            if (!leader() && election_timeout()) become_candidate();
+        }
+        // Implement the heartbeat functionality that the leader should broadcast to
+        // the followers to declare its presence
+    }
 
-                    }
-                    return;
+    auto Raft::configuration() -> std::shared_ptr<const RaftConfig> {
+        auto current = config.load(std::memory_order_acquire);
+        if (current->index != 0 || routing == nullptr) return current;
+        auto bootstrap = std::make_shared<RaftConfig>();
+        bootstrap->voters.emplace_back(own_addr);
+        auto table = routing->snapshot();
+        bootstrap->voters.insert(bootstrap->voters.end(), table->members.begin(), table->members.end());
+        return bootstrap;
+    }
+
+    auto Raft::load_config(const LogEntryView &entry, uint64_t index) -> void {
+        std::vector<std::string> voters, old_voters, learners;
+        entry.config(voters, old_voters, learners);
+        auto next = std::make_shared<RaftConfig>();
+        for (const auto &node: voters) next->voters.emplace_back(node);
+        for (const auto &node: old_voters) next->old_voters.emplace_back(node);
+        for (const auto &node: learners) next->learners.emplace_back(node);
+        next->index = index;
+        config.store(next, std::memory_order_release);
+        if (own_addr.empty()) return;
+
+        // nodes outside the voters, removed ones included, never campaign
+        SocketAddress self{own_addr};
+        learner = !next->votes(self);
+        if (routing != nullptr) {
+            std::vector<SocketAddress> members, others;
+            for (const auto *group: {&next->voters, &next->old_voters}) {
+                for (const auto &node: *group) {
+                    if (node != self && !contains(members, node)) members.emplace_back(node);
                 }
-                ++i;
             }
-            mtx.unlock();
-            cv.wait_for(l, std::chrono::milliseconds(450), [&timeout] { return timeout; });
-            mtx.lock();
-            try {
-                t.join();
-            } catch (std::system_error &e) {
+            for (const auto &node: next->learners) {
+                if (node != self) others.emplace_back(node);
+            }
+            routing->set_membership(std::move(members), std::move(others));
+        }
+        // nodes that left are neither contacted nor reported any more
+        std::lock_guard<std::mutex> lock(state_mtx);
+        std::erase_if(dropped_peers, [&](const auto &peer) { return !next->votes(peer) && !next->learns(peer); });
+        publish_dropped_peers();
+    }
+
+    auto Raft::restore_config(uint64_t index) -> void {
+        for (auto i = index; i > 0; i--) {
+            if (log.type_at(i) != EntryType::CONFIG) continue;
+            LogEntryView entry;
+            auto data = log.at(i);
+            if (entry.parse(data)) load_config(entry, i);
+            return;
+        }
+        config.store(std::make_shared<const RaftConfig>(), std::memory_order_release);
+    }
+
+    auto Raft::replicate_config(const RaftConfig &next) -> uint64_t {
+        LogEntryBuilder entry{EntryType::CONFIG};
+        entry.set_config(strings(next.voters), strings(next.old_voters), strings(next.learners));
+        return append(entry.release());
+    }
+
+    auto Raft::add_learner(const SocketAddress &node) -> bool {
+        uint64_t index;
+        {
+            std::lock_guard<std::mutex> lock(config_mtx);
+            if (!leader()) return false;
+            auto current = configuration();
+            if (current->votes(node) || current->learns(node)) return true;
+            auto next = *current;
+            next.learners.emplace_back(node);
+            index = replicate_config(next);
+        }
+        // the worker commits the entry, it takes the membership lock itself
+        return index != 0 && await_commit(index);
+    }
+
+    auto Raft::remove_node(const SocketAddress &node) -> bool {
+        uint64_t index;
+        {
+            std::lock_guard<std::mutex> lock(config_mtx);
+            if (!leader()) return false;
+            auto current = configuration();
+            auto next = *current;
+            if (current->learns(node)) {
+                // learners do not count for a majority, no joint phase needed
+                std::erase(next.learners, node);
+            } else {
+                if (!current->votes(node)) return true;
+                // the last voter stays
+                if (current->joint() || current->voters.size() < 2) return false;
+                next.old_voters = current->voters;
+                std::erase(next.voters, node);
+            }
+            index = replicate_config(next);
+        }
+        return index != 0 && await_commit(index);
+    }
+
+    auto Raft::holding(uint64_t index) const -> std::unordered_set<SocketAddress> {
+        std::unordered_set<SocketAddress> nodes{SocketAddress(own_addr)};
+        for (const auto &[peer, indices]: peer_indices) {
+            if (indices.match_index_ >= index) nodes.emplace(peer);
+        }
+        return nodes;
+    }
 
+    auto Raft::advance_commit_index() -> bool {
+        // only the match indices are candidates; an entry of an earlier term
+        // commits along with a later one of the current term
+        std::vector<uint64_t> candidates{size_log()};
+        for (const auto &[peer, indices]: peer_indices) candidates.emplace_back(indices.match_index_);
+        std::sort(candidates.begin(), candidates.end(), std::greater<>());
+        auto current = configuration();
+        for (auto index: candidates) {
+            if (index <= commit_index) return false;
+            if (log.term_at(index) != term() || !current->quorum(holding(index))) continue;
+            std::lock_guard<std::mutex> lock(log_mtx);
+            set_commit_index(index);
+            return true;
+        }
+        return false;
+    }
+
+    auto Raft::advance_configuration(uint64_t shipped) -> bool {
+        std::vector<SocketAddress> removed;
+        {
+            std::lock_guard<std::mutex> lock(config_mtx);
+            auto current = configuration();
+            if (!leader() || current->index == 0) return false;
+            if (!current->joint()) {
+                // promote the learners that hold every entry of the round together
+                auto next = *current;
+                for (const auto &node: current->learners) {
+                    auto it = peer_indices.find(node);
+                    if (it == peer_indices.end() || it->second.match_index_ < shipped) continue;
+                    next.voters.emplace_back(node);
+                    std::erase(next.learners, node);
+                }
+                if (next.voters.size() == current->voters.size()) return false;
+                next.old_voters = current->voters;
+                return replicate_config(next) != 0;
             }
-            if (!leader() && election_timeout()) {
-                set_candidate();
-                votes_received = 1;
-                voted_for = SocketAddress(own_addr);
-                ++current_term;
+            if (!current->quorum(holding(current->index))) return false;
+            auto next = *current;
+            next.old_voters.clear();
+            if (replicate_config(next) == 0) return false;
+            // a removed leader steps down on its own, see step_down_if_removed()
+            for (const auto &node: current->old_voters) {
+                if (!contains(next.voters, node) && node != SocketAddress(own_addr)) removed.emplace_back(node);
             }
+        }
 
+        // the removed voters no longer get the log, tell them to stand by;
+        // the next change need not wait for them
+        cloud::CloudMessage notification;
+        notification.set_type(cloud::CloudMessage_Type_NOTIFICATION);
+        notification.set_operation(cloud::CloudMessage_Operation_RAFT_REMOVE_NODE);
+        Connections connections;
+        for (const auto &node: removed) {
+            connections.emplace_back(node, std::make_unique<Connection>(node));
         }
-        // Implement the heartbeat functionality that the leader should broadcast to
-        // the followers to declare its presence
+        RpcDeadline deadline{connections, std::chrono::steady_clock::now() + rpc_timeout};
+        for (const auto &[node, con]: connections) {
+            cloud::CloudMessage reply;
+            if (!con->connect_failed && con->send(notification)) con->receive(reply);
+        }
+        return true;
     }
 
-    auto Raft::run(Routing &routing, std::mutex &mtx) -> std::thread {
-        auto thread = std::thread(&Raft::worker, (this), std::ref(routing), std::ref(mtx));
+    auto Raft::step_down_if_removed() -> bool {
+        auto current = configuration();
+        if (current->index == 0 || current->index > commit_index || current->votes(SocketAddress(own_addr))) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(state_mtx);
+        if (role == RaftRole::LEADER) {
+            role = RaftRole::FOLLOWER;
+            leader_addr = "";
+            reset_election_timer();
+        }
+        return true;
+    }
+
+    auto Raft::transfer_leadership(const SocketAddress &target) -> bool {
+        if (!leader() || target == SocketAddress(own_addr) || !configuration()->votes(target)) return false;
+        // new entries are refused until the handover, so the target has every
+        // entry when it campaigns; the round trips run without the log lock
+        if (transferring.exchange(true)) return false;
+        ScopedFlag transfer{transferring};
+        {
+            // an append that took the lock before the flag was set completes
+            std::lock_guard<std::mutex> log_lock(log_mtx);
+        }
+        if (!leader()) return false;
+        Connections connections;
+        connections.emplace_back(target, std::make_unique<Connection>(target));
+        const auto &con = *connections.back().second;
+        if (con.connect_failed) return false;
+        RpcDeadline deadline{connections, std::chrono::steady_clock::now() + rpc_timeout};
+
+        // the first round trip tells the length of the target's log, the
+        // next ones ship what it lacks, capped per request
+        cloud::CloudMessage request, reply;
+        auto first = size_log() + 1;
+        uint64_t matched = 0;
+        while (true) {
+            request.Clear();
+            prepare_heartbeat(request, first);
+            if (!con.send(request) || !con.receive(reply) || !reply.success()) return false;
+            const auto &result = reply.append_entries();
+            if (result.match_index() >= size_log()) break;
+            // a round that neither matched more entries nor moved the end of
+            // the target's log gets no further
+            auto next = std::min(result.log_size(), size_log()) + 1;
+            if (result.match_index() <= matched && next == first) return false;
+            matched = result.match_index();
+            first = next;
+        }
+
+        request.Clear();
+        request.set_type(cloud::CloudMessage_Type_REQUEST);
+        request.set_operation(cloud::CloudMessage_Operation_RAFT_TIMEOUT_NOW);
+        request.mutable_address()->set_address(own_addr);
+        request.mutable_append_entries()->set_term(term());
+        if (!con.send(request) || !con.receive(reply) || !reply.success()) return false;
+
+        // step down right away, the target's vote request brings the new term
+        {
+            std::lock_guard<std::mutex> lock(state_mtx);
+            if (role == RaftRole::LEADER) {
+                role = RaftRole::FOLLOWER;
+                leader_addr = target.string();
+                reset_election_timer();
+            }
+        }
+        wake();
+        return true;
+    }
+
+    auto Raft::timeout_now(uint64_t term) -> bool {
+        std::lock_guard<std::mutex> lock(state_mtx);
+        if (term < current_term || learner || leader()) return false;
+        become_candidate();
+        wake();
+        return true;
+    }
+
+    auto Raft::run(Routing &routing) -> std::thread {
+        this->routing = &routing;
+        if (!recover()) {
+            fmt::print("recovery of the raft log failed\n");
+        }
+        auto thread = std::thread(&Raft::worker, (this), std::ref(routing));
         // Return a thread that keeps running the heartbeat function.
         // If you have other implementation you can skip this.
         return thread;
     }
 
-    auto Raft::worker(Routing &routing, std::mutex &mtx) -> void {
+    auto Raft::worker(Routing &routing) -> void {
         while (true) {
-            mtx.lock();
             switch (role) {
                 case RaftRole::LEADER : {
-                    heartbeat(routing, mtx);
+                    heartbeat(routing);
                     break;
                 }
                 case RaftRole::CANDIDATE : {
-                    perform_election(routing, mtx);
+                    perform_election(routing);
                     break;
                 }
                 case RaftRole::FOLLOWER : {
                     reset_election_timer();
                     while (follower()) {
-                        mtx.unlock();
-                        std::this_thread::sleep_until(election_timer);
-                        mtx.lock();
+                        // heartbeats push the timer back, the worker then
+                        // waits for the new deadline
+                        wait_until(election_timer);
+                        std::lock_guard<std::mutex> lock(state_mtx);
                         if (!leader() && election_timeout()) {
-                            set_candidate();
-                            votes_received = 1;
-                            voted_for = SocketAddress(own_addr);
-                            ++current_term;
+                            // learners wait for a leader instead
+                            if (learner) {
+                                reset_election_timer();
+                                continue;
+                            }
+                            become_candidate();
                             break;
                         }
                     }
@@ -303,10 +757,9 @@ namespace cloudlab {
                     break;
                 }
             }
-            mtx.unlock();
         }
 
     }
 
 
-}  // namespace cloudlab
\ No newline at end of file
+}  // namespace cloudlab
@@ -0,0 +1,165 @@
+#include "cloudlab/sharding.hh"
+
+#include <algorithm>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+
+namespace cloudlab {
+
+    PartitionMap::PartitionMap(size_t initial) {
+        for (size_t b = 0; b < hash_buckets; b++) {
+            buckets[b].store(b % initial, std::memory_order_relaxed);
+        }
+    }
+
+    auto PartitionMap::buckets_of(size_t id) const -> std::vector<uint32_t> {
+        std::vector<uint32_t> result;
+        for (uint32_t b = 0; b < hash_buckets; b++) {
+            if (partition_of_bucket(b) == id) result.emplace_back(b);
+        }
+        return result;
+    }
+
+    auto PartitionMap::ids() const -> std::vector<size_t> {
+        std::set<size_t> tmp;
+        for (const auto &b: buckets) {
+            tmp.insert(b.load(std::memory_order_acquire));
+        }
+        return {tmp.begin(), tmp.end()};
+    }
+
+    auto PartitionMap::next_id() const -> size_t {
+        auto tmp = ids();
+        return tmp.empty() ? 0 : tmp.back() + 1;
+    }
+
+    auto PartitionMap::assign(const std::vector<uint32_t> &moved, size_t id) -> void {
+        for (auto b: moved) {
+            if (b < hash_buckets) buckets[b].store(id, std::memory_order_release);
+        }
+    }
+
+    auto PartitionMap::serialize() const -> std::string {
+        std::ostringstream out;
+        for (const auto &b: buckets) {
+            out << b.load(std::memory_order_acquire) << ' ';
+        }
+        return out.str();
+    }
+
+    auto PartitionMap::deserialize(const std::string &data) -> bool {
+        std::istringstream in{data};
+        std::vector<uint32_t> tmp(hash_buckets);
+        for (auto &b: tmp) {
+            if (!(in >> b)) return false;
+        }
+        for (size_t b = 0; b < hash_buckets; b++) {
+            buckets[b].store(tmp[b], std::memory_order_release);
+        }
+        return true;
+    }
+
+    auto LoadTracker::take() -> std::vector<Load> {
+        std::vector<Load> result(hash_buckets);
+        for (size_t b = 0; b < hash_buckets; b++) {
+            result[b].requests = requests[b].exchange(0, std::memory_order_relaxed);
+            result[b].bytes = bytes[b].exchange(0, std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    auto plan_split(const PartitionMap &map, size_t id, const std::vector<Load> &load) -> std::vector<uint32_t> {
+        auto buckets = map.buckets_of(id);
+        if (buckets.size() < 2) return {};
+
+        uint64_t total{};
+        for (auto b: buckets) total += load[b].requests;
+
+        // cut the bucket sequence where the first half reaches half the load,
+        // but never move all buckets
+        std::vector<uint32_t> moved;
+        uint64_t sum{};
+        for (size_t i = 0; i + 1 < buckets.size() && 2 * sum < total; i++) {
+            sum += load[buckets[i]].requests;
+            moved.emplace_back(buckets[i]);
+        }
+        return moved;
+    }
+
+    auto plan_placement(const std::map<uint32_t, uint64_t> &load, std::vector<SocketAddress> nodes,
+                        const Placement &current, size_t replicas) -> Placement {
+        if (nodes.empty()) return current;
+        // a deterministic node order keeps the plan stable between rounds
+        std::sort(nodes.begin(), nodes.end(), [](const auto &lhs, const auto &rhs) {
+            return lhs.string() < rhs.string();
+        });
+        replicas = std::min(replicas, nodes.size());
+
+        // every partition costs at least 1, so idle partitions spread evenly
+        auto cost = [&](uint32_t id) -> uint64_t {
+            auto it = load.find(id);
+            return 1 + (it == load.end() ? 0 : it->second);
+        };
+
+        std::unordered_map<SocketAddress, uint64_t> node_load;
+        for (const auto &node: nodes) node_load[node] = 0;
+        auto alive = [&](const SocketAddress &node) { return node_load.contains(node); };
+        auto owns = [](const std::vector<SocketAddress> &owners, const SocketAddress &node) {
+            return std::find(owners.begin(), owners.end(), node) != owners.end();
+        };
+
+        // keep the current owners that are still alive
+        Placement result;
+        for (const auto &[id, _]: load) {
+            auto &owners = result[id];
+            auto it = current.find(id);
+            if (it == current.end()) continue;
+            for (const auto &owner: it->second) {
+                if (owners.size() < replicas && alive(owner) && !owns(owners, owner)) {
+                    owners.emplace_back(owner);
+                    node_load[owner] += cost(id);
+                }
+            }
+        }
+
+        // fill missing replicas, hottest partitions first
+        std::vector<uint32_t> order;
+        for (const auto &[id, _]: result) order.emplace_back(id);
+        std::stable_sort(order.begin(), order.end(), [&](auto lhs, auto rhs) { return cost(lhs) > cost(rhs); });
+        for (auto id: order) {
+            auto &owners = result[id];
+            while (owners.size() < replicas) {
+                const SocketAddress *coldest = nullptr;
+                for (const auto &node: nodes) {
+                    if (owns(owners, node)) continue;
+                    if (coldest == nullptr || node_load[node] < node_load[*coldest]) coldest = &node;
+                }
+                owners.emplace_back(*coldest);
+                node_load[*coldest] += cost(id);
+            }
+        }
+
+        // move partitions from the hottest to the coldest node while that
+        // lowers the maximum; every move strictly shrinks the gap, so this ends
+        for (size_t round = 0; round < result.size() * nodes.size(); round++) {
+            auto [min, max] = std::minmax_element(nodes.begin(), nodes.end(), [&](const auto &lhs, const auto &rhs) {
+                return node_load[lhs] < node_load[rhs];
+            });
+            auto gap = node_load[*max] - node_load[*min];
+            std::optional<uint32_t> best;
+            for (const auto &[id, owners]: result) {
+                if (!owns(owners, *max) || owns(owners, *min) || cost(id) >= gap) continue;
+                if (!best || cost(id) > cost(*best)) best = id;
+            }
+            if (!best) break;
+            auto &owners = result[*best];
+            *std::find(owners.begin(), owners.end(), *max) = *min;
+            node_load[*max] -= cost(*best);
+            node_load[*min] += cost(*best);
+        }
+        return result;
+    }
+
+}  // namespace cloudlab
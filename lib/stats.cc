@@ -0,0 +1,106 @@
+#include "cloudlab/stats.hh"
+
+#include <bit>
+
+namespace cloudlab {
+
+    auto Histogram::index(uint64_t value) -> size_t {
+        if (value < sub_buckets) return value;
+        // the highest bit selects the power of two, the next bits the
+        // sub-bucket within it
+        auto exponent = std::bit_width(value) - 1;
+        auto shift = exponent - histogram_sub_bucket_bits;
+        auto sub = (value >> shift) - sub_buckets;
+        return (shift + 1) * sub_buckets + sub;
+    }
+
+    auto Histogram::upper_bound(size_t index) -> uint64_t {
+        if (index < sub_buckets) return index;
+        auto shift = index / sub_buckets - 1;
+        auto sub = index % sub_buckets;
+        return ((sub_buckets + sub + 1) << shift) - 1;
+    }
+
+    auto Histogram::record(uint64_t value) -> void {
+        counts[index(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        total_value.fetch_add(value, std::memory_order_relaxed);
+        auto current = maximum.load(std::memory_order_relaxed);
+        while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    auto Histogram::percentile(double q) const -> uint64_t {
+        // the buckets are read without a snapshot, concurrent records may
+        // shift the result by a few samples
+        auto n = count();
+        if (n == 0) return 0;
+        auto rank = static_cast<uint64_t>(q * static_cast<double>(n - 1)) + 1;
+        uint64_t seen{};
+        for (size_t i = 0; i < bucket_count; i++) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank) return std::min(upper_bound(i), maximum.load(std::memory_order_relaxed));
+        }
+        return maximum.load(std::memory_order_relaxed);
+    }
+
+    auto Histogram::summary() const -> Summary {
+        auto n = count();
+        auto us = [](uint64_t ns) { return ns / 1000; };
+        return {n, n == 0 ? 0 : us(sum() / n), us(percentile(0.5)), us(percentile(0.9)), us(percentile(0.99)),
+                us(percentile(0.999)), us(maximum.load(std::memory_order_relaxed))};
+    }
+
+    auto Histogram::buckets() const -> std::vector<std::pair<uint64_t, uint64_t>> {
+        std::vector<std::pair<uint64_t, uint64_t>> result;
+        uint64_t seen{};
+        for (size_t i = 0; i < bucket_count; i++) {
+            auto n = counts[i].load(std::memory_order_relaxed);
+            if (n == 0) continue;
+            seen += n;
+            result.emplace_back(upper_bound(i), seen);
+        }
+        return result;
+    }
+
+    auto stage_name(Stage stage) -> const char * {
+        switch (stage) {
+            case Stage::QUEUE:
+                return "queue";
+            case Stage::LOCK:
+                return "lock";
+            case Stage::LOG_APPEND:
+                return "log_append";
+            case Stage::STORAGE_READ:
+                return "storage_read";
+            case Stage::STORAGE_WRITE:
+                return "storage_write";
+            case Stage::REPLICATION:
+                return "replication";
+            default:
+                return "unknown";
+        }
+    }
+
+    auto Stats::peer(const std::string &address) -> Peer & {
+        std::lock_guard<std::mutex> lock(peers_mtx);
+        auto &entry = peer_stats[address];
+        if (!entry) entry = std::make_unique<Peer>();
+        return *entry;
+    }
+
+    auto Stats::peers() -> std::vector<std::pair<std::string, Peer *>> {
+        std::lock_guard<std::mutex> lock(peers_mtx);
+        std::vector<std::pair<std::string, Peer *>> result;
+        for (auto &[address, entry]: peer_stats) {
+            result.emplace_back(address, entry.get());
+        }
+        return result;
+    }
+
+    auto stats() -> Stats & {
+        static Stats instance;
+        return instance;
+    }
+
+}  // namespace cloudlab
@@ -0,0 +1,28 @@
+#include "cloudlab/storage/engine.hh"
+#include "cloudlab/storage/memory.hh"
+#include "cloudlab/storage/rocksdb.hh"
+
+#include "fmt/core.h"
+
+#include <stdexcept>
+
+namespace cloudlab {
+
+    auto make_engine(EngineType type, const std::string &path, bool disable_wal)
+    -> std::unique_ptr<StorageEngine> {
+        switch (type) {
+            case EngineType::MEMORY:
+                return std::make_unique<MemoryEngine>(path.empty() ? path : path + ".snapshot");
+            case EngineType::ROCKSDB:
+            default:
+                return std::make_unique<RocksDBEngine>(path, disable_wal);
+        }
+    }
+
+    auto parse_engine_type(const std::string &name) -> EngineType {
+        if (name == "rocksdb") return EngineType::ROCKSDB;
+        if (name == "memory") return EngineType::MEMORY;
+        throw std::invalid_argument(fmt::format("unknown storage engine {}", name));
+    }
+
+}  // namespace cloudlab
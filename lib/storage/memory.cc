@@ -0,0 +1,298 @@
+#include "cloudlab/storage/memory.hh"
+
+#include "fmt/core.h"
+
+#include <fstream>
+#include <mutex>
+
+namespace cloudlab {
+
+    namespace {
+
+        const std::string snapshot_magic = "cloudlab-memory-1";
+
+        // a cursor copies at most this many keys or bytes per lock acquisition
+        const size_t cursor_batch_keys = 256;
+        const size_t cursor_batch_bytes = 64 * 1024;
+
+        /**
+         * Cursor over one partition. It copies the partition in small batches
+         * and only holds the partition lock while it copies one, so a slow or
+         * paged scan never keeps the writers waiting; every batch is a
+         * consistent cut of the partition.
+         */
+        class MemoryCursor : public Cursor {
+        public:
+            explicit MemoryCursor(std::shared_ptr<MemoryEngine::Partition> p) : partition{std::move(p)} {
+            }
+
+            [[nodiscard]] auto valid() const -> bool override {
+                return pos < batch.size();
+            }
+
+            auto seek_to_first() -> void override {
+                fill({}, true);
+            }
+
+            auto seek(std::string_view key) -> void override {
+                fill(std::string{key}, true);
+            }
+
+            auto next() -> void override {
+                if (++pos < batch.size() || exhausted) return;
+                // the batch is done, continue behind its last key
+                fill(std::move(batch.back().first), false);
+            }
+
+            [[nodiscard]] auto key() const -> std::string_view override {
+                return batch[pos].first;
+            }
+
+            [[nodiscard]] auto value() const -> std::string_view override {
+                return batch[pos].second;
+            }
+
+        private:
+            // copy the keys from `from` on, or behind it unless `inclusive`
+            auto fill(std::string from, bool inclusive) -> void {
+                batch.clear();
+                pos = 0;
+                size_t bytes{};
+                std::shared_lock<std::shared_mutex> lock(partition->mtx);
+                const auto &map = partition->map;
+                std::string_view start{from};
+                auto it = inclusive ? map.lower_bound(start) : map.upper_bound(start);
+                for (; it != map.end() && batch.size() < cursor_batch_keys && bytes < cursor_batch_bytes; ++it) {
+                    batch.emplace_back(it->first, it->second);
+                    bytes += it->first.size() + it->second.size();
+                }
+                exhausted = it == map.end();
+            }
+
+            std::shared_ptr<MemoryEngine::Partition> partition;
+            std::vector<std::pair<std::string, std::string>> batch;
+            size_t pos{};
+            bool exhausted{true};
+        };
+
+        auto write_u64(std::ofstream &out, uint64_t v) -> void {
+            out.write(reinterpret_cast<const char *>(&v), sizeof(v));
+        }
+
+        auto read_u64(std::ifstream &in, uint64_t &v) -> bool {
+            return static_cast<bool>(in.read(reinterpret_cast<char *>(&v), sizeof(v)));
+        }
+
+        auto write_string(std::ofstream &out, std::string_view s) -> void {
+            write_u64(out, s.size());
+            out.write(s.data(), static_cast<std::streamsize>(s.size()));
+        }
+
+        auto read_string(std::ifstream &in, std::string &s) -> bool {
+            uint64_t size;
+            if (!read_u64(in, size)) return false;
+            s.resize(size);
+            return static_cast<bool>(in.read(s.data(), static_cast<std::streamsize>(size)));
+        }
+
+    }  // namespace
+
+    auto MemoryEngine::open() -> bool {
+        if (path.empty() || !std::filesystem::exists(path)) return true;
+        return load();
+    }
+
+    auto MemoryEngine::partition(size_t id) -> std::shared_ptr<Partition> {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        auto it = partitions.find(id);
+        return it == partitions.end() ? nullptr : it->second;
+    }
+
+    auto MemoryEngine::get(size_t id, const std::string &key, std::string &value) -> bool {
+        auto p = partition(id);
+        if (!p) return false;
+        std::shared_lock<std::shared_mutex> lock(p->mtx);
+        auto it = p->map.find(std::string_view{key});
+        if (it == p->map.end()) return false;
+        value.assign(it->second.data(), it->second.size());
+        return true;
+    }
+
+    auto MemoryEngine::put(size_t id, const std::string &key, const std::string &value) -> bool {
+        return set(id, key, value);
+    }
+
+    auto MemoryEngine::remove(size_t id, const std::string &key) -> bool {
+        return erase(id, key);
+    }
+
+    auto MemoryEngine::set(size_t id, std::string_view key, std::string_view value) -> bool {
+        auto p = partition(id);
+        if (!p) return false;
+        std::unique_lock<std::shared_mutex> lock(p->mtx);
+        auto it = p->map.find(key);
+        if (it != p->map.end()) {
+            it->second.assign(value.data(), value.size());
+        } else {
+            p->map.emplace(key, value);
+        }
+        return true;
+    }
+
+    auto MemoryEngine::erase(size_t id, std::string_view key) -> bool {
+        auto p = partition(id);
+        if (!p) return false;
+        std::unique_lock<std::shared_mutex> lock(p->mtx);
+        auto it = p->map.find(key);
+        if (it != p->map.end()) p->map.erase(it);
+        return true;
+    }
+
+    auto MemoryEngine::apply(const std::vector<Mutation> &batch, uint64_t index) -> bool {
+        write(batch);
+        applied.store(index);
+        return true;
+    }
+
+    auto MemoryEngine::write(const std::vector<Mutation> &batch) -> bool {
+        // the KVS serializes writers against snapshot(), so applying the
+        // mutations one by one is atomic for everyone who can observe it
+        for (const auto &m: batch) {
+            if (!has_partition(m.partition)) continue;
+            if (m.remove) {
+                erase(m.partition, m.key);
+            } else {
+                set(m.partition, m.key, m.value);
+            }
+        }
+        return true;
+    }
+
+    auto MemoryEngine::export_partition(size_t id, const std::string &dir, std::vector<std::string> &files)
+    -> bool {
+        auto p = partition(id);
+        if (!p) return false;
+        std::filesystem::create_directories(dir);
+
+        std::shared_lock<std::shared_mutex> lock(p->mtx);
+        if (p->map.empty()) return true;
+        auto file = std::filesystem::path(dir) / fmt::format("{}-0.mem", id);
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        write_u64(out, p->map.size());
+        for (auto &[key, value]: p->map) {
+            write_string(out, key);
+            write_string(out, value);
+        }
+        out.flush();
+        if (!out) return false;
+        files.emplace_back(file.string());
+        return true;
+    }
+
+    auto MemoryEngine::ingest_partition(size_t id, const std::vector<std::string> &files) -> bool {
+        if (!has_partition(id)) return false;
+        uint64_t entries;
+        std::string key, value;
+        for (const auto &file: files) {
+            std::ifstream in(file, std::ios::binary);
+            if (!read_u64(in, entries)) return false;
+            for (uint64_t j = 0; j < entries; j++) {
+                if (!read_string(in, key) || !read_string(in, value)) return false;
+                set(id, key, value);
+            }
+            in.close();
+            std::filesystem::remove(file);
+        }
+        return true;
+    }
+
+    auto MemoryEngine::create_partition(size_t id) -> bool {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        if (!partitions.contains(id)) partitions.insert({id, std::make_shared<Partition>()});
+        return true;
+    }
+
+    auto MemoryEngine::drop_partition(size_t id) -> bool {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        // open cursors keep the partition alive until they are destroyed
+        partitions.erase(id);
+        return true;
+    }
+
+    auto MemoryEngine::has_partition(size_t id) -> bool {
+        return partition(id) != nullptr;
+    }
+
+    auto MemoryEngine::partition_ids() -> std::vector<size_t> {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        std::vector<size_t> ids;
+        for (auto &[id, p]: partitions) {
+            ids.emplace_back(id);
+        }
+        return ids;
+    }
+
+    auto MemoryEngine::cursors(const std::vector<size_t> &ids) -> std::vector<std::unique_ptr<Cursor>> {
+        // cursors copy their partition batch by batch, see MemoryCursor
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        std::vector<std::unique_ptr<Cursor>> result;
+        for (auto id: ids) {
+            auto it = partitions.find(id);
+            if (it != partitions.end()) result.emplace_back(std::make_unique<MemoryCursor>(it->second));
+        }
+        return result;
+    }
+
+    auto MemoryEngine::snapshot() -> bool {
+        if (path.empty()) return true;
+        auto tmp = path;
+        tmp += ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out) return false;
+            out << snapshot_magic;
+            write_u64(out, applied.load());
+
+            std::shared_lock<std::shared_mutex> lock(mtx);
+            write_u64(out, partitions.size());
+            for (auto &[id, p]: partitions) {
+                std::shared_lock<std::shared_mutex> partition_lock(p->mtx);
+                write_u64(out, id);
+                write_u64(out, p->map.size());
+                for (auto &[key, value]: p->map) {
+                    write_string(out, key);
+                    write_string(out, value);
+                }
+            }
+            out.flush();
+            if (!out) return false;
+        }
+        // readers of the snapshot never observe a half-written file
+        std::error_code ec;
+        std::filesystem::rename(tmp, path, ec);
+        return !ec;
+    }
+
+    auto MemoryEngine::load() -> bool {
+        std::ifstream in(path, std::ios::binary);
+        std::string magic(snapshot_magic.size(), '\0');
+        if (!in.read(magic.data(), static_cast<std::streamsize>(magic.size())) || magic != snapshot_magic) {
+            return false;
+        }
+
+        uint64_t index, count, id, entries;
+        std::string key, value;
+        if (!read_u64(in, index) || !read_u64(in, count)) return false;
+        applied.store(index);
+        for (uint64_t i = 0; i < count; i++) {
+            if (!read_u64(in, id) || !read_u64(in, entries)) return false;
+            create_partition(id);
+            for (uint64_t j = 0; j < entries; j++) {
+                if (!read_string(in, key) || !read_string(in, value)) return false;
+                set(id, key, value);
+            }
+        }
+        return true;
+    }
+
+}  // namespace cloudlab
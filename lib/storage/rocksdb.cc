@@ -0,0 +1,325 @@
+#include "cloudlab/storage/rocksdb.hh"
+
+#include "rocksdb/db.h"
+#include "rocksdb/options.h"
+#include "rocksdb/slice.h"
+#include "rocksdb/sst_file_writer.h"
+#include "rocksdb/statistics.h"
+#include "rocksdb/write_batch.h"
+
+#include "fmt/core.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <optional>
+
+namespace cloudlab {
+
+    namespace {
+
+        class RocksDBCursor : public Cursor {
+        public:
+            explicit RocksDBCursor(rocksdb::Iterator *it) : it{it} {
+            }
+
+            [[nodiscard]] auto valid() const -> bool override {
+                return it->Valid();
+            }
+
+            auto seek_to_first() -> void override {
+                it->SeekToFirst();
+            }
+
+            auto seek(std::string_view key) -> void override {
+                it->Seek(rocksdb::Slice{key.data(), key.size()});
+            }
+
+            auto next() -> void override {
+                it->Next();
+            }
+
+            [[nodiscard]] auto key() const -> std::string_view override {
+                return it->key().ToStringView();
+            }
+
+            [[nodiscard]] auto value() const -> std::string_view override {
+                return it->value().ToStringView();
+            }
+
+        private:
+            std::unique_ptr<rocksdb::Iterator> it;
+        };
+
+        const std::string applied_index_key = "raft_applied_index";
+
+        // exported partitions are split into files of about this size
+        const uint64_t max_sst_file_size = 64 * 1024 * 1024;
+
+        auto partition_id(const std::string &name) -> std::optional<size_t> {
+            if (name.empty() || !std::all_of(name.begin(), name.end(), ::isdigit)) return {};
+            return std::stoull(name);
+        }
+
+    }  // namespace
+
+    auto RocksDBEngine::open() -> bool {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        // only open db if it was not opened yet
+        if (db) return true;
+
+        rocksdb::Options options;
+        options.create_if_missing = true;
+        // without a WAL, unflushed data is only recoverable through the raft
+        // log; flushing all column families together keeps the applied index
+        // consistent with the data it covers
+        options.atomic_flush = disable_wal;
+        // tickers for STATS; the default level skips the expensive timers
+        db_statistics = rocksdb::CreateDBStatistics();
+        options.statistics = db_statistics;
+
+        // reopen every column family the db already has
+        std::vector<std::string> names;
+        rocksdb::DB::ListColumnFamilies(options, path.string(), &names);
+        if (std::find(names.begin(), names.end(), rocksdb::kDefaultColumnFamilyName) == names.end()) {
+            names.insert(names.begin(), rocksdb::kDefaultColumnFamilyName);
+        }
+        std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
+        for (auto &name: names) {
+            column_families.emplace_back(name, rocksdb::ColumnFamilyOptions());
+        }
+
+        std::vector<rocksdb::ColumnFamilyHandle *> opened;
+        if (!rocksdb::DB::Open(options, path.string(), column_families, &opened, &db).ok()) {
+            db = nullptr;
+            return false;
+        }
+        for (auto *handle: opened) {
+            if (auto id = partition_id(handle->GetName())) {
+                handles.insert({*id, handle});
+            } else if (handle->GetName() == rocksdb::kDefaultColumnFamilyName) {
+                default_handle = handle;
+            } else {
+                db->DestroyColumnFamilyHandle(handle);
+            }
+        }
+        return true;
+    }
+
+    auto RocksDBEngine::handle(size_t id) -> rocksdb::ColumnFamilyHandle * {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        auto it = handles.find(id);
+        return it == handles.end() ? nullptr : it->second;
+    }
+
+    auto RocksDBEngine::get(size_t partition, const std::string &key, std::string &value) -> bool {
+        auto *cf = handle(partition);
+        return cf && db->Get(rocksdb::ReadOptions(), cf, key, &value).ok();
+    }
+
+    auto RocksDBEngine::put(size_t partition, const std::string &key, const std::string &value) -> bool {
+        return has_partition(partition) && write({{partition, key, value, false}});
+    }
+
+    auto RocksDBEngine::remove(size_t partition, const std::string &key) -> bool {
+        return has_partition(partition) && write({{partition, key, {}, true}});
+    }
+
+    auto RocksDBEngine::prepare(const std::vector<Mutation> &batch, rocksdb::WriteBatch &write_batch) -> void {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        for (const auto &m: batch) {
+            auto it = handles.find(m.partition);
+            if (it == handles.end()) continue;
+            rocksdb::Slice key{m.key.data(), m.key.size()};
+            if (m.remove) {
+                write_batch.Delete(it->second, key);
+            } else {
+                write_batch.Put(it->second, key, rocksdb::Slice{m.value.data(), m.value.size()});
+            }
+        }
+    }
+
+    auto RocksDBEngine::apply(const std::vector<Mutation> &batch, uint64_t index) -> bool {
+        rocksdb::WriteBatch write_batch;
+        prepare(batch, write_batch);
+        write_batch.Put(default_handle, applied_index_key,
+                        rocksdb::Slice{reinterpret_cast<const char *>(&index), sizeof(index)});
+
+        rocksdb::WriteOptions options;
+        options.disableWAL = disable_wal;
+        return db && db->Write(options, &write_batch).ok();
+    }
+
+    auto RocksDBEngine::write(const std::vector<Mutation> &batch) -> bool {
+        rocksdb::WriteBatch write_batch;
+        prepare(batch, write_batch);
+
+        rocksdb::WriteOptions options;
+        options.disableWAL = disable_wal;
+        if (!db || !db->Write(options, &write_batch).ok()) return false;
+        // without a WAL only a flush makes the batch durable
+        return !disable_wal || flush();
+    }
+
+    auto RocksDBEngine::flush() -> bool {
+        std::vector<rocksdb::ColumnFamilyHandle *> cfs{default_handle};
+        {
+            std::shared_lock<std::shared_mutex> lock(mtx);
+            for (auto &[id, handle]: handles) {
+                cfs.emplace_back(handle);
+            }
+        }
+        return db->Flush(rocksdb::FlushOptions(), cfs).ok();
+    }
+
+    auto RocksDBEngine::applied_index() -> uint64_t {
+        std::string value;
+        uint64_t index{};
+        if (db && db->Get(rocksdb::ReadOptions(), default_handle, applied_index_key, &value).ok() &&
+            value.size() == sizeof(index)) {
+            memcpy(&index, value.data(), sizeof(index));
+        }
+        return index;
+    }
+
+    auto RocksDBEngine::export_partition(size_t id, const std::string &dir, std::vector<std::string> &files)
+    -> bool {
+        auto *cf = handle(id);
+        if (!cf) return false;
+        std::filesystem::create_directories(dir);
+
+        // the iterator reads from an implicit snapshot, so the export is a
+        // consistent cut even while writes continue
+        std::unique_ptr<rocksdb::Iterator> it{db->NewIterator(rocksdb::ReadOptions(), cf)};
+        rocksdb::SstFileWriter writer{rocksdb::EnvOptions(), db->GetOptions(cf), cf};
+        bool open{};
+        for (it->SeekToFirst(); it->Valid(); it->Next()) {
+            if (!open) {
+                files.emplace_back(fmt::format("{}/{}-{}.sst", dir, id, files.size()));
+                if (!writer.Open(files.back()).ok()) return false;
+                open = true;
+            }
+            if (!writer.Put(it->key(), it->value()).ok()) return false;
+            if (writer.FileSize() >= max_sst_file_size) {
+                if (!writer.Finish().ok()) return false;
+                open = false;
+            }
+        }
+        if (open && !writer.Finish().ok()) return false;
+        return it->status().ok();
+    }
+
+    auto RocksDBEngine::ingest_partition(size_t id, const std::vector<std::string> &files) -> bool {
+        auto *cf = handle(id);
+        if (!cf) return false;
+        if (files.empty()) return true;
+        rocksdb::IngestExternalFileOptions options;
+        // the files were streamed into a staging directory, link them into
+        // the db instead of copying them once more
+        options.move_files = true;
+        return db->IngestExternalFile(cf, files, options).ok();
+    }
+
+    auto RocksDBEngine::create_partition(size_t id) -> bool {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        if (!db) return false;
+        if (handles.contains(id)) return true;
+        rocksdb::ColumnFamilyHandle *cf;
+        if (!db->CreateColumnFamily(rocksdb::ColumnFamilyOptions(), std::to_string(id), &cf).ok()) return false;
+        handles.insert({id, cf});
+        return true;
+    }
+
+    auto RocksDBEngine::drop_partition(size_t id) -> bool {
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        auto k = handles.find(id);
+        if (k == handles.end()) return true;
+        bool b = db->DropColumnFamily(k->second).ok();
+        b = db->DestroyColumnFamilyHandle(k->second).ok() && b;
+        handles.erase(k);
+        return b;
+    }
+
+    auto RocksDBEngine::has_partition(size_t id) -> bool {
+        return handle(id) != nullptr;
+    }
+
+    auto RocksDBEngine::partition_ids() -> std::vector<size_t> {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        std::vector<size_t> ids;
+        for (auto &[id, handle]: handles) {
+            ids.emplace_back(id);
+        }
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    auto RocksDBEngine::cursors(const std::vector<size_t> &ids) -> std::vector<std::unique_ptr<Cursor>> {
+        std::vector<rocksdb::ColumnFamilyHandle *> cfs;
+        {
+            std::shared_lock<std::shared_mutex> lock(mtx);
+            for (auto id: ids) {
+                auto it = handles.find(id);
+                if (it != handles.end()) cfs.emplace_back(it->second);
+            }
+        }
+        // iterators created together share one implicit snapshot, so the merged
+        // view is consistent across partitions
+        std::vector<rocksdb::Iterator *> its;
+        std::vector<std::unique_ptr<Cursor>> result;
+        if (db && !cfs.empty() && db->NewIterators(rocksdb::ReadOptions(), cfs, &its).ok()) {
+            for (auto *it: its) {
+                result.emplace_back(std::make_unique<RocksDBCursor>(it));
+            }
+        }
+        return result;
+    }
+
+    auto RocksDBEngine::statistics() -> std::vector<std::pair<std::string, uint64_t>> {
+        std::vector<std::pair<std::string, uint64_t>> result;
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        if (!db) return result;
+
+        const std::pair<const char *, rocksdb::Tickers> tickers[] = {
+                {"block_cache_hit", rocksdb::BLOCK_CACHE_HIT},
+                {"block_cache_miss", rocksdb::BLOCK_CACHE_MISS},
+                {"memtable_hit", rocksdb::MEMTABLE_HIT},
+                {"memtable_miss", rocksdb::MEMTABLE_MISS},
+                {"keys_read", rocksdb::NUMBER_KEYS_READ},
+                {"keys_written", rocksdb::NUMBER_KEYS_WRITTEN},
+                {"bytes_read", rocksdb::BYTES_READ},
+                {"bytes_written", rocksdb::BYTES_WRITTEN},
+                {"stall_micros", rocksdb::STALL_MICROS},
+        };
+        for (const auto &[name, ticker]: tickers) {
+            result.emplace_back(fmt::format("rocksdb.{}", name), db_statistics->getTickerCount(ticker));
+        }
+
+        // summed over all column families, i.e. partitions
+        const char *properties[] = {
+                "rocksdb.estimate-num-keys",
+                "rocksdb.cur-size-all-mem-tables",
+                "rocksdb.total-sst-files-size",
+                "rocksdb.estimate-pending-compaction-bytes",
+                "rocksdb.block-cache-usage",
+                "rocksdb.estimate-table-readers-mem",
+        };
+        for (const auto *property: properties) {
+            uint64_t value{};
+            if (db->GetAggregatedIntProperty(property, &value)) result.emplace_back(property, value);
+        }
+        return result;
+    }
+
+    RocksDBEngine::~RocksDBEngine() {
+        if (!db) return;
+        // memtables are not covered by a WAL, persist them on a clean shutdown
+        if (disable_wal) flush();
+        for (auto &[id, handle]: handles) {
+            db->DestroyColumnFamilyHandle(handle);
+        }
+        if (default_handle) db->DestroyColumnFamilyHandle(default_handle);
+        delete db;
+    }
+
+}  // namespace cloudlab
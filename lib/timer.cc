@@ -0,0 +1,152 @@
+#include "cloudlab/timer.hh"
+
+#include <algorithm>
+#include <limits>
+
+namespace cloudlab {
+
+    namespace {
+
+        const auto tick_length = std::chrono::duration_cast<TimerWheel::Clock::duration>(timer_tick).count();
+
+        const auto never = std::numeric_limits<uint64_t>::max();
+
+    }  // namespace
+
+    TimerWheel::TimerWheel() : start{Clock::now()} {
+        thread = std::thread(&TimerWheel::service, this);
+    }
+
+    TimerWheel::~TimerWheel() {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stopping = true;
+        }
+        changed.notify_one();
+        thread.join();
+    }
+
+    auto TimerWheel::ticks(Clock::time_point time) const -> uint64_t {
+        auto elapsed = (time - start).count();
+        return elapsed <= 0 ? 0 : elapsed / tick_length;
+    }
+
+    auto TimerWheel::schedule(Clock::time_point deadline, std::function<void()> callback) -> Id {
+        std::lock_guard<std::mutex> lock(mtx);
+        // an empty wheel does not tick, catch up without walking the slots
+        if (pending.empty()) current = std::max(current, ticks(Clock::now()));
+
+        // round up, a timer must not fire before its deadline
+        auto elapsed = (deadline - start).count();
+        uint64_t expiry = elapsed <= 0 ? 0 : (elapsed + tick_length - 1) / tick_length;
+
+        auto id = next_id++;
+        Slot slot;
+        slot.push_back({id, std::max(expiry, current + 1), std::move(callback)});
+        place(slot, slot.begin());
+        if (expiry < wakeup) changed.notify_one();
+        return id;
+    }
+
+    auto TimerWheel::cancel(Id id) -> bool {
+        std::unique_lock<std::mutex> lock(mtx);
+        auto entry = pending.find(id);
+        if (entry != pending.end()) {
+            auto [slot, it] = entry->second;
+            slot->erase(it);
+            pending.erase(entry);
+            return true;
+        }
+        fired.wait(lock, [this, id] { return running != id; });
+        return false;
+    }
+
+    auto TimerWheel::place(Slot &from, Slot::iterator it) -> void {
+        auto expiry = it->expiry;
+        Slot *target;
+        if (expiry <= current) {
+            target = &due;
+        } else {
+            // the lowest level whose slots still tell the expiry apart from now
+            auto level = 0;
+            while (level < levels - 1 &&
+                   (expiry >> (slot_bits * level)) - (current >> (slot_bits * level)) >= slots) {
+                level++;
+            }
+            auto block = expiry >> (slot_bits * level);
+            // beyond the range of the wheel: park in the farthest slot, the
+            // timer is placed again when the wheel gets there
+            block = std::min(block, (current >> (slot_bits * level)) + slots - 1);
+            target = &wheel[level][block % slots];
+        }
+        target->splice(target->end(), from, it);
+        pending[it->id] = {target, it};
+    }
+
+    auto TimerWheel::advance(uint64_t target) -> void {
+        if (pending.size() == due.size()) {
+            // nothing in the wheel
+            current = std::max(current, target);
+            return;
+        }
+        while (current < target) {
+            current++;
+            // cascade from the top, a timer may drop several levels at once
+            for (auto level = levels - 1; level > 0; level--) {
+                if (current % (uint64_t{1} << (slot_bits * level)) != 0) continue;
+                auto &slot = wheel[level][(current >> (slot_bits * level)) % slots];
+                while (!slot.empty()) {
+                    place(slot, slot.begin());
+                }
+            }
+            auto &slot = wheel[0][current % slots];
+            for (const auto &timer: slot) {
+                pending[timer.id].first = &due;
+            }
+            due.splice(due.end(), slot);
+        }
+    }
+
+    auto TimerWheel::next_tick() const -> uint64_t {
+        if (!due.empty()) return current;
+        if (pending.empty()) return never;
+        // the next busy slot of level 0, or the next cascade
+        auto boundary = ((current >> slot_bits) + 1) << slot_bits;
+        for (auto tick = current + 1; tick < boundary; tick++) {
+            if (!wheel[0][tick % slots].empty()) return tick;
+        }
+        return boundary;
+    }
+
+    auto TimerWheel::service() -> void {
+        std::unique_lock<std::mutex> lock(mtx);
+        while (!stopping) {
+            advance(ticks(Clock::now()));
+            if (!due.empty()) {
+                auto timer = std::move(due.front());
+                due.pop_front();
+                pending.erase(timer.id);
+                running = timer.id;
+                lock.unlock();
+                timer.callback();
+                lock.lock();
+                running = 0;
+                fired.notify_all();
+                continue;
+            }
+            wakeup = next_tick();
+            if (wakeup == never) {
+                changed.wait(lock);
+            } else {
+                changed.wait_until(lock, start + Clock::duration(static_cast<Clock::rep>(wakeup) * tick_length));
+            }
+            wakeup = never;
+        }
+    }
+
+    auto timers() -> TimerWheel & {
+        static TimerWheel instance;
+        return instance;
+    }
+
+}  // namespace cloudlab
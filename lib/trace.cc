@@ -0,0 +1,177 @@
+#include "cloudlab/trace.hh"
+
+#include "fmt/core.h"
+
+#include "cloud.pb.h"
+
+#include <random>
+#include <unistd.h>
+
+namespace cloudlab {
+
+    namespace {
+
+        auto rng() -> std::mt19937_64 & {
+            thread_local std::mt19937_64 generator{std::random_device{}()};
+            return generator;
+        }
+
+        thread_local std::chrono::system_clock::time_point ready;
+
+        auto micros(std::chrono::system_clock::duration d) -> int64_t {
+            return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+        }
+
+        // the span name is one of ours, but keep the JSON valid regardless
+        auto escape(const std::string &s) -> std::string {
+            std::string result;
+            for (auto c: s) {
+                if (c == '"' || c == '\\') result += '\\';
+                if (static_cast<unsigned char>(c) >= 0x20) result += c;
+            }
+            return result;
+        }
+
+    }  // namespace
+
+    auto current_trace() -> TraceContext & {
+        thread_local TraceContext context;
+        return context;
+    }
+
+    auto new_trace_id() -> uint64_t {
+        uint64_t id;
+        // 0 means "no span"
+        while ((id = rng()()) == 0) {
+        }
+        return id;
+    }
+
+    auto Tracer::open(const std::string &path, double sample_rate, const std::string &node) -> bool {
+        std::lock_guard<std::mutex> lock(mtx);
+        out.open(path, std::ios::trunc);
+        if (!out) return false;
+        // the closing bracket is optional in the JSON array format, so the
+        // file stays valid while spans are appended
+        out << fmt::format("[{{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+                           getpid(), escape(node));
+        out.flush();
+        rate = sample_rate;
+        return true;
+    }
+
+    auto Tracer::sample() -> bool {
+        auto r = rate.load(std::memory_order_relaxed);
+        if (r <= 0) return false;
+        if (r >= 1) return true;
+        return std::uniform_real_distribution<double>{0, 1}(rng()) < r;
+    }
+
+    auto Tracer::record(Span span) -> void {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (spans.size() >= max_buffered_spans) {
+            dropped++;
+            return;
+        }
+        spans.emplace_back(std::move(span));
+    }
+
+    auto Tracer::flush() -> bool {
+        std::vector<Span> pending;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            pending.swap(spans);
+        }
+        if (pending.empty()) return true;
+
+        // one row (tid) per trace, so the spans of a request nest in the viewer
+        std::string data;
+        auto pid = getpid();
+        for (const auto &span: pending) {
+            data += fmt::format(
+                    ",\n{{\"name\":\"{}\",\"cat\":\"kvs\",\"ph\":\"X\",\"ts\":{},\"dur\":{},\"pid\":{},\"tid\":{},"
+                    "\"args\":{{\"trace_id\":\"{:016x}\",\"span_id\":\"{:016x}\",\"parent_id\":\"{:016x}\"}}}}",
+                    escape(span.name), micros(span.start.time_since_epoch()), micros(span.duration), pid,
+                    span.trace_id & 0x7fffffff, span.trace_id, span.span_id, span.parent_id);
+        }
+
+        std::lock_guard<std::mutex> lock(mtx);
+        if (dropped > 0) {
+            fmt::print("tracing: dropped {} spans\n", dropped);
+            dropped = 0;
+        }
+        out << data;
+        out.flush();
+        return static_cast<bool>(out);
+    }
+
+    auto tracer() -> Tracer & {
+        static Tracer instance;
+        return instance;
+    }
+
+    TraceScope::TraceScope(const cloud::CloudMessage_Trace &trace) : previous{current_trace()} {
+        current_trace() = {trace.trace_id(), trace.parent_span_id(), trace.sampled() && trace.trace_id() != 0};
+    }
+
+    TraceSpan::TraceSpan(std::string_view name) {
+        auto &context = current_trace();
+        if (!context.sampled) return;
+        active = true;
+        this->name = name;
+        span_id = new_trace_id();
+        parent_id = context.span_id;
+        context.span_id = span_id;
+        start = std::chrono::system_clock::now();
+    }
+
+    TraceSpan::~TraceSpan() {
+        if (!active) return;
+        auto &context = current_trace();
+        tracer().record({std::move(name), context.trace_id, span_id, parent_id, start,
+                         std::chrono::system_clock::now() - start});
+        context.span_id = parent_id;
+    }
+
+    auto TraceSpan::record(std::string_view name, std::chrono::system_clock::time_point start,
+                           std::chrono::system_clock::time_point end) -> void {
+        const auto &context = current_trace();
+        if (!context.sampled) return;
+        tracer().record({std::string{name}, context.trace_id, new_trace_id(), context.span_id, start, end - start});
+    }
+
+    auto start_trace(cloud::CloudMessage &msg) -> void {
+        if (msg.has_trace() || !tracer().enabled()) return;
+        switch (msg.operation()) {
+            case cloud::CloudMessage_Operation_PUT:
+            case cloud::CloudMessage_Operation_GET:
+            case cloud::CloudMessage_Operation_DELETE:
+            case cloud::CloudMessage_Operation_SCAN:
+                break;
+            default:
+                return;
+        }
+        if (!tracer().sample()) return;
+        auto *trace = msg.mutable_trace();
+        trace->set_trace_id(new_trace_id());
+        trace->set_sampled(true);
+    }
+
+    auto propagate_trace(cloud::CloudMessage &msg) -> void {
+        const auto &context = current_trace();
+        if (!context.sampled) return;
+        auto *trace = msg.mutable_trace();
+        trace->set_trace_id(context.trace_id);
+        trace->set_parent_span_id(context.span_id);
+        trace->set_sampled(true);
+    }
+
+    auto set_ready_time(std::chrono::system_clock::time_point time) -> void {
+        ready = time;
+    }
+
+    auto ready_time() -> std::chrono::system_clock::time_point {
+        return ready;
+    }
+
+}  // namespace cloudlab
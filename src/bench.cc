@@ -0,0 +1,372 @@
+#include "cloudlab/client/async_client.hh"
+#include "cloudlab/client/client.hh"
+#include "cloudlab/network/connection.hh"
+
+#include "cloud.pb.h"
+
+#include "argh.hh"
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <filesystem>
+#include <mutex>
+#include <random>
+#include <semaphore>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace cloudlab;
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Zipfian ranks in [0, items) as in YCSB (Gray et al., "Quickly generating
+ * billion-record synthetic databases"): rank 0 is the most popular item.
+ */
+class Zipfian {
+ public:
+  Zipfian(uint64_t items, double theta) : items{items}, theta{theta} {
+    zetan = zeta(items);
+    auto zeta2 = zeta(2);
+    alpha = 1.0 / (1.0 - theta);
+    eta = (1 - std::pow(2.0 / items, 1 - theta)) / (1 - zeta2 / zetan);
+  }
+
+  template <typename Rng>
+  auto next(Rng& rng) -> uint64_t {
+    auto u = std::uniform_real_distribution<double>{0, 1}(rng);
+    auto uz = u * zetan;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + std::pow(0.5, theta)) return 1;
+    auto rank = static_cast<uint64_t>(items * std::pow(eta * u - eta + 1, alpha));
+    return std::min(rank, items - 1);
+  }
+
+ private:
+  auto zeta(uint64_t n) const -> double {
+    double sum{};
+    for (uint64_t i = 1; i <= n; i++) sum += 1.0 / std::pow(i, theta);
+    return sum;
+  }
+
+  uint64_t items;
+  double theta, zetan{}, alpha{}, eta{};
+};
+
+enum class Distribution { UNIFORM, ZIPFIAN, LATEST };
+
+struct Workload {
+  Distribution distribution{Distribution::ZIPFIAN};
+  double read_ratio{0.5};
+  // share of the writes that insert new records instead of updating
+  double insert_ratio{0.0};
+  uint64_t records{10000};
+  uint64_t operations{100000};
+  size_t value_size{100};
+  double theta{0.99};
+};
+
+struct Result {
+  std::vector<uint32_t> reads, writes;
+  uint64_t errors{};
+};
+
+static auto key_of(uint64_t n) -> std::string {
+  // scramble the rank so popular keys spread over all partitions
+  auto hash = n * 0x9E3779B97F4A7C15ULL;
+  return fmt::format("user{:016x}", hash);
+}
+
+// picks the record of the next operation, `inserted` grows with inserts
+class KeyChooser {
+ public:
+  KeyChooser(const Workload& workload, std::atomic<uint64_t>& inserted)
+      : workload{workload},
+        inserted{inserted},
+        zipfian{std::max<uint64_t>(workload.records, 2), workload.theta} {
+  }
+
+  template <typename Rng>
+  auto next(Rng& rng) -> uint64_t {
+    auto count = inserted.load(std::memory_order_relaxed);
+    switch (workload.distribution) {
+      case Distribution::UNIFORM:
+        return std::uniform_int_distribution<uint64_t>{0, count - 1}(rng);
+      case Distribution::ZIPFIAN:
+        return zipfian.next(rng) % count;
+      case Distribution::LATEST:
+        // the most recently inserted records are the most popular
+        return count - 1 - zipfian.next(rng) % count;
+    }
+    return 0;
+  }
+
+ private:
+  const Workload& workload;
+  std::atomic<uint64_t>& inserted;
+  Zipfian zipfian;
+};
+
+static auto percentile(std::vector<uint32_t>& samples, double p) -> uint32_t {
+  if (samples.empty()) return 0;
+  auto rank = static_cast<size_t>(std::ceil(p * samples.size()));
+  return samples[std::clamp<size_t>(rank, 1, samples.size()) - 1];
+}
+
+static auto latency_json(std::vector<uint32_t>& samples) -> std::string {
+  std::sort(samples.begin(), samples.end());
+  return fmt::format(
+      R"({{"count": {}, "p50": {}, "p99": {}, "p999": {}, "max": {}}})",
+      samples.size(), percentile(samples, 0.5), percentile(samples, 0.99),
+      percentile(samples, 0.999), samples.empty() ? 0 : samples.back());
+}
+
+// start a leader and `nodes - 1` followers and let the followers join
+static auto spawn_cluster(const std::string& kvs, size_t nodes,
+                          uint16_t base_port, std::vector<pid_t>& pids)
+    -> std::string {
+  auto address = [](uint16_t port) { return fmt::format("127.0.0.1:{}", port); };
+  auto leader_p2p = address(base_port + 1);
+
+  for (size_t i = 0; i < nodes; i++) {
+    auto api = address(base_port + 2 * i);
+    auto p2p = address(base_port + 2 * i + 1);
+    auto pid = fork();
+    if (pid == 0) {
+      if (i == 0) {
+        execl(kvs.c_str(), kvs.c_str(), "-a", api.c_str(), "-c", p2p.c_str(),
+              "-l", nullptr);
+      } else {
+        execl(kvs.c_str(), kvs.c_str(), "-a", api.c_str(), "-p", p2p.c_str(),
+              "-c", leader_p2p.c_str(), nullptr);
+      }
+      _exit(127);
+    }
+    pids.push_back(pid);
+  }
+  std::this_thread::sleep_for(std::chrono::seconds(2));
+
+  for (size_t i = 1; i < nodes; i++) {
+    cloud::CloudMessage request{}, response{};
+    request.set_type(cloud::CloudMessage_Type_REQUEST);
+    request.set_operation(cloud::CloudMessage_Operation_JOIN_CLUSTER);
+    request.mutable_address()->set_address(address(base_port + 2 * i + 1));
+    Connection con{leader_p2p};
+    if (!con.send(request) || !con.receive(response) || !response.success()) {
+      fmt::print(stderr, "node {} could not join\n", i);
+    }
+  }
+  // give the followers a heartbeat to learn about the leader
+  if (nodes > 1) std::this_thread::sleep_for(std::chrono::seconds(3));
+  return leader_p2p;
+}
+
+static auto run_sync(const std::string& seed, const Workload& workload,
+                     size_t threads, std::atomic<uint64_t>& inserted)
+    -> Result {
+  std::vector<Result> results(threads);
+  std::atomic<uint64_t> next_op{0};
+  std::vector<std::thread> workers;
+
+  for (size_t t = 0; t < threads; t++) {
+    workers.emplace_back([&, t]() {
+      Client client{{seed}};
+      std::mt19937_64 rng{t + 1};
+      KeyChooser chooser{workload, inserted};
+      std::string value(workload.value_size, 'x'), result;
+      auto& mine = results[t];
+
+      while (next_op.fetch_add(1) < workload.operations) {
+        auto read = std::uniform_real_distribution<double>{0, 1}(rng) <
+                    workload.read_ratio;
+        auto insert = !read && std::uniform_real_distribution<double>{0, 1}(
+                                   rng) < workload.insert_ratio;
+        auto n = insert ? inserted.fetch_add(1) : chooser.next(rng);
+
+        auto start = Clock::now();
+        auto ok = read ? client.get(key_of(n), result)
+                       : client.put(key_of(n), value);
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                          Clock::now() - start)
+                          .count();
+        (read ? mine.reads : mine.writes).push_back(micros);
+        if (!ok) mine.errors++;
+      }
+    });
+  }
+  for (auto& worker : workers) worker.join();
+
+  Result total;
+  for (auto& r : results) {
+    total.reads.insert(total.reads.end(), r.reads.begin(), r.reads.end());
+    total.writes.insert(total.writes.end(), r.writes.begin(), r.writes.end());
+    total.errors += r.errors;
+  }
+  return total;
+}
+
+static auto run_async(const std::string& seed, const Workload& workload,
+                      size_t window, std::atomic<uint64_t>& inserted,
+                      const AsyncClientOptions& options) -> Result {
+  AsyncClient client{{seed}, options};
+  std::counting_semaphore<> slots{static_cast<std::ptrdiff_t>(window)};
+  std::mutex mtx;
+  Result total;
+  std::mt19937_64 rng{1};
+  KeyChooser chooser{workload, inserted};
+  std::string value(workload.value_size, 'x');
+
+  for (uint64_t i = 0; i < workload.operations; i++) {
+    auto read = std::uniform_real_distribution<double>{0, 1}(rng) <
+                workload.read_ratio;
+    auto insert = !read && std::uniform_real_distribution<double>{0, 1}(rng) <
+                               workload.insert_ratio;
+    auto n = insert ? inserted.fetch_add(1) : chooser.next(rng);
+
+    // at most `window` operations are outstanding
+    slots.acquire();
+    auto start = Clock::now();
+    auto done = [&, read, start](bool ok, const std::string&) {
+      auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                        Clock::now() - start)
+                        .count();
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        (read ? total.reads : total.writes).push_back(micros);
+        if (!ok) total.errors++;
+      }
+      slots.release();
+    };
+    if (read) {
+      client.get(key_of(n), done);
+    } else {
+      client.put(key_of(n), value, done);
+    }
+  }
+  client.flush();
+  return total;
+}
+
+auto main(int argc, char* argv[]) -> int {
+  argh::parser cmdl({"-c", "--cluster", "--spawn", "--kvs", "--base-port",
+                     "-w", "--workload", "-d", "--distribution", "-r",
+                     "--records", "-n", "--operations", "--value-size", "-t",
+                     "--threads", "--read-ratio", "--theta", "--connections",
+                     "--batch"});
+  cmdl.parse(argc, argv);
+
+  std::string cluster, kvs, preset, distribution;
+  size_t spawn{}, threads{}, connections{}, batch{};
+  uint16_t base_port{};
+  double read_ratio{-1};
+  Workload workload;
+
+  // an existing cluster (any node), otherwise a local one is spawned
+  cmdl({"-c", "--cluster"}, "") >> cluster;
+  cmdl({"--spawn"}, 1) >> spawn;
+  cmdl({"--kvs"},
+       std::filesystem::path{argv[0]}.parent_path().append("kvs-test").string())
+      >> kvs;
+  cmdl({"--base-port"}, 50000) >> base_port;
+  // YCSB core workloads: a (50% reads), b (95%), c (100%), d (95%, inserts)
+  cmdl({"-w", "--workload"}, "a") >> preset;
+  cmdl({"-d", "--distribution"}, "zipfian") >> distribution;
+  cmdl({"-r", "--records"}, workload.records) >> workload.records;
+  cmdl({"-n", "--operations"}, workload.operations) >> workload.operations;
+  cmdl({"--value-size"}, workload.value_size) >> workload.value_size;
+  cmdl({"-t", "--threads"}, 8) >> threads;
+  cmdl({"--read-ratio"}, -1) >> read_ratio;
+  cmdl({"--theta"}, workload.theta) >> workload.theta;
+  // only with --async: connections and batch size of the async client
+  cmdl({"--connections"}, 2) >> connections;
+  cmdl({"--batch"}, 128) >> batch;
+
+  if (preset == "a") {
+    workload.read_ratio = 0.5;
+  } else if (preset == "b") {
+    workload.read_ratio = 0.95;
+  } else if (preset == "c") {
+    workload.read_ratio = 1.0;
+  } else if (preset == "d") {
+    workload.read_ratio = 0.95;
+    workload.insert_ratio = 1.0;
+    workload.distribution = Distribution::LATEST;
+  } else {
+    fmt::print(stderr, "unknown workload {}\n", preset);
+    return 1;
+  }
+  if (read_ratio >= 0) workload.read_ratio = read_ratio;
+  if (cmdl({"-d", "--distribution"})) {
+    if (distribution == "uniform") {
+      workload.distribution = Distribution::UNIFORM;
+    } else if (distribution == "zipfian") {
+      workload.distribution = Distribution::ZIPFIAN;
+    } else if (distribution == "latest") {
+      workload.distribution = Distribution::LATEST;
+    } else {
+      fmt::print(stderr, "unknown distribution {}\n", distribution);
+      return 1;
+    }
+  }
+  if (workload.records == 0 || threads == 0) {
+    fmt::print(stderr, "records and threads must be positive\n");
+    return 1;
+  }
+
+  std::vector<pid_t> pids;
+  auto seed = cluster.empty() ? spawn_cluster(kvs, spawn, base_port, pids)
+                              : cluster;
+
+  // load phase: every record exists before the measurement starts
+  std::atomic<uint64_t> inserted{0};
+  if (!cmdl["--skip-load"]) {
+    AsyncClient loader{{seed}};
+    std::string value(workload.value_size, 'x');
+    for (uint64_t n = 0; n < workload.records; n++) {
+      loader.put(key_of(n), value, [](bool, const std::string&) {});
+    }
+    loader.flush();
+  }
+  inserted = workload.records;
+
+  auto start = Clock::now();
+  auto result =
+      cmdl["--async"]
+          ? run_async(seed, workload, threads, inserted,
+                      {connections, std::max<size_t>(threads, 1), batch})
+          : run_sync(seed, workload, threads, inserted);
+  auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  for (auto pid : pids) {
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+  }
+
+  std::vector<uint32_t> all{result.reads};
+  all.insert(all.end(), result.writes.begin(), result.writes.end());
+
+  // one JSON object, latencies in microseconds
+  fmt::print(
+      R"({{"workload": "{}", "distribution": "{}", "mode": "{}", "threads": {}, )"
+      R"("records": {}, "operations": {}, "value_size": {}, "read_ratio": {}, )"
+      R"("duration_s": {:.3f}, "throughput_ops": {:.1f}, "errors": {}, )"
+      R"("latency_us": {{"read": {}, "write": {}, "all": {}}}}})"
+      "\n",
+      preset,
+      workload.distribution == Distribution::UNIFORM   ? "uniform"
+      : workload.distribution == Distribution::ZIPFIAN ? "zipfian"
+                                                       : "latest",
+      cmdl["--async"] ? "async" : "sync", threads, workload.records,
+      workload.operations, workload.value_size, workload.read_ratio, seconds,
+      workload.operations / seconds, result.errors, latency_json(result.reads),
+      latency_json(result.writes), latency_json(all));
+  return 0;
+}
@@ -1,3 +1,4 @@
+#include "cloudlab/client/client.hh"
 #include "cloudlab/network/connection.hh"
 
 #include "cloud.pb.h"
@@ -10,11 +11,18 @@ using namespace cloudlab;
 auto main(int argc, char *argv[]) -> int {
   cloud::CloudMessage msg{};
 
-  argh::parser cmdl({"-a", "--api"});
+  argh::parser cmdl({"-a", "--api", "-n", "--limit", "-t", "--token",
+                     "--max-staleness", "--min-index"});
   cmdl.parse(argc, argv);
 
-  std::string api_address;
+  std::string api_address, token;
+  uint32_t limit{};
+  uint64_t max_staleness{}, min_index{};
   cmdl({"-a", "--api"}, "127.0.0.1:41000") >> api_address;
+  cmdl({"-n", "--limit"}, 0) >> limit;
+  cmdl({"-t", "--token"}, "") >> token;
+  cmdl("--max-staleness", 0) >> max_staleness;
+  cmdl("--min-index", 0) >> min_index;
 
   auto num_pos_args = cmdl.pos_args().size();
 
@@ -35,37 +43,109 @@ auto main(int argc, char *argv[]) -> int {
       tmp->set_key(cmdl.pos_args().at(i));
     }
   } else if (num_pos_args > 2 && cmdl.pos_args().at(1) == "direct_get") {
+    // direct_get <key>... [--max-staleness ms] [--min-index index]
     msg.set_operation(cloud::CloudMessage_Operation_RAFT_DIRECT_GET);
     for (auto i = 2; i < num_pos_args; i++) {
       auto *tmp = msg.add_kvp();
       tmp->set_key(cmdl.pos_args().at(i));
     }
+    if (max_staleness != 0 || min_index != 0) {
+      auto *bound = msg.mutable_read_bound();
+      bound->set_max_staleness_ms(max_staleness);
+      bound->set_min_applied_index(min_index);
+    }
   } else if (num_pos_args > 2 && cmdl.pos_args().at(1) == "del") {
     msg.set_operation(cloud::CloudMessage_Operation_DELETE);
     for (auto i = 2; i < num_pos_args; i++) {
       auto *tmp = msg.add_kvp();
       tmp->set_key(cmdl.pos_args().at(i));
     }
+  } else if (num_pos_args >= 2 && num_pos_args <= 4 &&
+             cmdl.pos_args().at(1) == "scan") {
+    // scan [start [end]] [-n limit] [-t token] [--all]
+    msg.set_operation(cloud::CloudMessage_Operation_SCAN);
+    auto *range = msg.mutable_range();
+    if (num_pos_args > 2) range->set_start(cmdl.pos_args().at(2));
+    if (num_pos_args > 3) range->set_end(cmdl.pos_args().at(3));
+    range->set_limit(limit);
+    range->set_token(token);
   } else if (num_pos_args == 3 && cmdl.pos_args().at(1) == "join") {
     msg.set_operation(cloud::CloudMessage_Operation_JOIN_CLUSTER);
     auto *address = msg.mutable_address();
     address->set_address(cmdl.pos_args().at(2));
+  } else if (num_pos_args == 4 && (cmdl.pos_args().at(1) == "transfer" ||
+                                    cmdl.pos_args().at(1) == "steal")) {
+    // transfer <partition> <destination peer>: move a partition away
+    // steal <partition> <owner peer>: move a partition to the contacted node
+    msg.set_operation(cmdl.pos_args().at(1) == "transfer"
+                          ? cloud::CloudMessage_Operation_TRANSFER_PARTITION
+                          : cloud::CloudMessage_Operation_STEAL_PARTITIONS);
+    auto *partition = msg.add_partition();
+    partition->set_id(std::stoul(cmdl.pos_args().at(2)));
+    partition->set_peer(cmdl.pos_args().at(3));
+  } else if (num_pos_args == 3 && (cmdl.pos_args().at(1) == "add_node" ||
+                                    cmdl.pos_args().at(1) == "remove_node")) {
+    // add_node <peer>: join as a learner, remove_node <peer>: leave the group
+    msg.set_operation(cmdl.pos_args().at(1) == "add_node"
+                          ? cloud::CloudMessage_Operation_RAFT_ADD_NODE
+                          : cloud::CloudMessage_Operation_RAFT_REMOVE_NODE);
+    msg.mutable_address()->set_address(cmdl.pos_args().at(2));
+  } else if ((num_pos_args == 2 || num_pos_args == 3) &&
+             cmdl.pos_args().at(1) == "transfer_leader") {
+    // transfer_leader [<peer>]: hand the leadership to a follower, e.g.
+    // before restarting the leader
+    msg.set_operation(cloud::CloudMessage_Operation_RAFT_TRANSFER_LEADERSHIP);
+    if (num_pos_args == 3) {
+      msg.mutable_address()->set_address(cmdl.pos_args().at(2));
+    }
   } else if (num_pos_args == 2 && cmdl.pos_args().at(1) == "dropped") {
     msg.set_operation(cloud::CloudMessage_Operation_RAFT_DROPPED_NODE);
   } else if (num_pos_args == 2 && cmdl.pos_args().at(1) == "leader") {
     msg.set_operation(cloud::CloudMessage_Operation_RAFT_GET_LEADER);
+  } else if (num_pos_args == 2 && cmdl.pos_args().at(1) == "stats") {
+    msg.set_operation(cloud::CloudMessage_Operation_STATS);
   } else {
     fmt::print("Usage: {} <operation> <args>\n", cmdl.pos_args().at(0));
     return 1;
   }
 
-  Connection con{api_address};
+  // key operations go through the client, which follows the redirects of
+  // followers to the leader; everything else targets the given node
+  auto key_operation = msg.operation() == cloud::CloudMessage_Operation_PUT ||
+                       msg.operation() == cloud::CloudMessage_Operation_GET ||
+                       msg.operation() == cloud::CloudMessage_Operation_DELETE ||
+                       msg.operation() == cloud::CloudMessage_Operation_SCAN;
+  Client client{{api_address}};
+  auto round_trip = [&]() {
+    if (key_operation) {
+      auto request = msg;
+      if (!client.execute(request, msg)) msg.set_message("ERROR");
+    } else {
+      auto request = msg;
+      Connection con{api_address};
+      con.send(msg);
+      con.receive(msg);
+      // a bounded read the node is too stale for goes to the leader
+      if (request.has_read_bound() && !msg.success() && msg.has_address() &&
+          !client.execute(request, msg)) {
+        msg.set_message("ERROR");
+      }
+    }
+  };
 
-  // send request
-  con.send(msg);
+  round_trip();
 
-  // receive reply
-  con.receive(msg);
+  // with --all, keep requesting pages over the same connection until the
+  // scan is exhausted; only one page is held in memory at a time
+  while (msg.operation() == cloud::CloudMessage_Operation_SCAN &&
+         cmdl["--all"] && msg.success() && !msg.range().token().empty()) {
+    for (const auto &kvp : msg.kvp()) {
+      fmt::print("Key:\t{}\nValue:\t{}\n", kvp.key(), kvp.value());
+    }
+    msg.clear_kvp();
+    msg.set_type(cloud::CloudMessage_Type_REQUEST);
+    round_trip();
+  }
 
   switch (msg.operation()) {
     case cloud::CloudMessage_Operation_PUT:
@@ -78,6 +158,29 @@ auto main(int argc, char *argv[]) -> int {
         for (const auto &kvp : msg.kvp()) {
           fmt::print("Key:\t{}\nValue:\t{}\n", kvp.key(), kvp.value());
         }
+        // pass as --min-index to read your own writes from a follower
+        if (msg.has_read_bound()) {
+          fmt::print("Index:\t{}\n", msg.read_bound().applied_index());
+        }
+      }
+      break;
+    case cloud::CloudMessage_Operation_SCAN:
+      if (!msg.success()) {
+        fmt::print("{}\n", msg.message());
+      } else {
+        for (const auto &kvp : msg.kvp()) {
+          fmt::print("Key:\t{}\nValue:\t{}\n", kvp.key(), kvp.value());
+        }
+        if (!msg.range().token().empty()) {
+          fmt::print("Next:\t{}\n", msg.range().token());
+        }
+      }
+      break;
+    case cloud::CloudMessage_Operation_RAFT_TRANSFER_LEADERSHIP:
+      if (!msg.success()) {
+        fmt::print("{}\n", msg.message());
+      } else {
+        fmt::print("Leader:\t{}\n", msg.address().address());
       }
       break;
     case cloud::CloudMessage_Operation_RAFT_DROPPED_NODE:
@@ -89,6 +192,24 @@ auto main(int argc, char *argv[]) -> int {
         }
       }
       break;
+    case cloud::CloudMessage_Operation_STATS:
+      if (!msg.success()) {
+        fmt::print("{}\n", msg.message());
+        break;
+      }
+      fmt::print("{:<36}{:>10}{:>10}{:>10}{:>10}{:>10}{:>10}{:>10}\n",
+                 "latency (us)", "count", "mean", "p50", "p90", "p99", "p999",
+                 "max");
+      for (const auto &h : msg.histogram()) {
+        fmt::print("{:<36}{:>10}{:>10}{:>10}{:>10}{:>10}{:>10}{:>10}\n",
+                   h.name(), h.count(), h.mean(), h.p50(), h.p90(), h.p99(),
+                   h.p999(), h.max());
+      }
+      fmt::print("\n");
+      for (const auto &kvp : msg.kvp()) {
+        fmt::print("{:<46}{:>20}\n", kvp.key(), kvp.value());
+      }
+      break;
     default:
       fmt::print("{}\n", msg.message());
       break;
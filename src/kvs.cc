@@ -1,20 +1,82 @@
 #include "cloudlab/handler/api.hh"
 #include "cloudlab/handler/p2p.hh"
+#include "cloudlab/network/metrics.hh"
 #include "cloudlab/network/server.hh"
 #include "cloudlab/raft/raft.hh"
+#include "cloudlab/trace.hh"
 #include "argh.hh"
 #include <fmt/core.h>
 
 using namespace cloudlab;
 
+// periodically persist the storage engine, e.g. to restart a memory tier warm
+auto snapshot_worker(P2PHandler& handler, uint64_t interval_ms) -> void {
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+    if (!handler.snapshot()) fmt::print("snapshot failed\n");
+  }
+}
+
+// periodically place the partitions by load and split hot partitions
+auto rebalance_worker(P2PHandler& handler, uint64_t interval_ms) -> void {
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+    if (!handler.rebalance()) fmt::print("rebalance incomplete\n");
+  }
+}
+
+// append the spans of sampled requests to the trace file
+auto trace_worker() -> void {
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    if (!tracer().flush()) fmt::print("writing the trace file failed\n");
+  }
+}
+
 auto main(int argc, char* argv[]) -> int {
-  argh::parser cmdl({"-a", "--api", "-p", "--p2p"});
+  argh::parser cmdl({"-a", "--api", "-p", "--p2p", "--cache-mb", "--engine",
+                     "--snapshot-ms", "--rebalance-ms", "--metrics",
+                     "--trace-file", "--trace-sample"});
   cmdl.parse(argc, argv);
 
-  std::string api_address, p2p_address, clust_address;
+  std::string api_address, p2p_address, clust_address, engine;
+  std::string metrics_address, trace_file;
+  double trace_sample{};
+  size_t cache_mb{};
+  uint64_t snapshot_ms{}, rebalance_ms{};
   cmdl({"-a", "--api"}, "127.0.0.1:31000") >> api_address;
   cmdl({"-p", "--p2p"}, "127.0.0.1:32000") >> p2p_address;
   cmdl({"-c", "--ca"}, "127.0.0.1:41000") >> clust_address;
+  // hot-key cache budget in MiB, 0 disables the cache
+  cmdl({"--cache-mb"}, default_cache_capacity >> 20) >> cache_mb;
+  // storage engine: rocksdb or memory
+  cmdl({"--engine"}, "rocksdb") >> engine;
+  // snapshot interval of the storage engine, 0 disables snapshots
+  cmdl({"--snapshot-ms"}, 0) >> snapshot_ms;
+  // rebalance interval of the partition placement, 0 replicates every
+  // partition to every node
+  cmdl({"--rebalance-ms"}, 0) >> rebalance_ms;
+  // address of the Prometheus metrics listener, empty disables it
+  cmdl({"--metrics"}, "") >> metrics_address;
+  // Chrome trace file for the spans of sampled requests, empty disables it
+  cmdl({"--trace-file"}, "") >> trace_file;
+  // share of the client requests that are traced
+  cmdl({"--trace-sample"}, 0.01) >> trace_sample;
+
+  // sync the raft log and let the storage engine skip its own WAL
+  auto durable_log = cmdl[{"--durable-log"}];
+
+  StorageOptions options{parse_engine_type(engine), cache_mb << 20,
+                         durable_log};
+
+  if (!trace_file.empty()) {
+    auto node = cmdl[{"-l", "--leader"}] ? clust_address : p2p_address;
+    if (tracer().open(trace_file, trace_sample, node)) {
+      std::thread(trace_worker).detach();
+    } else {
+      fmt::print("could not open the trace file {}\n", trace_file);
+    }
+  }
 
   if (cmdl[{"-l", "--leader"}]) {
     auto routing = Routing(clust_address);
@@ -23,11 +85,26 @@ auto main(int argc, char* argv[]) -> int {
     auto api_server = Server(api_address, api_handler);
     auto api_thread = api_server.run();
 
-    auto p2p_handler = P2PHandler(routing);
+    auto p2p_handler = P2PHandler(routing, options);
     auto p2p_server = Server(clust_address, p2p_handler);
     p2p_handler.set_raft_leader();
     auto p2p_thread = p2p_server.run();
     auto raft_thread = p2p_handler.raft_run();
+    if (snapshot_ms > 0) {
+      std::thread(snapshot_worker, std::ref(p2p_handler), snapshot_ms).detach();
+    }
+    if (rebalance_ms > 0) {
+      std::thread(rebalance_worker, std::ref(p2p_handler), rebalance_ms)
+          .detach();
+    }
+    std::unique_ptr<MetricsServer> metrics;
+    if (!metrics_address.empty()) {
+      metrics = std::make_unique<MetricsServer>(
+          metrics_address, p2p_handler,
+          std::vector<std::pair<std::string, const Server*>>{
+              {"api", &api_server}, {"p2p", &p2p_server}});
+      metrics->run().detach();
+    }
 
     fmt::print("leader up and running ...\n");
 
@@ -45,11 +122,26 @@ auto main(int argc, char* argv[]) -> int {
     auto api_server = Server(api_address, api_handler);
     auto api_thread = api_server.run();
 
-    auto p2p_handler = P2PHandler(routing);
+    auto p2p_handler = P2PHandler(routing, options);
     auto p2p_server = Server(p2p_address, p2p_handler);
     p2p_handler.set_raft_follower();
     auto p2p_thread = p2p_server.run();
     auto raft_thread = p2p_handler.raft_run();
+    if (snapshot_ms > 0) {
+      std::thread(snapshot_worker, std::ref(p2p_handler), snapshot_ms).detach();
+    }
+    if (rebalance_ms > 0) {
+      std::thread(rebalance_worker, std::ref(p2p_handler), rebalance_ms)
+          .detach();
+    }
+    std::unique_ptr<MetricsServer> metrics;
+    if (!metrics_address.empty()) {
+      metrics = std::make_unique<MetricsServer>(
+          metrics_address, p2p_handler,
+          std::vector<std::pair<std::string, const Server*>>{
+              {"api", &api_server}, {"p2p", &p2p_server}});
+      metrics->run().detach();
+    }
 
     fmt::print("KVS up and running ...\n");
 
@@ -0,0 +1,333 @@
+#include "cloudlab/arena.hh"
+#include "cloudlab/kvs.hh"
+#include "cloudlab/network/address.hh"
+#include "cloudlab/network/connection.hh"
+#include "cloudlab/network/routing.hh"
+#include "cloudlab/raft/raft.hh"
+#include "cloudlab/spmc.hh"
+
+#include "cloud.pb.h"
+
+#include <benchmark/benchmark.h>
+#include <fmt/core.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/socket.h>
+
+using namespace cloudlab;
+
+// microbenchmarks of the hot-path components, run in isolation
+
+const auto bench_keys = 10000;
+
+static auto key_of(uint64_t i) -> std::string {
+  return fmt::format("key{:08}", i);
+}
+
+// every heap allocation of the process, to report allocator pressure
+static std::atomic<uint64_t> allocations{0};
+
+void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto* p = std::malloc(size == 0 ? 1 : size)) return p;
+  throw std::bad_alloc{};
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+// -------------------------------------------------------------------------
+// Connection: framing and (de)serialization of one message over a socketpair
+
+static void BM_ConnectionRoundTrip(benchmark::State& state) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    state.SkipWithError("socketpair() failed");
+    return;
+  }
+  // the connections own the sockets
+  Connection sender{fds[0]}, receiver{fds[1]};
+
+  cloud::CloudMessage msg{}, out{};
+  msg.set_type(cloud::CloudMessage_Type_REQUEST);
+  msg.set_operation(cloud::CloudMessage_Operation_PUT);
+  auto* kvp = msg.add_kvp();
+  kvp->set_key(key_of(42));
+  kvp->set_value(std::string(state.range(0), 'x'));
+
+  for (auto _ : state) {
+    // one message never exceeds the socket buffer, no second thread needed
+    if (!sender.send(msg) || !receiver.receive(out)) {
+      state.SkipWithError("send() / receive() failed");
+      break;
+    }
+    benchmark::DoNotOptimize(out);
+  }
+  state.SetBytesProcessed(state.iterations() * msg.ByteSizeLong());
+}
+BENCHMARK(BM_ConnectionRoundTrip)->RangeMultiplier(8)->Range(16, 64 << 10);
+
+// -------------------------------------------------------------------------
+// Messages: build, serialize and parse a request with N key-value pairs the
+// way a handler does, on the heap and on the request arena
+
+static auto fill_message(cloud::CloudMessage& msg, int64_t kvps) -> void {
+  msg.set_type(cloud::CloudMessage_Type_REQUEST);
+  msg.set_operation(cloud::CloudMessage_Operation_PUT);
+  for (auto i = 0; i < kvps; i++) {
+    auto* kvp = msg.add_kvp();
+    kvp->set_key(key_of(i));
+    kvp->set_value(std::string(100, 'x'));
+  }
+}
+
+static void BM_MessageHeap(benchmark::State& state) {
+  auto start = allocations.load();
+  for (auto _ : state) {
+    cloud::CloudMessage msg{}, parsed{};
+    fill_message(msg, state.range(0));
+    auto data = msg.SerializeAsString();
+    parsed.ParseFromString(data);
+    benchmark::DoNotOptimize(parsed);
+  }
+  state.counters["allocs"] = benchmark::Counter(
+      allocations.load() - start, benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_MessageHeap)->RangeMultiplier(8)->Range(1, 512);
+
+static void BM_MessageArena(benchmark::State& state) {
+  auto start = allocations.load();
+  for (auto _ : state) {
+    ArenaScope arena;
+    auto& msg = arena.create<cloud::CloudMessage>();
+    auto& parsed = arena.create<cloud::CloudMessage>();
+    fill_message(msg, state.range(0));
+    auto data = msg.SerializeAsString();
+    parsed.ParseFromString(data);
+    benchmark::DoNotOptimize(parsed);
+  }
+  state.counters["allocs"] = benchmark::Counter(
+      allocations.load() - start, benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_MessageArena)->RangeMultiplier(8)->Range(1, 512);
+
+// -------------------------------------------------------------------------
+// KVS: shared store, operations by thread count; arg 0 is the engine
+
+static std::unique_ptr<KVS> kvs;
+
+static auto kvs_path() -> std::filesystem::path {
+  return std::filesystem::temp_directory_path() / "kvs-microbench";
+}
+
+static void SetupKVS(const benchmark::State& state) {
+  auto engine = state.range(0) == 0 ? EngineType::MEMORY : EngineType::ROCKSDB;
+  std::filesystem::remove_all(kvs_path());
+  kvs = std::make_unique<KVS>(kvs_path().string(), true,
+                              StorageOptions{.engine = engine});
+  for (auto i = 0; i < bench_keys; i++) {
+    kvs->put(key_of(i), std::string(100, 'x'));
+  }
+}
+
+static void TeardownKVS(const benchmark::State&) {
+  kvs.reset();
+  std::filesystem::remove_all(kvs_path());
+}
+
+static void BM_KVSGet(benchmark::State& state) {
+  std::mt19937_64 rng(state.thread_index());
+  std::uniform_int_distribution<uint64_t> dist(0, bench_keys - 1);
+  std::string value;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(kvs->get(key_of(dist(rng)), value));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_KVSPut(benchmark::State& state) {
+  std::mt19937_64 rng(state.thread_index());
+  std::uniform_int_distribution<uint64_t> dist(0, bench_keys - 1);
+  const std::string value(100, 'y');
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(kvs->put(key_of(dist(rng)), value));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_KVSRemove(benchmark::State& state) {
+  // remove and re-insert, so the key space does not run dry
+  std::mt19937_64 rng(state.thread_index());
+  std::uniform_int_distribution<uint64_t> dist(0, bench_keys - 1);
+  const std::string value(100, 'z');
+  for (auto _ : state) {
+    auto key = key_of(dist(rng));
+    benchmark::DoNotOptimize(kvs->remove(key));
+    state.PauseTiming();
+    kvs->put(key, value);
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK(BM_KVSGet)
+    ->ArgName("rocksdb")
+    ->DenseRange(0, 1)
+    ->ThreadRange(1, 8)
+    ->Setup(SetupKVS)
+    ->Teardown(TeardownKVS)
+    ->UseRealTime();
+BENCHMARK(BM_KVSPut)
+    ->ArgName("rocksdb")
+    ->DenseRange(0, 1)
+    ->ThreadRange(1, 8)
+    ->Setup(SetupKVS)
+    ->Teardown(TeardownKVS)
+    ->UseRealTime();
+BENCHMARK(BM_KVSRemove)
+    ->ArgName("rocksdb")
+    ->DenseRange(0, 1)
+    ->ThreadRange(1, 8)
+    ->Setup(SetupKVS)
+    ->Teardown(TeardownKVS)
+    ->UseRealTime();
+
+// -------------------------------------------------------------------------
+// SPMCQueue: thread 0 produces, every other thread consumes
+
+static SPMCQueue<int> queue;
+
+static void BM_SPMCQueue(benchmark::State& state) {
+  if (state.threads() == 1) {
+    for (auto _ : state) {
+      queue.produce(1);
+      benchmark::DoNotOptimize(queue.consume());
+    }
+  } else if (state.thread_index() == 0) {
+    // every thread runs the same number of iterations, so one item per
+    // consumer and iteration balances the queue
+    for (auto _ : state) {
+      for (auto i = 1; i < state.threads(); i++) queue.produce(i);
+    }
+  } else {
+    for (auto _ : state) {
+      benchmark::DoNotOptimize(queue.consume());
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SPMCQueue)->ThreadRange(1, 8)->UseRealTime();
+
+// -------------------------------------------------------------------------
+// Routing: lookups on the published snapshot; arg 0 is the partition count
+
+static auto make_routing(uint32_t partitions) -> std::unique_ptr<Routing> {
+  auto routing = std::make_unique<Routing>("127.0.0.1:40000");
+  std::unordered_map<uint32_t, std::vector<SocketAddress>> placement;
+  for (uint32_t id = 0; id < partitions; id++) {
+    for (auto replica = 0; replica < 2; replica++) {
+      placement[id].emplace_back(
+          fmt::format("127.0.0.1:{}", 41000 + (id + replica) % 8));
+    }
+  }
+  routing->set_placement(std::move(placement));
+  return routing;
+}
+
+static void BM_RoutingFindPeer(benchmark::State& state) {
+  auto partitions = static_cast<uint32_t>(state.range(0));
+  auto routing = make_routing(partitions);
+  uint32_t id = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(routing->find_peer(id));
+    if (++id == partitions) id = 0;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RoutingFindPeer)->RangeMultiplier(8)->Range(8, 4096);
+
+static void BM_RoutingPartitionsByPeer(benchmark::State& state) {
+  auto routing = make_routing(static_cast<uint32_t>(state.range(0)));
+  std::vector<SocketAddress> peers;
+  for (auto i = 0; i < 8; i++) {
+    peers.emplace_back(fmt::format("127.0.0.1:{}", 41000 + i));
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    auto table = routing->snapshot();
+    auto it = table->by_peer.find(peers[i++ % peers.size()]);
+    benchmark::DoNotOptimize(it->second.size());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RoutingPartitionsByPeer)->RangeMultiplier(8)->Range(8, 4096);
+
+// -------------------------------------------------------------------------
+// SocketAddress: parsing and hashing
+
+static void BM_SocketAddressParse(benchmark::State& state) {
+  const std::string address =
+      state.range(0) == 0 ? "127.0.0.1:41000" : "[::1]:41000";
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(SocketAddress{address});
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SocketAddressParse)->ArgName("ipv6")->DenseRange(0, 1);
+
+static void BM_SocketAddressLookup(benchmark::State& state) {
+  // the typical use of the hash: connections and peers keyed by address
+  std::unordered_map<SocketAddress, size_t> peers;
+  std::vector<SocketAddress> addresses;
+  for (auto i = 0; i < state.range(0); i++) {
+    addresses.emplace_back(fmt::format("127.0.0.1:{}", 41000 + i));
+    peers.emplace(addresses.back(), i);
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(peers.find(addresses[i++ % addresses.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SocketAddressLookup)->RangeMultiplier(8)->Range(8, 512);
+
+// -------------------------------------------------------------------------
+// Raft: the leader ships the whole log with every heartbeat
+
+static void BM_RaftPrepareHeartbeat(benchmark::State& state) {
+  Raft raft{{}, "127.0.0.1:42000", false,
+            StorageOptions{.engine = EngineType::MEMORY}};
+
+  auto value = std::string(100, 'x');
+  for (auto i = 0; i < state.range(0); i++) {
+    LogEntryBuilder entry{EntryType::PUT};
+    entry.add(key_of(i), value);
+    raft.add_to_log(entry.release());
+  }
+
+  for (auto _ : state) {
+    cloud::CloudMessage hb{};
+    raft.prepare_heartbeat(hb);
+    benchmark::DoNotOptimize(hb);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.SetComplexityN(state.range(0));
+}
+BENCHMARK(BM_RaftPrepareHeartbeat)
+    ->RangeMultiplier(4)
+    ->Range(64, 64 << 10)
+    ->Complexity(benchmark::oN);
+
+BENCHMARK_MAIN();
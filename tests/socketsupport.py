@@ -30,7 +30,7 @@ def run_router(api_addr: str, router_addr: str):
     proc = subprocess.Popen(router, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
     return proc
 
-def run_leader(api_addr: str, clust_addr: str):
+def run_leader(api_addr: str, clust_addr: str, extra: list = []):
     leader = [
         find_project_executable("kvs-test"),
         "-a",
@@ -38,14 +38,14 @@ def run_leader(api_addr: str, clust_addr: str):
         "-c",
         clust_addr,
         "-l"
-    ]
+    ] + extra
 
     info("Run leader")
 
     proc = subprocess.Popen(leader, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
     return proc
 
-def run_kvs(api_addr: str, p2p_addr: str, clust_addr: str):
+def run_kvs(api_addr: str, p2p_addr: str, clust_addr: str, extra: list = []):
     kvs = [
         find_project_executable("kvs-test"),
         "-a",
@@ -54,7 +54,7 @@ def run_kvs(api_addr: str, p2p_addr: str, clust_addr: str):
         p2p_addr,
         "-c",
         clust_addr
-    ]
+    ] + extra
 
     info("Run kvs")
 
@@ -77,3 +77,11 @@ def run_ctl(api_addr: str, op: str, arg: str = ""):
     proc = run_project_executable("ctl-test", args, check=False)
     print(proc.stdout)
     return proc.stdout
+
+# the value of a counter line printed by `stats`, -1 if it is missing
+def counter(output: str, name: str) -> int:
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) == 2 and fields[0] == name:
+            return int(fields[1])
+    return -1
@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+
+import sys
+from time import sleep
+from testsupport import subtest, run
+from socketsupport import run_leader, run_kvs, run_ctl
+
+def kill_nodes(nodes) -> None:
+    for i in range(len(nodes)):
+        run(["kill", "-9", str(nodes[i][0].pid)])
+
+def main() -> None:
+    with subtest("Testing that spellings of one address are one peer"):
+        leader = run_leader("127.0.0.1:40300", "127.0.0.1:41300")
+        kvs1 = run_kvs("127.0.0.1:42300", "[::1]:43300", "127.0.0.1:41300")
+        kvs_list = [[leader, "127.0.0.1:40300", "127.0.0.1:41300"],
+                    [kvs1, "127.0.0.1:42300", "[::1]:43300"]]
+        sleep(2)
+
+        # both name the same resolved address
+        for address in ["[0:0:0:0:0:0:0:1]:43300", "[::1]:43300"]:
+            ctl = run_ctl("127.0.0.1:40300", "join", address)
+            if "OK" not in ctl:
+                kill_nodes(kvs_list)
+                sys.exit(1)
+        sleep(5)
+
+        ctl = run_ctl("127.0.0.1:40300", "put", "a 1 b 2")
+        if "OK" not in ctl:
+            kill_nodes(kvs_list)
+            sys.exit(1)
+        sleep(2)
+
+        peers = [line for line in run_ctl("127.0.0.1:40300", "stats").splitlines()
+                 if line.startswith("replication.") and line.split()[0].endswith(".lag")]
+        if len(peers) != 1 or not peers[0].startswith("replication.[::1]:43300"):
+            kill_nodes(kvs_list)
+            print("Failing first subtest")
+            sys.exit(1)
+
+        print("Passing first subtest")
+
+        # the follower recognizes itself in the configuration of the leader
+        ctl = run_ctl("127.0.0.1:42300", "direct_get", "a b")
+        if "Value:\t1" not in ctl or "Value:\t2" not in ctl:
+            kill_nodes(kvs_list)
+            print("Failing second subtest")
+            sys.exit(1)
+
+        print("Passing second subtest")
+        kill_nodes(kvs_list)
+        print("Test successful.")
+        sys.exit(0)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+
+import sys
+from testsupport import subtest, run
+from socketsupport import run_leader, run_ctl, counter
+from time import sleep
+
+def kill_nodes(nodes) -> None:
+    for i in range(len(nodes)):
+        run(["kill", "-9", str(nodes[i][0].pid)])
+
+def main() -> None:
+    with subtest("Testing the hot-key cache"):
+        leader = run_leader("127.0.0.1:40000", "127.0.0.1:41000")
+        kvs_list = [[leader, "127.0.0.1:40000", "127.0.0.1:41000"]]
+        sleep(2)
+
+        ctl = run_ctl("127.0.0.1:40000", "put", "hot v1")
+        if "OK" not in ctl:
+            kill_nodes(kvs_list)
+            sys.exit(1)
+
+        # the first read fills the cache, the second one is a hit
+        for _ in range(2):
+            ctl = run_ctl("127.0.0.1:40000", "get", "hot")
+            if "Value:\tv1" not in ctl:
+                kill_nodes(kvs_list)
+                print("Failing first subtest")
+                sys.exit(1)
+        if counter(run_ctl("127.0.0.1:40000", "stats"), "cache.hits") < 1:
+            kill_nodes(kvs_list)
+            print("Failing first subtest")
+            sys.exit(1)
+
+        print("Passing first subtest")
+
+        # a put invalidates the cached value
+        ctl = run_ctl("127.0.0.1:40000", "put", "hot v2")
+        ctl = run_ctl("127.0.0.1:40000", "get", "hot")
+        if "Value:\tv2" not in ctl:
+            kill_nodes(kvs_list)
+            print("Failing second subtest")
+            sys.exit(1)
+
+        print("Passing second subtest")
+
+        # so does a delete
+        ctl = run_ctl("127.0.0.1:40000", "get", "hot")
+        ctl = run_ctl("127.0.0.1:40000", "del", "hot")
+        ctl = run_ctl("127.0.0.1:40000", "get", "hot")
+        if "Value:\tv2" in ctl or "Value:\tERROR" not in ctl:
+            kill_nodes(kvs_list)
+            print("Failing third subtest")
+            sys.exit(1)
+
+        print("Passing third subtest")
+        kill_nodes(kvs_list)
+        print("Test successful.")
+        sys.exit(0)
+
+if __name__ == "__main__":
+    main()
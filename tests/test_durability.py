@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+
+import sys
+from time import sleep
+from testsupport import subtest, run
+from socketsupport import run_leader, run_ctl, counter
+
+def kill_nodes(nodes) -> None:
+    for i in range(len(nodes)):
+        run(["kill", "-9", str(nodes[i][0].pid)])
+
+def main() -> None:
+    with subtest("Testing crash recovery with a durable raft log"):
+        durable = ["--durable-log"]
+        leader = run_leader("127.0.0.1:40100", "127.0.0.1:41100", durable)
+        kvs_list = [[leader, "127.0.0.1:40100", "127.0.0.1:41100"]]
+        sleep(2)
+
+        keys = [f"d{i:02d}" for i in range(20)]
+        for k in keys:
+            ctl = run_ctl("127.0.0.1:40100", "put", f"{k} v{k}")
+            if "OK" not in ctl:
+                kill_nodes(kvs_list)
+                sys.exit(1)
+
+        applied = counter(run_ctl("127.0.0.1:40100", "stats"), "raft.applied_index")
+        if applied < len(keys):
+            kill_nodes(kvs_list)
+            print("Failing first subtest")
+            sys.exit(1)
+
+        print("Passing first subtest")
+
+        # no clean shutdown: the memtables are lost, the log replays them
+        kill_nodes(kvs_list)
+        sleep(1)
+        leader = run_leader("127.0.0.1:40100", "127.0.0.1:41100", durable)
+        kvs_list = [[leader, "127.0.0.1:40100", "127.0.0.1:41100"]]
+        sleep(2)
+
+        if counter(run_ctl("127.0.0.1:40100", "stats"), "raft.applied_index") < applied:
+            kill_nodes(kvs_list)
+            print("Failing second subtest")
+            sys.exit(1)
+
+        ctl = run_ctl("127.0.0.1:40100", "get", " ".join(keys))
+        for k in keys:
+            if f"Key:\t{k}\nValue:\tv{k}" not in ctl:
+                kill_nodes(kvs_list)
+                print("Failing second subtest")
+                sys.exit(1)
+
+        print("Passing second subtest")
+        kill_nodes(kvs_list)
+        print("Test successful.")
+        sys.exit(0)
+
+if __name__ == "__main__":
+    main()
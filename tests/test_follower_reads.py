@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+
+import sys
+from time import sleep
+from testsupport import subtest, run
+from socketsupport import run_leader, run_kvs, run_ctl
+
+def kill_nodes(nodes) -> None:
+    for i in range(len(nodes)):
+        run(["kill", "-9", str(nodes[i][0].pid)])
+
+def main() -> None:
+    with subtest("Testing follower reads"):
+        leader = run_leader("127.0.0.1:40900", "127.0.0.1:41900")
+        kvs1 = run_kvs("127.0.0.1:42900", "127.0.0.1:43900", "127.0.0.1:41900")
+        kvs2 = run_kvs("127.0.0.1:44900", "127.0.0.1:45900", "127.0.0.1:41900")
+        kvs_list = [[leader, "127.0.0.1:40900", "127.0.0.1:41900"],
+                    [kvs1, "127.0.0.1:42900", "127.0.0.1:43900"],
+                    [kvs2, "127.0.0.1:44900", "127.0.0.1:45900"]]
+        sleep(2)
+
+        for node in kvs_list[1:]:
+            ctl = run_ctl("127.0.0.1:40900", "join", node[2])
+            if "OK" not in ctl:
+                kill_nodes(kvs_list)
+                sys.exit(1)
+        sleep(5)
+
+        for k in range(1, 21):
+            ctl = run_ctl("127.0.0.1:40900", "put", f"{k} 2")
+            if "OK" not in ctl:
+                kill_nodes(kvs_list)
+                sys.exit(1)
+        sleep(2)
+
+        # bounded follower reads: served locally or by the leader, never stale
+        for node in kvs_list:
+            ctl = run_ctl(node[1], "direct_get", "1 --max-staleness 2000 --min-index 20")
+            if "Value:\t2" not in ctl:
+                kill_nodes(kvs_list)
+                print("Failing first subtest")
+                sys.exit(1)
+
+        print("Passing first subtest")
+
+        # read-your-writes: a follower read with the write's index sees it
+        ctl = run_ctl("127.0.0.1:40900", "put", "99 3")
+        index = [l.split("\t")[1] for l in ctl.splitlines() if l.startswith("Index:")]
+        if not index:
+            kill_nodes(kvs_list)
+            print("Failing second subtest")
+            sys.exit(1)
+        for node in kvs_list[1:]:
+            ctl = run_ctl(node[1], "direct_get", f"99 --min-index {index[0]}")
+            if "Value:\t3" not in ctl:
+                kill_nodes(kvs_list)
+                print("Failing second subtest")
+                sys.exit(1)
+
+        print("Passing second subtest")
+        kill_nodes(kvs_list)
+        print("Test successful.")
+        sys.exit(0)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+
+import sys
+from time import sleep
+from testsupport import subtest, run
+from socketsupport import run_leader, run_kvs, run_ctl, counter
+
+def kill_nodes(nodes) -> None:
+    for i in range(len(nodes)):
+        run(["kill", "-9", str(nodes[i][0].pid)])
+
+def main() -> None:
+    with subtest("Testing leadership transfer"):
+        leader = run_leader("127.0.0.1:40700", "127.0.0.1:41700")
+        kvs1 = run_kvs("127.0.0.1:42700", "127.0.0.1:43700", "127.0.0.1:41700")
+        kvs2 = run_kvs("127.0.0.1:44700", "127.0.0.1:45700", "127.0.0.1:41700")
+        kvs_list = [[leader, "127.0.0.1:40700", "127.0.0.1:41700"],
+                    [kvs1, "127.0.0.1:42700", "127.0.0.1:43700"],
+                    [kvs2, "127.0.0.1:44700", "127.0.0.1:45700"]]
+        sleep(2)
+
+        for node in kvs_list[1:]:
+            ctl = run_ctl("127.0.0.1:40700", "add_node", node[2])
+            if "OK" not in ctl:
+                kill_nodes(kvs_list)
+                sys.exit(1)
+        sleep(5)
+
+        ctl = run_ctl("127.0.0.1:40700", "put", "before 1")
+        if "OK" not in ctl:
+            kill_nodes(kvs_list)
+            sys.exit(1)
+
+        ctl = run_ctl("127.0.0.1:40700", "transfer_leader", "127.0.0.1:43700")
+        if "Leader:\t127.0.0.1:43700" not in ctl:
+            kill_nodes(kvs_list)
+            print("Failing first subtest")
+            sys.exit(1)
+        sleep(2)
+
+        # every node follows the target, which has every entry
+        for node in kvs_list:
+            if "127.0.0.1:43700" not in run_ctl(node[1], "leader"):
+                kill_nodes(kvs_list)
+                print("Failing first subtest")
+                sys.exit(1)
+        if counter(run_ctl("127.0.0.1:40700", "stats"), "raft.leader") != 0:
+            kill_nodes(kvs_list)
+            print("Failing first subtest")
+            sys.exit(1)
+
+        print("Passing first subtest")
+
+        # the new leader takes writes and serves the old ones
+        ctl = run_ctl("127.0.0.1:42700", "put", "after 2")
+        if "OK" not in ctl:
+            kill_nodes(kvs_list)
+            print("Failing second subtest")
+            sys.exit(1)
+        ctl = run_ctl("127.0.0.1:42700", "get", "before after")
+        if "Value:\t1" not in ctl or "Value:\t2" not in ctl:
+            kill_nodes(kvs_list)
+            print("Failing second subtest")
+            sys.exit(1)
+
+        print("Passing second subtest")
+        kill_nodes(kvs_list)
+        print("Test successful.")
+        sys.exit(0)
+
+if __name__ == "__main__":
+    main()
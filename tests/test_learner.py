@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+
+import sys
+from time import sleep
+from testsupport import subtest, run
+from socketsupport import run_leader, run_kvs, run_ctl, counter
+
+def kill_nodes(nodes) -> None:
+    for i in range(len(nodes)):
+        run(["kill", "-9", str(nodes[i][0].pid)])
+
+def main() -> None:
+    with subtest("Testing learner catch-up and promotion"):
+        leader = run_leader("127.0.0.1:40500", "127.0.0.1:41500")
+        kvs1 = run_kvs("127.0.0.1:42500", "127.0.0.1:43500", "127.0.0.1:41500")
+        kvs_list = [[leader, "127.0.0.1:40500", "127.0.0.1:41500"],
+                    [kvs1, "127.0.0.1:42500", "127.0.0.1:43500"]]
+        sleep(2)
+
+        # the new node has to catch up with these first
+        keys = [f"l{i:02d}" for i in range(30)]
+        ctl = run_ctl("127.0.0.1:40500", "put", " ".join(f"{k} v{k}" for k in keys))
+        if "OK" not in ctl:
+            kill_nodes(kvs_list)
+            sys.exit(1)
+
+        ctl = run_ctl("127.0.0.1:40500", "add_node", "127.0.0.1:43500")
+        if "OK" not in ctl:
+            kill_nodes(kvs_list)
+            sys.exit(1)
+        sleep(5)
+
+        # it holds the log and votes now
+        if counter(run_ctl("127.0.0.1:42500", "stats"), "raft.learner") != 0:
+            kill_nodes(kvs_list)
+            print("Failing first subtest")
+            sys.exit(1)
+
+        ctl = run_ctl("127.0.0.1:42500", "direct_get", " ".join(keys))
+        for k in keys:
+            if f"Key:\t{k}\nValue:\tv{k}" not in ctl:
+                kill_nodes(kvs_list)
+                print("Failing first subtest")
+                sys.exit(1)
+
+        print("Passing first subtest")
+
+        # with two voters, entries commit once both hold them
+        ctl = run_ctl("127.0.0.1:40500", "put", "last 1")
+        index = [l.split("\t")[1] for l in ctl.splitlines() if l.startswith("Index:")]
+        sleep(2)
+        if not index or counter(run_ctl("127.0.0.1:40500", "stats"), "raft.commit_index") < int(index[0]):
+            kill_nodes(kvs_list)
+            print("Failing second subtest")
+            sys.exit(1)
+
+        print("Passing second subtest")
+        kill_nodes(kvs_list)
+        print("Test successful.")
+        sys.exit(0)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+
+import sys
+from time import sleep
+from testsupport import subtest, run
+from socketsupport import run_leader, run_kvs, run_ctl
+
+def kill_nodes(nodes) -> None:
+    for i in range(len(nodes)):
+        # stopped nodes are resumed first, so they do not linger
+        run(["kill", "-CONT", str(nodes[i][0].pid)])
+        run(["kill", "-9", str(nodes[i][0].pid)])
+
+def fail(nodes, subtest: str) -> None:
+    kill_nodes(nodes)
+    print(f"Failing {subtest} subtest")
+    sys.exit(1)
+
+def main() -> None:
+    with subtest("Testing truncation of uncommitted entries"):
+        leader = run_leader("127.0.0.1:40800", "127.0.0.1:41800")
+        kvs1 = run_kvs("127.0.0.1:42800", "127.0.0.1:43800", "127.0.0.1:41800")
+        kvs2 = run_kvs("127.0.0.1:44800", "127.0.0.1:45800", "127.0.0.1:41800")
+        kvs_list = [[leader, "127.0.0.1:40800", "127.0.0.1:41800"],
+                    [kvs1, "127.0.0.1:42800", "127.0.0.1:43800"],
+                    [kvs2, "127.0.0.1:44800", "127.0.0.1:45800"]]
+        sleep(2)
+
+        for node in kvs_list[1:]:
+            ctl = run_ctl("127.0.0.1:40800", "add_node", node[2])
+            if "OK" not in ctl:
+                fail(kvs_list, "first")
+        sleep(5)
+
+        ctl = run_ctl("127.0.0.1:40800", "put", "before 1")
+        if "OK" not in ctl:
+            fail(kvs_list, "first")
+
+        # without the followers the write cannot be committed, so it is
+        # neither acknowledged nor applied
+        for node in kvs_list[1:]:
+            run(["kill", "-STOP", str(node[0].pid)])
+        ctl = run_ctl("127.0.0.1:40800", "put", "lost 2")
+        if "OK" in ctl:
+            fail(kvs_list, "first")
+
+        print("Passing first subtest")
+
+        # the followers elect a new leader without the deposed one's write
+        run(["kill", "-STOP", str(leader.pid)])
+        for node in kvs_list[1:]:
+            run(["kill", "-CONT", str(node[0].pid)])
+        sleep(10)
+        new_leader = run_ctl("127.0.0.1:42800", "leader").strip()
+        nodes = [node for node in kvs_list[1:] if node[2] == new_leader]
+        if not nodes:
+            fail(kvs_list, "second")
+        ctl = run_ctl(nodes[0][1], "put", "kept 3")
+        if "OK" not in ctl:
+            fail(kvs_list, "second")
+
+        print("Passing second subtest")
+
+        # the deposed leader follows again and drops its uncommitted entry
+        run(["kill", "-CONT", str(leader.pid)])
+        sleep(5)
+        ctl = run_ctl("127.0.0.1:40800", "direct_get", "before lost kept")
+        if "Value:\t1" not in ctl or "Value:\t2" in ctl or "Value:\t3" not in ctl:
+            fail(kvs_list, "third")
+
+        print("Passing third subtest")
+        kill_nodes(kvs_list)
+        print("Test successful.")
+        sys.exit(0)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+
+import sys
+from time import sleep
+from testsupport import subtest, run
+from socketsupport import run_leader, run_ctl
+
+def kill_nodes(nodes) -> None:
+    for i in range(len(nodes)):
+        run(["kill", "-9", str(nodes[i][0].pid)])
+
+def keys_of(output: str):
+    return [line.split("\t", 1)[1] for line in output.splitlines() if line.startswith("Key:")]
+
+def main() -> None:
+    with subtest("Testing the in-memory storage engine"):
+        engine = ["--engine", "memory", "--snapshot-ms", "200"]
+        leader = run_leader("127.0.0.1:40000", "127.0.0.1:41000", engine)
+        kvs_list = [[leader, "127.0.0.1:40000", "127.0.0.1:41000"]]
+        sleep(2)
+
+        # more keys per partition than a memory cursor copies at once
+        keys = [f"m{i:04d}" for i in range(1200)]
+        for start in range(0, len(keys), 300):
+            pairs = " ".join(f"{k} v{k}" for k in keys[start:start + 300])
+            ctl = run_ctl("127.0.0.1:40000", "put", pairs)
+            if "OK" not in ctl:
+                kill_nodes(kvs_list)
+                sys.exit(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "scan", "m0000 m9999 --all")
+        if keys_of(ctl) != keys:
+            kill_nodes(kvs_list)
+            print("Failing first subtest")
+            sys.exit(1)
+
+        print("Passing first subtest")
+
+        ctl = run_ctl("127.0.0.1:40000", "del", "m0005")
+        ctl = run_ctl("127.0.0.1:40000", "get", "m0005 m0006")
+        if "Value:\tERROR" not in ctl or "Value:\tvm0006" not in ctl:
+            kill_nodes(kvs_list)
+            print("Failing second subtest")
+            sys.exit(1)
+
+        print("Passing second subtest")
+
+        # a restart loads the last snapshot
+        sleep(1)
+        kill_nodes(kvs_list)
+        sleep(1)
+        leader = run_leader("127.0.0.1:40000", "127.0.0.1:41000", engine)
+        kvs_list = [[leader, "127.0.0.1:40000", "127.0.0.1:41000"]]
+        sleep(2)
+
+        ctl = run_ctl("127.0.0.1:40000", "get", "m0005 m0006 m1199")
+        if "Value:\tERROR" not in ctl or "Value:\tvm0006" not in ctl or "Value:\tvm1199" not in ctl:
+            kill_nodes(kvs_list)
+            print("Failing third subtest")
+            sys.exit(1)
+
+        print("Passing third subtest")
+        kill_nodes(kvs_list)
+        print("Test successful.")
+        sys.exit(0)
+
+if __name__ == "__main__":
+    main()
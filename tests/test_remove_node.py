@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+
+import sys
+from time import sleep
+from testsupport import subtest, run
+from socketsupport import run_leader, run_kvs, run_ctl, counter
+
+def kill_nodes(nodes) -> None:
+    for i in range(len(nodes)):
+        run(["kill", "-9", str(nodes[i][0].pid)])
+
+def main() -> None:
+    with subtest("Testing the removal of voters"):
+        leader = run_leader("127.0.0.1:40600", "127.0.0.1:41600")
+        kvs1 = run_kvs("127.0.0.1:42600", "127.0.0.1:43600", "127.0.0.1:41600")
+        kvs2 = run_kvs("127.0.0.1:44600", "127.0.0.1:45600", "127.0.0.1:41600")
+        kvs_list = [[leader, "127.0.0.1:40600", "127.0.0.1:41600"],
+                    [kvs1, "127.0.0.1:42600", "127.0.0.1:43600"],
+                    [kvs2, "127.0.0.1:44600", "127.0.0.1:45600"]]
+        sleep(2)
+
+        for node in kvs_list[1:]:
+            ctl = run_ctl("127.0.0.1:40600", "add_node", node[2])
+            if "OK" not in ctl:
+                kill_nodes(kvs_list)
+                sys.exit(1)
+        sleep(5)
+
+        # a follower leaves through the joint configuration
+        ctl = run_ctl("127.0.0.1:40600", "remove_node", "127.0.0.1:43600")
+        if "OK" not in ctl:
+            kill_nodes(kvs_list)
+            print("Failing first subtest")
+            sys.exit(1)
+        sleep(3)
+
+        ctl = run_ctl("127.0.0.1:40600", "put", "after 1")
+        if "OK" not in ctl or counter(run_ctl("127.0.0.1:42600", "stats"), "raft.learner") != 1:
+            kill_nodes(kvs_list)
+            print("Failing first subtest")
+            sys.exit(1)
+        sleep(2)
+        ctl = run_ctl("127.0.0.1:42600", "direct_get", "after")
+        if "Value:\t1" in ctl or "127.0.0.1:43600" in run_ctl("127.0.0.1:40600", "dropped"):
+            kill_nodes(kvs_list)
+            print("Failing first subtest")
+            sys.exit(1)
+
+        print("Passing first subtest")
+
+        # the leader removes itself and steps down, the last voter takes over
+        ctl = run_ctl("127.0.0.1:40600", "remove_node", "127.0.0.1:41600")
+        if "OK" not in ctl:
+            kill_nodes(kvs_list)
+            print("Failing second subtest")
+            sys.exit(1)
+        sleep(8)
+
+        if "127.0.0.1:45600" not in run_ctl("127.0.0.1:44600", "leader") or \
+                counter(run_ctl("127.0.0.1:40600", "stats"), "raft.leader") != 0:
+            kill_nodes(kvs_list)
+            print("Failing second subtest")
+            sys.exit(1)
+
+        ctl = run_ctl("127.0.0.1:44600", "put", "last 2")
+        if "OK" not in ctl:
+            kill_nodes(kvs_list)
+            print("Failing second subtest")
+            sys.exit(1)
+
+        print("Passing second subtest")
+        kill_nodes(kvs_list)
+        print("Test successful.")
+        sys.exit(0)
+
+if __name__ == "__main__":
+    main()
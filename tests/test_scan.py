@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+
+import sys
+from time import sleep
+from testsupport import subtest, run
+from socketsupport import run_leader, run_ctl
+
+def kill_nodes(nodes) -> None:
+    for i in range(len(nodes)):
+        run(["kill", "-9", str(nodes[i][0].pid)])
+
+def keys_of(output: str):
+    return [line.split("\t", 1)[1] for line in output.splitlines() if line.startswith("Key:")]
+
+def main() -> None:
+    with subtest("Testing ordered scan"):
+        leader = run_leader("127.0.0.1:40000", "127.0.0.1:41000")
+        kvs_list = [[leader, "127.0.0.1:40000", "127.0.0.1:41000"]]
+        sleep(2)
+
+        keys = [f"k{i:02d}" for i in range(30)]
+        for k in reversed(keys):
+            ctl = run_ctl("127.0.0.1:40000", "put", f"{k} v{k}")
+            if "OK" not in ctl:
+                kill_nodes(kvs_list)
+                sys.exit(1)
+
+        ctl = run_ctl("127.0.0.1:40000", "scan", "k05 k15")
+        if keys_of(ctl) != keys[5:15]:
+            kill_nodes(kvs_list)
+            print("Failing first subtest")
+            sys.exit(1)
+
+        print("Passing first subtest")
+
+        # page through the whole store with a small limit
+        seen = []
+        token = ""
+        while True:
+            arg = "-n 7" if token == "" else f"-n 7 -t {token}"
+            ctl = run_ctl("127.0.0.1:40000", "scan", arg)
+            seen += keys_of(ctl)
+            nxt = [line.split("\t", 1)[1] for line in ctl.splitlines() if line.startswith("Next:")]
+            if not nxt:
+                break
+            token = nxt[0]
+
+        if seen != keys:
+            kill_nodes(kvs_list)
+            print("Failing second subtest")
+            sys.exit(1)
+
+        print("Passing second subtest")
+        kill_nodes(kvs_list)
+        print("Test successful.")
+        sys.exit(0)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+
+import sys
+from time import sleep
+from testsupport import subtest, run
+from socketsupport import run_leader, run_kvs, run_ctl
+
+def kill_nodes(nodes) -> None:
+    for i in range(len(nodes)):
+        run(["kill", "-9", str(nodes[i][0].pid)])
+
+def has_values(output: str, keys, value: str) -> bool:
+    return all(f"Key:\t{k}\nValue:\t{value}" in output for k in keys)
+
+def main() -> None:
+    with subtest("Testing partition transfers"):
+        leader = run_leader("127.0.0.1:40200", "127.0.0.1:41200")
+        kvs1 = run_kvs("127.0.0.1:42200", "127.0.0.1:43200", "127.0.0.1:41200")
+        kvs_list = [[leader, "127.0.0.1:40200", "127.0.0.1:41200"],
+                    [kvs1, "127.0.0.1:42200", "127.0.0.1:43200"]]
+        sleep(2)
+
+        ctl = run_ctl("127.0.0.1:40200", "join", "127.0.0.1:43200")
+        if "OK" not in ctl:
+            kill_nodes(kvs_list)
+            sys.exit(1)
+        sleep(5)
+
+        keys = [f"t{i:02d}" for i in range(40)]
+        ctl = run_ctl("127.0.0.1:40200", "put", " ".join(f"{k} 1" for k in keys))
+        if "OK" not in ctl:
+            kill_nodes(kvs_list)
+            sys.exit(1)
+        sleep(2)
+
+        # the follower gets a fresh copy of every partition
+        for partition in range(4):
+            ctl = run_ctl("127.0.0.1:40200", "transfer", f"{partition} 127.0.0.1:43200")
+            if "OK" not in ctl:
+                kill_nodes(kvs_list)
+                print("Failing first subtest")
+                sys.exit(1)
+
+        # writes after the transfer are not overwritten by the copy
+        ctl = run_ctl("127.0.0.1:40200", "put", " ".join(f"{k} 2" for k in keys))
+        sleep(2)
+        ctl = run_ctl("127.0.0.1:42200", "direct_get", " ".join(keys))
+        if not has_values(ctl, keys, "2"):
+            kill_nodes(kvs_list)
+            print("Failing first subtest")
+            sys.exit(1)
+
+        print("Passing first subtest")
+
+        # and the leader takes them back
+        for partition in range(4):
+            ctl = run_ctl("127.0.0.1:40200", "steal", f"{partition} 127.0.0.1:43200")
+            if "OK" not in ctl:
+                kill_nodes(kvs_list)
+                print("Failing second subtest")
+                sys.exit(1)
+
+        ctl = run_ctl("127.0.0.1:40200", "get", " ".join(keys))
+        if not has_values(ctl, keys, "2"):
+            kill_nodes(kvs_list)
+            print("Failing second subtest")
+            sys.exit(1)
+
+        print("Passing second subtest")
+        kill_nodes(kvs_list)
+        print("Test successful.")
+        sys.exit(0)
+
+if __name__ == "__main__":
+    main()